@@ -0,0 +1,547 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * loadgen.c - an open-loop load generator with latency histograms
+ *
+ * Requests are issued on a schedule (fixed or Poisson inter-arrival
+ * times) that does not depend on the responses, and the latency of a
+ * request is measured from its scheduled time. A server that falls
+ * behind therefore shows up in the latency distribution instead of
+ * slowing down the client (no coordinated omission).
+ *
+ * Each core owns a share of the connections and of the rate. Due
+ * requests are assigned to an idle connection of the core, pipelining
+ * up to LG_MAX_OUTSTANDING per connection; when none is available they
+ * wait in a per-core backlog. Responses are matched to requests in
+ * order.
+ *
+ * Once the measurement ends, each core stops scheduling and waits up to
+ * LG_DRAIN for its backlogged and in-flight requests; those still
+ * outstanding after that are reported as incomplete. A core stops
+ * recording when it finishes, and the last core to finish merges the
+ * per-core histograms.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <ixev.h>
+#include <ixev_timer.h>
+#include <ix/latsketch.h>
+#include <net/ip.h>
+
+#define LG_MAX_CORES		64
+#define LG_MAX_OUTSTANDING	32	/* pipelined requests per connection */
+#define LG_BACKLOG		4096	/* due requests waiting for a connection */
+#define LG_RECV_CHUNK		65536
+#define LG_DRAIN		1.0	/* seconds to wait for outstanding requests */
+#define LG_DRAIN_POLL_US	100
+
+struct lg_core;
+
+struct lg_conn {
+	struct ixev_ctx ctx;
+	struct lg_core *core;
+	bool connected;
+	bool blocked;		/* waiting for IXEVOUT */
+	size_t send_left;	/* bytes left of the request being sent */
+	size_t recv_bytes;	/* bytes received of the current response */
+	unsigned int head, tail;
+	uint64_t sched[LG_MAX_OUTSTANDING];	/* scheduled TSC of requests */
+};
+
+struct lg_core {
+	struct lg_conn *conns;
+	int nr_conns;
+	int nr_connected;
+	int rr;			/* next connection to try */
+	double rate;		/* requests per cycle */
+	uint64_t seed;
+
+	struct ixev_timer timer;
+	uint64_t next_tsc;
+	uint64_t measure_tsc;
+	uint64_t end_tsc;
+	uint64_t drain_tsc;
+	bool done;
+
+	unsigned int bl_head, bl_tail;
+	uint64_t backlog[LG_BACKLOG];
+
+	uint64_t issued;	/* requests scheduled in the measurement */
+	uint64_t completed;	/* of which completed */
+	uint64_t overflow;	/* of which dropped, backlog full */
+	uint64_t incomplete;	/* of which still outstanding at the end */
+	struct latsketch lat;	/* ns */
+};
+
+static struct ip_tuple server;
+static size_t req_size = 64;
+static size_t resp_size = 64;
+static int nr_conns_total = 1;
+static double rate_total = 10000;
+static bool poisson = true;
+static double duration = 10;
+static double warmup = 1;
+
+static int nr_cores;
+static struct lg_core *cores[LG_MAX_CORES];
+static int next_core;
+static int finished_cores;
+static double cycles_per_ns;
+
+static char *req_buf;
+static __thread char *recv_buf;
+
+static void lg_calibrate(void)
+{
+	struct timeval start, now;
+	uint64_t tsc;
+	long us;
+
+	gettimeofday(&start, NULL);
+	tsc = rdtsc();
+	do {
+		gettimeofday(&now, NULL);
+		us = (now.tv_sec - start.tv_sec) * 1000000 +
+		     now.tv_usec - start.tv_usec;
+	} while (us < 100000);
+
+	cycles_per_ns = (double) (rdtsc() - tsc) / (us * 1000);
+}
+
+static double lg_random(struct lg_core *core)
+{
+	/* xorshift64*, uniform in (0, 1] */
+	core->seed ^= core->seed >> 12;
+	core->seed ^= core->seed << 25;
+	core->seed ^= core->seed >> 27;
+	return ((core->seed * 2685821657736338717ull) >> 11) * (1.0 / (1ull << 53)) +
+	       (1.0 / (1ull << 53));
+}
+
+static uint64_t lg_interarrival(struct lg_core *core)
+{
+	if (poisson)
+		return -log(lg_random(core)) / core->rate;
+
+	return 1 / core->rate;
+}
+
+static void lg_die(const char *msg)
+{
+	fprintf(stderr, "loadgen: %s\n", msg);
+	exit(1);
+}
+
+static void lg_send(struct lg_conn *conn)
+{
+	ssize_t ret;
+
+	ret = ixev_send(&conn->ctx, &req_buf[req_size - conn->send_left],
+			conn->send_left);
+	if (ret == -EAGAIN) {
+		conn->blocked = true;
+		return;
+	}
+	if (ret < 0)
+		lg_die("send failed");
+
+	conn->send_left -= ret;
+	conn->blocked = conn->send_left > 0;
+}
+
+/*
+ * Assigns backlogged requests to connections that are not in the middle
+ * of sending a request and have room in their pipeline.
+ */
+static void lg_dispatch(struct lg_core *core)
+{
+	struct lg_conn *conn;
+	int tried = 0;
+
+	while (core->bl_head != core->bl_tail && tried < core->nr_conns) {
+		conn = &core->conns[core->rr];
+		core->rr = (core->rr + 1) % core->nr_conns;
+
+		if (conn->blocked || conn->send_left ||
+		    conn->tail - conn->head >= LG_MAX_OUTSTANDING) {
+			tried++;
+			continue;
+		}
+
+		conn->sched[conn->tail++ % LG_MAX_OUTSTANDING] =
+			core->backlog[core->bl_head++ % LG_BACKLOG];
+		conn->send_left = req_size;
+		lg_send(conn);
+		tried = 0;
+	}
+}
+
+static void lg_finish(struct lg_core *core);
+
+/* returns the measured requests that are backlogged or in flight */
+static uint64_t lg_outstanding(struct lg_core *core)
+{
+	return core->issued - core->completed - core->overflow;
+}
+
+static void lg_complete(struct lg_core *core, uint64_t sched, uint64_t now)
+{
+	/* the results of a finished core may be merged at any time */
+	if (core->done)
+		return;
+
+	if (sched < core->measure_tsc || sched >= core->end_tsc)
+		return;
+
+	latsketch_add(&core->lat, (now - sched) / cycles_per_ns);
+	core->completed++;
+}
+
+static void lg_handler(struct ixev_ctx *ctx, unsigned int reason)
+{
+	struct lg_conn *conn = container_of(ctx, struct lg_conn, ctx);
+	struct lg_core *core = conn->core;
+	uint64_t now;
+	ssize_t ret;
+
+	if (reason & IXEVHUP)
+		lg_die("remote connection was closed");
+
+	if ((reason & IXEVOUT) && conn->blocked)
+		lg_send(conn);
+
+	if (reason & IXEVIN) {
+		while (1) {
+			ret = ixev_recv(ctx, recv_buf, LG_RECV_CHUNK);
+			if (ret <= 0) {
+				if (ret != -EAGAIN)
+					lg_die("recv failed");
+				break;
+			}
+
+			now = rdtsc();
+			conn->recv_bytes += ret;
+			while (conn->recv_bytes >= resp_size &&
+			       conn->head != conn->tail) {
+				conn->recv_bytes -= resp_size;
+				lg_complete(core, conn->sched[conn->head++ %
+					    LG_MAX_OUTSTANDING], now);
+			}
+		}
+	}
+
+	lg_dispatch(core);
+
+	if (!core->done && core->end_tsc && rdtsc() >= core->end_tsc &&
+	    !lg_outstanding(core))
+		lg_finish(core);
+}
+
+/*
+ * Stops recording on this core. The atomic increment orders the final
+ * counters and histogram of each core before the merge, which the last
+ * core to finish performs.
+ */
+static void lg_finish(struct lg_core *core)
+{
+	struct latsketch lat;
+	uint64_t issued = 0, completed = 0, overflow = 0, incomplete = 0;
+	int i;
+
+	if (core->done)
+		return;
+
+	core->incomplete = lg_outstanding(core);
+	core->done = true;
+	if (__sync_add_and_fetch(&finished_cores, 1) != nr_cores)
+		return;
+
+	memset(&lat, 0, sizeof(lat));
+	for (i = 0; i < nr_cores; i++) {
+		latsketch_merge(&lat, &cores[i]->lat, 1);
+		issued += cores[i]->issued;
+		completed += cores[i]->completed;
+		overflow += cores[i]->overflow;
+		incomplete += cores[i]->incomplete;
+	}
+
+	printf("{\"offered_rps\": %.0f, \"issued_rps\": %.0f, "
+	       "\"throughput_rps\": %.0f, \"dropped\": %lu, "
+	       "\"incomplete\": %lu, "
+	       "\"mean_us\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, "
+	       "\"p999_us\": %.2f}\n",
+	       rate_total, issued / duration, completed / duration,
+	       (unsigned long) overflow, (unsigned long) incomplete,
+	       lat.count ? (double) lat.sum / lat.count / 1000 : 0.0,
+	       latsketch_quantile(&lat, 0.5) / 1000.0,
+	       latsketch_quantile(&lat, 0.99) / 1000.0,
+	       latsketch_quantile(&lat, 0.999) / 1000.0);
+	fflush(stdout);
+	exit(0);
+}
+
+static void lg_tick(void *arg)
+{
+	struct lg_core *core = arg;
+	struct timeval tv;
+	uint64_t now = rdtsc(), delay;
+
+	if (core->done)
+		return;
+
+	if (now >= core->end_tsc) {
+		lg_dispatch(core);
+		if (!lg_outstanding(core) || now >= core->drain_tsc) {
+			lg_finish(core);
+			return;
+		}
+
+		tv.tv_sec = 0;
+		tv.tv_usec = LG_DRAIN_POLL_US;
+		ixev_timer_add(&core->timer, tv);
+		return;
+	}
+
+	while (core->next_tsc <= now && core->next_tsc < core->end_tsc) {
+		if (core->next_tsc >= core->measure_tsc)
+			core->issued++;
+
+		if (core->bl_tail - core->bl_head < LG_BACKLOG)
+			core->backlog[core->bl_tail++ % LG_BACKLOG] = core->next_tsc;
+		else if (core->next_tsc >= core->measure_tsc)
+			core->overflow++;
+
+		core->next_tsc += lg_interarrival(core);
+	}
+
+	lg_dispatch(core);
+
+	now = rdtsc();
+	delay = core->next_tsc > now ?
+		(core->next_tsc - now) / cycles_per_ns / 1000 : 0;
+	if (core->next_tsc >= core->end_tsc)
+		delay = core->end_tsc > now ?
+			(core->end_tsc - now) / cycles_per_ns / 1000 : 0;
+	tv.tv_sec = delay / 1000000;
+	tv.tv_usec = delay % 1000000 ? delay % 1000000 : 1;
+	ixev_timer_add(&core->timer, tv);
+}
+
+static void lg_start(struct lg_core *core)
+{
+	uint64_t now = rdtsc();
+
+	core->next_tsc = now;
+	core->measure_tsc = now + warmup * 1e9 * cycles_per_ns;
+	core->end_tsc = core->measure_tsc + duration * 1e9 * cycles_per_ns;
+	core->drain_tsc = core->end_tsc + LG_DRAIN * 1e9 * cycles_per_ns;
+	lg_tick(core);
+}
+
+static struct ixev_ctx *lg_accept(struct ip_tuple *id)
+{
+	return NULL;
+}
+
+static void lg_release(struct ixev_ctx *ctx) { }
+
+static void lg_dialed(struct ixev_ctx *ctx, long ret)
+{
+	struct lg_conn *conn = container_of(ctx, struct lg_conn, ctx);
+	struct lg_core *core = conn->core;
+
+	if (ret)
+		lg_die("failed to connect");
+
+	conn->connected = true;
+	ixev_set_handler(ctx, IXEVIN | IXEVOUT | IXEVHUP, &lg_handler);
+
+	if (++core->nr_connected == core->nr_conns)
+		lg_start(core);
+}
+
+static struct ixev_conn_ops lg_conn_ops = {
+	.accept		= &lg_accept,
+	.release	= &lg_release,
+	.dialed		= &lg_dialed,
+};
+
+static void *lg_main(void *arg)
+{
+	struct lg_core *core;
+	int i, idx, ret;
+
+	ret = ixev_init_thread();
+	if (ret)
+		lg_die("unable to init IXEV");
+
+	idx = __sync_fetch_and_add(&next_core, 1);
+	core = calloc(1, sizeof(*core));
+	recv_buf = malloc(LG_RECV_CHUNK);
+	if (!core || !recv_buf)
+		lg_die("out of memory");
+	cores[idx] = core;
+
+	core->nr_conns = nr_conns_total / nr_cores +
+			 (idx < nr_conns_total % nr_cores);
+	core->rate = rate_total * core->nr_conns / nr_conns_total /
+		     (1e9 * cycles_per_ns);
+	core->seed = 0x9e3779b97f4a7c15ull * (idx + 1);
+
+	if (!core->nr_conns) {
+		lg_finish(core);
+		while (1)
+			ixev_wait();
+	}
+
+	core->conns = calloc(core->nr_conns, sizeof(struct lg_conn));
+	if (!core->conns)
+		lg_die("out of memory");
+
+	if (!ixev_timer_init(&core->timer, lg_tick, core))
+		lg_die("unable to create timer");
+
+	for (i = 0; i < core->nr_conns; i++) {
+		core->conns[i].core = core;
+		ixev_ctx_init(&core->conns[i].ctx);
+		ixev_dial(&core->conns[i].ctx, &server);
+	}
+
+	while (1)
+		ixev_wait();
+
+	return NULL;
+}
+
+static int parse_ip_addr(const char *str, uint32_t *addr)
+{
+	unsigned char a, b, c, d;
+
+	if (sscanf(str, "%hhu.%hhu.%hhu.%hhu", &a, &b, &c, &d) != 4)
+		return -EINVAL;
+
+	*addr = MAKE_IP_ADDR(a, b, c, d);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options] IP PORT\n", prog);
+	fprintf(stderr, "  -r RATE     offered load in requests/s (default: 10000)\n");
+	fprintf(stderr, "  -a DIST     inter-arrival distribution: poisson or fixed (default: poisson)\n");
+	fprintf(stderr, "  -c CONNS    number of connections, spread over all cores (default: 1)\n");
+	fprintf(stderr, "  -q BYTES    request size (default: 64)\n");
+	fprintf(stderr, "  -s BYTES    response size (default: 64, must match the server)\n");
+	fprintf(stderr, "  -d SECONDS  measurement duration (default: 10)\n");
+	fprintf(stderr, "  -w SECONDS  warm-up, excluded from the results (default: 1)\n");
+	fprintf(stderr, "Prints one JSON object with throughput and latency percentiles.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t tid;
+	uint32_t addr;
+	int i, opt, ret;
+
+	while ((opt = getopt(argc, argv, "r:a:c:q:s:d:w:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			rate_total = atof(optarg);
+			break;
+		case 'a':
+			if (!strcmp(optarg, "poisson"))
+				poisson = true;
+			else if (!strcmp(optarg, "fixed"))
+				poisson = false;
+			else
+				goto bad_usage;
+			break;
+		case 'c':
+			nr_conns_total = atoi(optarg);
+			break;
+		case 'q':
+			req_size = atol(optarg);
+			break;
+		case 's':
+			resp_size = atol(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'w':
+			warmup = atof(optarg);
+			break;
+		default:
+			goto bad_usage;
+		}
+	}
+
+	if (argc - optind != 2 || rate_total <= 0 || nr_conns_total <= 0 ||
+	    !req_size || !resp_size || duration <= 0 || warmup < 0)
+		goto bad_usage;
+
+	if (parse_ip_addr(argv[optind], &addr)) {
+		fprintf(stderr, "Bad IP address '%s'\n", argv[optind]);
+		return 1;
+	}
+	server.dst_ip = addr;
+	server.dst_port = atoi(argv[optind + 1]);
+
+	req_buf = calloc(1, req_size);
+	if (!req_buf)
+		lg_die("out of memory");
+
+	lg_calibrate();
+
+	ret = ixev_init(&lg_conn_ops);
+	if (ret)
+		lg_die("failed to initialize ixev");
+
+	nr_cores = sys_nrcpus();
+	if (nr_cores < 1 || nr_cores > LG_MAX_CORES)
+		lg_die("invalid cpu count");
+
+	sys_spawnmode(true);
+
+	for (i = 1; i < nr_cores; i++) {
+		if (pthread_create(&tid, NULL, lg_main, NULL))
+			lg_die("failed to spawn thread");
+	}
+
+	lg_main(NULL);
+	return 0;
+
+bad_usage:
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,411 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * bench.c - runs the dataplane microbenchmarks and compares the results
+ * against a baseline
+ *
+ * Each benchmark is calibrated until one run takes at least the target
+ * time, then repeated; the median and minimum cost per operation are
+ * reported as one JSON object per line on stdout. With -b, the minimums
+ * are compared against a previous output and the exit status is non-zero
+ * if any benchmark slowed down by more than the threshold, or by more
+ * than its own noise (the spread between the minimum and the upper
+ * quartile of the repetitions) if that is larger. A slowdown has to
+ * survive BENCH_RETRIES re-measurements to count.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include <ix/stddef.h>
+#include <ix/errno.h>
+#include <ix/log.h>
+#include <ix/cpu.h>
+#include <ix/cfg.h>
+#include <ix/timer.h>
+#include <ix/mbuf.h>
+#include <ix/control_plane.h>
+
+#include <net/ip.h>
+#include <net/ethernet.h>
+
+#include <asm/cpu.h>
+
+#include "../dp/net/net.h"
+#include "bench.h"
+
+#define BENCH_MAX_REPS		64
+#define BENCH_MAX_RESULTS	256
+#define BENCH_RETRIES		3
+
+volatile uint64_t bench_sink;
+
+extern int memp_init(void);
+extern int memp_init_cpu(void);
+
+static int init_firstcpu(void);
+
+struct init_vector_t {
+	const char *name;
+	int (*f)(void);
+	int (*fcpu)(void);
+};
+
+/* a subset of the dataplane init table, in the same order */
+static struct init_vector_t init_tbl[] = {
+	{ "CPU",     cpu_init,     NULL},
+	{ "timer",   timer_init,   timer_init_cpu},
+	{ "arp",     arp_init,     NULL},
+	{ "firstcpu", init_firstcpu, NULL},
+	{ "mbuf",    mbuf_init,    mbuf_init_cpu},        // after firstcpu
+	{ "memp",    memp_init,    memp_init_cpu},
+	{ NULL, NULL, NULL}
+};
+
+static struct bench_vector *bench_tbls[] = {
+	bench_core_tbl,
+	bench_net_tbl,
+	bench_tcp_tbl,
+	NULL,
+};
+
+struct bench_result {
+	char name[64];
+	double min_cycles_per_op;
+};
+
+static struct bench_result baseline[BENCH_MAX_RESULTS];
+static int nr_baseline;
+
+static int opt_reps = 11;
+static int opt_min_us = 10000;
+static double opt_threshold = 10.0;
+static const char *opt_filter;
+static const char *opt_baseline;
+
+static int init_firstcpu(void)
+{
+	return cpu_init_one(CFG.cpu[0]);
+}
+
+/*
+ * The dataplane reports to stdout; divert it to stderr while it runs
+ * set-up code so that stdout only carries the results.
+ */
+static int stdout_divert(void)
+{
+	int out;
+
+	fflush(stdout);
+	out = dup(STDOUT_FILENO);
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+	return out;
+}
+
+static void stdout_restore(int out)
+{
+	fflush(stdout);
+	dup2(out, STDOUT_FILENO);
+	close(out);
+}
+
+static int bench_init(void)
+{
+	int i, ret, out;
+
+	cp_shmem = calloc(1, sizeof(*cp_shmem));
+	if (!cp_shmem)
+		return -ENOMEM;
+
+	CFG.host_addr.addr = MAKE_IP_ADDR(10, 0, 0, 1);
+	CFG.mask = MAKE_IP_ADDR(255, 255, 255, 0);
+	CFG.mtu = ETH_MTU;
+	CFG.num_cpus = 1;
+	CFG.cpu[0] = sched_getcpu();
+
+	out = stdout_divert();
+	ret = 0;
+	for (i = 0; init_tbl[i].name && !ret; i++) {
+		if (!init_tbl[i].f)
+			continue;
+		ret = init_tbl[i].f();
+		if (ret)
+			log_err("bench: module %s failed (%d)\n",
+				init_tbl[i].name, ret);
+	}
+
+	for (i = 0; init_tbl[i].name && !ret; i++) {
+		if (!init_tbl[i].fcpu)
+			continue;
+		ret = init_tbl[i].fcpu();
+		if (ret)
+			log_err("bench: per-cpu module %s failed (%d)\n",
+				init_tbl[i].name, ret);
+	}
+
+	stdout_restore(out);
+	return ret;
+}
+
+static uint64_t bench_time(struct bench_vector *b, unsigned long iters)
+{
+	unsigned int aux;
+	uint64_t start;
+
+	start = rdtscp(&aux);
+	b->run(iters);
+	return rdtscp(&aux) - start;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static struct bench_result *baseline_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nr_baseline; i++)
+		if (!strcmp(baseline[i].name, name))
+			return &baseline[i];
+
+	return NULL;
+}
+
+/* runs the repetitions and sorts their cost per operation */
+static void bench_measure(struct bench_vector *b, unsigned long iters,
+			  double *samples)
+{
+	int i;
+
+	for (i = 0; i < opt_reps; i++)
+		samples[i] = (double) bench_time(b, iters) / iters;
+	qsort(samples, opt_reps, sizeof(double), cmp_double);
+}
+
+/*
+ * The minimum is the least disturbed repetition, so it is what gets
+ * compared. Benchmarks that are noisy even so, like the timer expiry
+ * ones that idle, get a threshold that clears their spread.
+ */
+static double bench_delta(struct bench_result *base, double *samples)
+{
+	return (samples[0] - base->min_cycles_per_op) * 100 /
+	       base->min_cycles_per_op;
+}
+
+static double bench_limit(double *samples)
+{
+	double noise = (samples[opt_reps - 1 - opt_reps / 4] - samples[0]) *
+		       100 / samples[0];
+
+	return max(opt_threshold, noise);
+}
+
+/**
+ * bench_run - calibrates and runs one benchmark
+ * @b: the benchmark
+ *
+ * Returns 1 if the benchmark regressed against the baseline, otherwise 0.
+ */
+static int bench_run(struct bench_vector *b)
+{
+	uint64_t target = (uint64_t) opt_min_us * cycles_per_us;
+	double samples[BENCH_MAX_REPS], retry[BENCH_MAX_REPS];
+	double median, delta, limit;
+	unsigned long iters = 1;
+	struct bench_result *base;
+	uint64_t cycles;
+	int i, ret, out;
+
+	if (b->setup) {
+		out = stdout_divert();
+		ret = b->setup();
+		stdout_restore(out);
+		if (ret) {
+			fprintf(stderr, "bench: %s: setup failed, skipped\n",
+				b->name);
+			return 0;
+		}
+	}
+
+	/* warms up the caches as a side effect */
+	while ((cycles = bench_time(b, iters)) < target)
+		iters = cycles ? max(iters * 2, iters * target / cycles) : iters * 2;
+
+	/* only the measured repetitions count towards the error */
+	if (b->error_ns)
+		b->error_ns();
+	bench_measure(b, iters, samples);
+
+	/*
+	 * A slowdown that doesn't reproduce is interference from the rest
+	 * of the machine: keep the repetitions with the lowest minimum.
+	 */
+	base = baseline_find(b->name);
+	for (i = 0; base && i < BENCH_RETRIES &&
+	     bench_delta(base, samples) > bench_limit(samples); i++) {
+		bench_measure(b, iters, retry);
+		if (retry[0] < samples[0])
+			memcpy(samples, retry, opt_reps * sizeof(double));
+	}
+	median = samples[opt_reps / 2];
+
+	printf("{\"name\": \"%s\", \"iters\": %lu, \"cycles_per_op\": %.2f, "
+	       "\"min_cycles_per_op\": %.2f, \"ns_per_op\": %.2f",
+	       b->name, iters, median, samples[0],
+	       median * 1000 / cycles_per_us);
+	if (b->error_ns)
+		printf(", \"error_ns\": %.2f", b->error_ns());
+	printf("}\n");
+	fflush(stdout);
+
+	if (!base)
+		return 0;
+
+	delta = bench_delta(base, samples);
+	limit = bench_limit(samples);
+	fprintf(stderr, "%-28s %10.2f -> %10.2f min cycles/op %+7.1f%% (limit %.1f%%)%s\n",
+		b->name, base->min_cycles_per_op, samples[0], delta, limit,
+		delta > limit ? "  REGRESSION" : "");
+
+	return delta > limit;
+}
+
+static int baseline_load(const char *path)
+{
+	char line[512], *name, *end, *val;
+	const char *key = "\"min_cycles_per_op\": ";
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror("bench: can't open the baseline");
+		return -ENOENT;
+	}
+
+	while (fgets(line, sizeof(line), f) && nr_baseline < BENCH_MAX_RESULTS) {
+		name = strstr(line, "\"name\": \"");
+		val = strstr(line, key);
+		if (!name || !val)
+			continue;
+
+		name += strlen("\"name\": \"");
+		end = strchr(name, '"');
+		if (!end || end - name >= sizeof(baseline[0].name))
+			continue;
+
+		*end = '\0';
+		strcpy(baseline[nr_baseline].name, name);
+		baseline[nr_baseline].min_cycles_per_op =
+			strtod(val + strlen(key), NULL);
+		if (baseline[nr_baseline].min_cycles_per_op > 0)
+			nr_baseline++;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-f FILTER] [-r REPS] [-m MIN_US] "
+		"[-b BASELINE] [-t PERCENT] [-v]\n", prog);
+	fprintf(stderr, "  -f  only run benchmarks whose name contains FILTER\n");
+	fprintf(stderr, "  -r  repetitions per benchmark (default %d)\n", opt_reps);
+	fprintf(stderr, "  -m  minimum duration of one repetition in us (default %d)\n", opt_min_us);
+	fprintf(stderr, "  -b  compare against the output of a previous run\n");
+	fprintf(stderr, "  -t  regression threshold in percent (default %.0f)\n", opt_threshold);
+	fprintf(stderr, "  -v  show the dataplane log\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_vector *b;
+	int i, opt, regressions = 0;
+
+	max_loglevel = LOG_ERR;
+
+	while ((opt = getopt(argc, argv, "f:r:m:b:t:vh")) != -1) {
+		switch (opt) {
+		case 'f':
+			opt_filter = optarg;
+			break;
+		case 'r':
+			opt_reps = atoi(optarg);
+			if (opt_reps < 1 || opt_reps > BENCH_MAX_REPS)
+				usage(argv[0]);
+			break;
+		case 'm':
+			opt_min_us = atoi(optarg);
+			if (opt_min_us < 1)
+				usage(argv[0]);
+			break;
+		case 'b':
+			opt_baseline = optarg;
+			break;
+		case 't':
+			opt_threshold = atof(optarg);
+			break;
+		case 'v':
+			max_loglevel = LOG_DEBUG;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (opt_baseline && baseline_load(opt_baseline))
+		return EXIT_FAILURE;
+
+	if (bench_init()) {
+		fprintf(stderr, "bench: failed to set up the dataplane\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; bench_tbls[i]; i++) {
+		for (b = bench_tbls[i]; b->name; b++) {
+			if (opt_filter && !strstr(b->name, opt_filter))
+				continue;
+			regressions += bench_run(b);
+		}
+	}
+
+	if (opt_baseline && regressions) {
+		fprintf(stderr, "bench: %d benchmark(s) regressed by more than %.1f%%\n",
+			regressions, opt_threshold);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -21,28 +21,33 @@
  * THE SOFTWARE.
  */
 
+/*
+ * bench.h - dataplane microbenchmarks
+ */
 
 #pragma once
 
+#include <stdint.h>
 
-#define MIN_NINES 1 /* 90% */
-#define MAX_NINES 5 /* 99.999 */
-
-const char *tailqueue_nines[] = {"", "90%", "99%", "99.9%", "99.99%", "99.999"};
-
-
-struct tailqueue;
-
-struct taildistr {
-	uint64_t count, min, max;
-	uint64_t nines[MAX_NINES + 1]; /* nb: nines[0] is unused */
+/**
+ * struct bench_vector - a microbenchmark
+ * @name: the name reported with the result
+ * @setup: prepares state before the first run (optional); a non-zero
+ *         return skips the benchmark
+ * @run: performs @iters operations
+ * @error_ns: returns the mean error of the operations since the last
+ *            call, in nanoseconds (optional); reported as "error_ns"
+ */
+struct bench_vector {
+	const char *name;
+	int (*setup)(void);
+	void (*run)(unsigned long iters);
+	double (*error_ns)(void);
 };
 
-extern void tailqueue_addsample(struct tailqueue *tq,
-				uint64_t t_us);
-
-extern void tailqueue_calcnines(struct tailqueue *tq,
-				struct taildistr *td,
-				int reset);
-
+/* results are folded into this to keep the compiler from dropping work */
+extern volatile uint64_t bench_sink;
 
+extern struct bench_vector bench_core_tbl[];
+extern struct bench_vector bench_net_tbl[];
+extern struct bench_vector bench_tcp_tbl[];
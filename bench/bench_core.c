@@ -0,0 +1,472 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * bench_core.c - microbenchmarks for timers, mempools, hashing,
+ * checksums, kstats and cross-core calls
+ */
+
+#include <ix/stddef.h>
+#include <ix/errno.h>
+#include <ix/log.h>
+#include <ix/cpu.h>
+#include <ix/cfg.h>
+#include <ix/timer.h>
+#include <ix/mempool.h>
+#include <ix/hash.h>
+#include <ix/kstats.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <net/ethernet.h>
+
+#include <lwip/inet_chksum.h>
+
+#include "bench.h"
+
+#define BENCH_TIMERS		1024
+#define BENCH_MEMPOOL_ELEMS	16384
+#define BENCH_MEMPOOL_BATCH	32
+
+/*
+ * Timers
+ */
+
+static struct timer bench_timers[BENCH_TIMERS];
+
+static void bench_timer_handler(struct timer *t, struct eth_fg *cur_fg)
+{
+	/* keep the wheel populated if a run ever reaches the deadline */
+	timer_add(t, NULL, ONE_SECOND * 60);
+}
+
+static int bench_timer_setup(void)
+{
+	int i;
+
+	for (i = 0; i < BENCH_TIMERS; i++)
+		timer_init_entry(&bench_timers[i], bench_timer_handler);
+
+	return 0;
+}
+
+static void bench_timer_add_del(unsigned long iters)
+{
+	struct timer *t = &bench_timers[0];
+	unsigned long i;
+
+	for (i = 0; i < iters; i++) {
+		timer_add(t, NULL, 1000 + (i & 1023));
+		timer_del(t);
+	}
+}
+
+static int bench_timer_run_setup(void)
+{
+	int i;
+
+	for (i = 0; i < BENCH_TIMERS; i++)
+		timer_del(&bench_timers[i]);
+	bench_timer_setup();
+	for (i = 0; i < BENCH_TIMERS; i++)
+		timer_add(&bench_timers[i], NULL, ONE_SECOND * 30 + i * 1000);
+
+	return 0;
+}
+
+static void bench_timer_run(unsigned long iters)
+{
+	unsigned long i;
+
+	for (i = 0; i < iters; i++)
+		timer_run();
+}
+
+static void bench_timer_deadline(unsigned long iters)
+{
+	uint64_t sum = 0;
+	unsigned long i;
+
+	for (i = 0; i < iters; i++)
+		sum += timer_deadline(10 * ONE_MS);
+
+	bench_sink += sum;
+}
+
+/*
+ * Timer expiry error: each operation arms a timer and idles on
+ * timer_deadline() the way sys_bpoll() does until the timer fires.
+ */
+
+static struct timer bench_expiry_timer;
+static volatile uint64_t bench_expiry_fired;
+static uint64_t bench_expiry_err, bench_expiry_count;
+
+static void bench_expiry_handler(struct timer *t, struct eth_fg *cur_fg)
+{
+	bench_expiry_fired = rdtsc();
+}
+
+static int bench_timer_expiry_setup(void)
+{
+	timer_init_entry(&bench_expiry_timer, bench_expiry_handler);
+	bench_expiry_err = 0;
+	bench_expiry_count = 0;
+
+	return 0;
+}
+
+static void bench_timer_expiry(unsigned long iters, uint64_t usecs)
+{
+	uint64_t due, deadline, start;
+	unsigned long i;
+
+	for (i = 0; i < iters; i++) {
+		bench_expiry_fired = 0;
+		due = rdtsc() + usecs * cycles_per_us;
+		timer_add(&bench_expiry_timer, NULL, usecs);
+
+		for (;;) {
+			timer_run();
+			if (bench_expiry_fired)
+				break;
+			deadline = timer_deadline(10 * ONE_MS);
+			start = rdtsc();
+			while (rdtsc() - start < deadline * cycles_per_us)
+				cpu_relax();
+		}
+
+		bench_expiry_err += llabs((int64_t) (bench_expiry_fired - due));
+		bench_expiry_count++;
+	}
+}
+
+static void bench_timer_expiry_2us(unsigned long iters)
+{
+	bench_timer_expiry(iters, 2);
+}
+
+static void bench_timer_expiry_10us(unsigned long iters)
+{
+	bench_timer_expiry(iters, 10);
+}
+
+static void bench_timer_expiry_100us(unsigned long iters)
+{
+	bench_timer_expiry(iters, 100);
+}
+
+static double bench_timer_expiry_error_ns(void)
+{
+	double err = 0;
+
+	if (bench_expiry_count)
+		err = (double) bench_expiry_err * 1000 /
+		      bench_expiry_count / cycles_per_us;
+	bench_expiry_err = 0;
+	bench_expiry_count = 0;
+
+	return err;
+}
+
+/*
+ * Mempools
+ */
+
+static struct mempool_datastore bench_ds;
+static struct mempool bench_pool;
+
+static int bench_mempool_setup(void)
+{
+	static bool initialized;
+	int ret;
+
+	if (initialized)
+		return 0;
+
+	ret = mempool_create_datastore(&bench_ds, BENCH_MEMPOOL_ELEMS, 64, 0,
+				       MEMPOOL_DEFAULT_CHUNKSIZE, "bench");
+	if (ret)
+		return ret;
+
+	ret = mempool_create(&bench_pool, &bench_ds, MEMPOOL_SANITY_GLOBAL, 0);
+	if (ret)
+		return ret;
+
+	initialized = true;
+	return 0;
+}
+
+static void bench_mempool_alloc_free(unsigned long iters)
+{
+	unsigned long i;
+	void *p;
+
+	for (i = 0; i < iters; i++) {
+		p = mempool_alloc(&bench_pool);
+		mempool_free(&bench_pool, p);
+	}
+}
+
+static void bench_mempool_alloc_free_batch(unsigned long iters)
+{
+	void *p[BENCH_MEMPOOL_BATCH];
+	unsigned long i;
+	int j;
+
+	for (i = 0; i < iters; i += BENCH_MEMPOOL_BATCH) {
+		for (j = 0; j < BENCH_MEMPOOL_BATCH; j++)
+			p[j] = mempool_alloc(&bench_pool);
+		for (j = 0; j < BENCH_MEMPOOL_BATCH; j++)
+			mempool_free(&bench_pool, p[j]);
+	}
+}
+
+/*
+ * Hashing
+ */
+
+static void bench_hash_crc32c_one(unsigned long iters)
+{
+	uint32_t h = 0;
+	unsigned long i;
+
+	for (i = 0; i < iters; i++)
+		h = hash_crc32c_one(h, i);
+
+	bench_sink += h;
+}
+
+static void bench_hash_crc32c_two(unsigned long iters)
+{
+	uint32_t h = 0;
+	unsigned long i;
+
+	for (i = 0; i < iters; i++)
+		h = hash_crc32c_two(h, i, ~i);
+
+	bench_sink += h;
+}
+
+static void bench_hash_city_one(unsigned long iters)
+{
+	uint64_t h = 0;
+	unsigned long i;
+
+	for (i = 0; i < iters; i++)
+		h ^= hash_city_one(h + i);
+
+	bench_sink += h;
+}
+
+static void bench_hash_city_two(unsigned long iters)
+{
+	uint64_t h = 0;
+	unsigned long i;
+
+	for (i = 0; i < iters; i++)
+		h ^= hash_city_two(h + i, ~i);
+
+	bench_sink += h;
+}
+
+/*
+ * Checksums
+ */
+
+static unsigned char bench_payload[ETH_MTU] __aligned(64);
+
+static int bench_chksum_setup(void)
+{
+	int i;
+
+	for (i = 0; i < sizeof(bench_payload); i++)
+		bench_payload[i] = i * 31;
+
+	return 0;
+}
+
+static void bench_chksum(unsigned long iters, u16_t len)
+{
+	uint32_t sum = 0;
+	unsigned long i;
+
+	for (i = 0; i < iters; i++) {
+		bench_payload[0] = i;
+		sum += inet_chksum(bench_payload, len);
+	}
+
+	bench_sink += sum;
+}
+
+static void bench_chksum_64(unsigned long iters)
+{
+	bench_chksum(iters, 64);
+}
+
+static void bench_chksum_1500(unsigned long iters)
+{
+	bench_chksum(iters, ETH_MTU);
+}
+
+/*
+ * kstats
+ */
+
+static int bench_kstats_setup(void)
+{
+	KSTATS_VECTOR(none);
+	return 0;
+}
+
+static int bench_kstats_pmu_setup(void)
+{
+	CFG.kstats_pmu = (1 << KSTATS_PMU_NR_EVENTS) - 1;
+	if (kstats_init_pmu())
+		return -ENODEV;
+
+	KSTATS_VECTOR(none);
+	return 0;
+}
+
+static void bench_kstats_push_pop(unsigned long iters)
+{
+	kstats_accumulate save;
+	unsigned long i;
+
+	for (i = 0; i < iters; i++) {
+		KSTATS_PUSH(timer, &save);
+		KSTATS_POP(&save);
+	}
+}
+
+/*
+ * Cross-core calls: each operation is a round trip. A runner goes to a
+ * peer core through cpu_run_on_one(), the peer answers with a runner of
+ * its own, and both sides pick runners up in cpu_do_bookkeeping() the
+ * way the bpoll loop does. The peer thread sleeps between runs so that
+ * it doesn't disturb the other benchmarks.
+ */
+
+static unsigned int bench_home_cpu, bench_peer_cpu;
+static volatile int bench_peer_state;	/* 1 once up, -1 if it failed */
+static volatile bool bench_peer_run;
+static volatile bool bench_pong;
+
+static void bench_cpu_pong(void *data)
+{
+	bench_pong = true;
+}
+
+static void bench_cpu_ping(void *data)
+{
+	if (cpu_run_on_one(bench_cpu_pong, NULL, bench_home_cpu))
+		panic("bench: failed to answer a cross-core call\n");
+}
+
+static void *bench_cpu_peer(void *arg)
+{
+	if (cpu_init_one(bench_peer_cpu)) {
+		bench_peer_state = -1;
+		return NULL;
+	}
+
+	bench_peer_state = 1;
+	for (;;) {
+		if (!bench_peer_run) {
+			usleep(1000);
+			continue;
+		}
+		cpu_do_bookkeeping();
+	}
+
+	return NULL;
+}
+
+static int bench_cpu_setup(void)
+{
+	static bool started;
+	pthread_t tid;
+
+	if (started)
+		return bench_peer_state == 1 ? 0 : -ENODEV;
+	started = true;
+
+	if (cpu_count < 2)
+		return -ENODEV;
+
+	bench_home_cpu = percpu_get(cpu_id);
+	bench_peer_cpu = (bench_home_cpu + 1) % cpu_count;
+	if (pthread_create(&tid, NULL, bench_cpu_peer, NULL)) {
+		bench_peer_state = -1;
+		return -ENODEV;
+	}
+
+	while (!bench_peer_state)
+		cpu_relax();
+
+	return bench_peer_state == 1 ? 0 : -ENODEV;
+}
+
+static void bench_cpu_run_on_one(unsigned long iters)
+{
+	unsigned long i;
+
+	bench_peer_run = true;
+	for (i = 0; i < iters; i++) {
+		bench_pong = false;
+		if (cpu_run_on_one(bench_cpu_ping, NULL, bench_peer_cpu))
+			panic("bench: failed to make a cross-core call\n");
+
+		while (!bench_pong)
+			cpu_do_bookkeeping();
+	}
+	bench_peer_run = false;
+}
+
+struct bench_vector bench_core_tbl[] = {
+	{ "timer_add_del",		bench_timer_setup,	bench_timer_add_del },
+	{ "timer_run_1024",		bench_timer_run_setup,	bench_timer_run },
+	{ "timer_deadline_1024",	bench_timer_run_setup,	bench_timer_deadline },
+	{ "timer_expiry_2us",		bench_timer_expiry_setup, bench_timer_expiry_2us,
+	  bench_timer_expiry_error_ns },
+	{ "timer_expiry_10us",		bench_timer_expiry_setup, bench_timer_expiry_10us,
+	  bench_timer_expiry_error_ns },
+	{ "timer_expiry_100us",		bench_timer_expiry_setup, bench_timer_expiry_100us,
+	  bench_timer_expiry_error_ns },
+	{ "mempool_alloc_free",		bench_mempool_setup,	bench_mempool_alloc_free },
+	{ "mempool_alloc_free_32",	bench_mempool_setup,	bench_mempool_alloc_free_batch },
+	{ "hash_crc32c_one",		NULL,			bench_hash_crc32c_one },
+	{ "hash_crc32c_two",		NULL,			bench_hash_crc32c_two },
+	{ "hash_city_one",		NULL,			bench_hash_city_one },
+	{ "hash_city_two",		NULL,			bench_hash_city_two },
+	{ "chksum_64",			bench_chksum_setup,	bench_chksum_64 },
+	{ "chksum_1500",		bench_chksum_setup,	bench_chksum_1500 },
+	/* once opened, the PMU counters stay enabled: keep this pair in order */
+	{ "kstats_push_pop",		bench_kstats_setup,	bench_kstats_push_pop },
+	{ "kstats_push_pop_pmu",	bench_kstats_pmu_setup,	bench_kstats_push_pop },
+	{ "cpu_run_on_one_pingpong",	bench_cpu_setup,	bench_cpu_run_on_one },
+	{ NULL, NULL, NULL },
+};
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * bench_net.c - microbenchmarks for the IX network stack
+ */
+
+#include <ix/stddef.h>
+#include <ix/errno.h>
+
+#include <net/ethernet.h>
+#include <net/ip.h>
+
+#include "../dp/net/net.h"
+#include "bench.h"
+
+#define BENCH_ARP_ENTRIES	64
+
+static struct ip_addr bench_arp_addrs[BENCH_ARP_ENTRIES];
+
+static int bench_arp_setup(void)
+{
+	struct eth_addr mac = {{0x02, 0, 0, 0, 0, 0}};
+	int i, ret;
+
+	for (i = 0; i < BENCH_ARP_ENTRIES; i++) {
+		bench_arp_addrs[i].addr = MAKE_IP_ADDR(10, 0, 1, (i + 1));
+		mac.addr[5] = i + 1;
+		ret = arp_insert(&bench_arp_addrs[i], &mac);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void bench_arp_lookup(unsigned long iters)
+{
+	struct eth_addr mac;
+	unsigned long i;
+
+	for (i = 0; i < iters; i++) {
+		arp_lookup_mac(&bench_arp_addrs[i & (BENCH_ARP_ENTRIES - 1)], &mac);
+		bench_sink += mac.addr[5];
+	}
+}
+
+struct bench_vector bench_net_tbl[] = {
+	{ "arp_lookup_mac",		bench_arp_setup,	bench_arp_lookup },
+	{ NULL, NULL, NULL },
+};
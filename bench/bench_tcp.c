@@ -0,0 +1,201 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * bench_tcp.c - microbenchmarks for the lwIP TCP input path
+ *
+ * A single connection is set up against a listening pcb by feeding the
+ * handshake through tcp_input_tmp(), then every operation delivers one
+ * in-order data segment to it. lwip_tcp_event() below plays the
+ * application and consumes the data immediately, so the receive window
+ * never closes; tcp_output_packet() stops where the packet would be
+ * handed to the NIC.
+ */
+
+#include <stdlib.h>
+
+#include <ix/stddef.h>
+#include <ix/errno.h>
+#include <ix/log.h>
+#include <ix/cfg.h>
+#include <ix/mbuf.h>
+#include <ix/ethfg.h>
+
+#include <net/ethernet.h>
+
+#include <lwip/tcp.h>
+#include <lwip/tcp_impl.h>
+#include <lwip/pbuf.h>
+
+#include "bench.h"
+
+#define BENCH_CLIENT_ADDR	((10 << 24) | 2)	/* 10.0.0.2 */
+#define BENCH_CLIENT_PORT	40000
+#define BENCH_SERVER_PORT	8000
+#define BENCH_SEGMENT_LEN	64
+
+extern void tcp_init(struct eth_fg *cur_fg);
+extern void tcp_input_tmp(struct eth_fg *cur_fg, struct mbuf *pkt,
+			  struct ip_hdr *iphdr, void *tcphdr);
+
+/* the last TCP header handed to the NIC, in host byte order */
+static struct {
+	uint32_t seqno;
+	uint32_t ackno;
+	uint8_t flags;
+} bench_tcp_out;
+
+static struct eth_fg *bench_fg;
+static struct tcp_pcb_listen bench_lpcb;
+static uint32_t bench_client_seq;
+static uint32_t bench_server_seq;
+
+/**
+ * lwip_tcp_event - accepts every connection and consumes all data
+ */
+err_t lwip_tcp_event(struct eth_fg *cur_fg, void *arg, struct tcp_pcb *pcb,
+		     enum lwip_event event, struct pbuf *p, u16_t size,
+		     err_t err)
+{
+	if (event == LWIP_EVENT_RECV && p) {
+		tcp_recved(cur_fg, pcb, p->tot_len);
+		pbuf_free(p);
+	}
+
+	return ERR_OK;
+}
+
+/**
+ * tcp_output_packet - records the segment instead of transmitting it
+ */
+int tcp_output_packet(struct eth_fg *cur_fg, struct tcp_pcb *pcb, struct pbuf *p)
+{
+	struct tcp_hdr *tcphdr = p->payload;
+
+	bench_tcp_out.seqno = ntohl(tcphdr->seqno);
+	bench_tcp_out.ackno = ntohl(tcphdr->ackno);
+	bench_tcp_out.flags = TCPH_FLAGS(tcphdr);
+
+	return 0;
+}
+
+static void bench_tcp_segment(uint32_t seq, uint32_t ack, uint8_t flags,
+			      int len)
+{
+	struct mbuf *pkt;
+	struct eth_hdr *ethhdr;
+	struct ip_hdr *iphdr;
+	struct tcp_hdr *tcphdr;
+
+	pkt = mbuf_alloc_local();
+	if (unlikely(!pkt))
+		panic("bench: out of mbufs\n");
+
+	ethhdr = mbuf_mtod(pkt, struct eth_hdr *);
+	iphdr = mbuf_nextd(ethhdr, struct ip_hdr *);
+	tcphdr = mbuf_nextd(iphdr, struct tcp_hdr *);
+
+	ethhdr->type = hton16(ETHTYPE_IP);
+	IPH_VHL_SET(iphdr, 4, sizeof(struct ip_hdr) / 4);
+	IPH_TOS_SET(iphdr, 0);
+	IPH_LEN_SET(iphdr, htons(sizeof(struct ip_hdr) + sizeof(struct tcp_hdr) + len));
+	IPH_ID_SET(iphdr, 0);
+	IPH_OFFSET_SET(iphdr, 0);
+	IPH_TTL_SET(iphdr, 64);
+	IPH_PROTO_SET(iphdr, IP_PROTO_TCP);
+	IPH_CHKSUM_SET(iphdr, 0);
+	iphdr->src.addr = htonl(BENCH_CLIENT_ADDR);
+	iphdr->dest.addr = htonl(CFG.host_addr.addr);
+
+	tcphdr->src = htons(BENCH_CLIENT_PORT);
+	tcphdr->dest = htons(BENCH_SERVER_PORT);
+	tcphdr->seqno = htonl(seq);
+	tcphdr->ackno = htonl(ack);
+	TCPH_HDRLEN_FLAGS_SET(tcphdr, sizeof(struct tcp_hdr) / 4, flags);
+	tcphdr->wnd = htons(0xffff);
+	tcphdr->chksum = 0;
+	tcphdr->urgp = 0;
+
+	pkt->len = sizeof(struct eth_hdr) + sizeof(struct ip_hdr) +
+		   sizeof(struct tcp_hdr) + len;
+	tcp_input_tmp(bench_fg, pkt, iphdr, tcphdr);
+}
+
+static int bench_tcp_setup(void)
+{
+	struct eth_fg *fg;
+	int ret;
+
+	fg = calloc(1, sizeof(struct eth_fg));
+	if (!fg)
+		return -ENOMEM;
+
+	eth_fg_init(fg, 0);
+	ret = eth_fg_init_cpu(fg);
+	if (ret)
+		return ret;
+	fg->cur_cpu = percpu_get(cpu_id);
+	fg->fg_id = 0;
+	fgs[0] = fg;
+	nr_flow_groups = 1;
+	tcp_init(fg);
+	bench_fg = fg;
+
+	ret = tcp_listen_with_backlog(&bench_lpcb, 1, IP_ADDR_ANY,
+				      BENCH_SERVER_PORT);
+	if (ret)
+		return ret;
+
+	bench_client_seq = 1000;
+	bench_tcp_segment(bench_client_seq++, 0, TCP_SYN, 0);
+	if (bench_tcp_out.flags != (TCP_SYN | TCP_ACK) ||
+	    bench_tcp_out.ackno != bench_client_seq) {
+		log_err("bench: no SYN-ACK from the listening pcb\n");
+		return -EINVAL;
+	}
+
+	bench_server_seq = bench_tcp_out.seqno + 1;
+	bench_tcp_segment(bench_client_seq, bench_server_seq, TCP_ACK, 0);
+	if (!fg->tcp_active_pcbs) {
+		log_err("bench: the connection wasn't established\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void bench_tcp_input_data(unsigned long iters)
+{
+	unsigned long i;
+
+	for (i = 0; i < iters; i++) {
+		bench_tcp_segment(bench_client_seq, bench_server_seq,
+				  TCP_ACK | TCP_PSH, BENCH_SEGMENT_LEN);
+		bench_client_seq += BENCH_SEGMENT_LEN;
+	}
+}
+
+struct bench_vector bench_tcp_tbl[] = {
+	{ "tcp_input_data_64",		bench_tcp_setup,	bench_tcp_input_data },
+	{ NULL, NULL, NULL },
+};
@@ -0,0 +1,10 @@
+/*
+ * dune.h - the part of libdune the dataplane objects use
+ *
+ * Outside of Dune, entering a core only means installing its per-cpu
+ * segment; see stubs.c.
+ */
+
+#pragma once
+
+extern int dune_enter_ex(void *percpu);
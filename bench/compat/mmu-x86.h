@@ -0,0 +1,10 @@
+/*
+ * mmu-x86.h - the page table definitions of libdune used by ix/vm.h
+ */
+
+#pragma once
+
+#define PDX(level, la)	((((uintptr_t) (la)) >> (12 + 9 * (level))) & 0x1ff)
+#define PTE_ADDR(pte)	((pte) & ~0xfffUL)
+#define PTE_FLAGS(pte)	((pte) & 0xfff)
+#define PTE_P		0x001
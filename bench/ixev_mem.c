@@ -0,0 +1,240 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ixev_mem.c - memory per connection of the ixev event library
+ *
+ * Links the user-level ixev sources against stand-ins for the libIX
+ * system call layer, creates a large number of contexts and reports how
+ * much memory they take while idle, while a fraction of them has a
+ * backlog of small unread segments, and once the backlog is drained.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <ix/stddef.h>
+#include <ix/errno.h>
+#include <ix/mem.h>
+
+#include <asm/cpu.h>
+
+#include "ixev.h"
+
+#define MEMBENCH_SEG_LEN	64
+
+static int opt_conns = 1000000;
+static int opt_burst = 512;
+static int opt_burst_every = 64;
+
+static struct ix_ops *bench_ops;
+static void (*bench_flushed)(struct bsys_desc *descs, unsigned int nr);
+static char bench_payload[MEMBENCH_SEG_LEN];
+
+__thread struct bsys_ring *kring;
+__thread struct bsys_arr *karr;
+
+/*
+ * Stand-ins for libix/main.c and libix/mem.c: commands "succeed" with a
+ * zero return, and memory comes from anonymous mappings.
+ */
+
+static void bench_complete(void)
+{
+	unsigned long i;
+
+	for (i = 0; i < karr->len; i++) {
+		karr->descs[i].arga = 0;
+		karr->descs[i].argb = 0;
+	}
+}
+
+void ix_flush(void)
+{
+	bench_complete();
+	if (bench_flushed)
+		bench_flushed(karr->descs, karr->len);
+	ix_bsys_reset();
+}
+
+int ix_poll(void)
+{
+	bench_complete();
+	return 0;
+}
+
+void ix_handle_events(void)
+{
+}
+
+int ix_init(struct ix_ops *ops, int batch_depth)
+{
+	bench_ops = ops;
+	bench_flushed = ops->flushed;
+
+	kring = malloc(sizeof(struct bsys_ring) +
+		       sizeof(struct bsys_desc) * batch_depth);
+	if (!kring)
+		return -ENOMEM;
+
+	karr = &kring->sq;
+	karr->max_len = batch_depth;
+	ix_bsys_reset();
+
+	return 0;
+}
+
+void *ix_alloc_pages(int nrpages)
+{
+	void *addr = mmap(NULL, (size_t) nrpages * PGSIZE_2MB,
+			  PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+void ix_free_pages(void *addr, int nrpages)
+{
+	munmap(addr, (size_t) nrpages * PGSIZE_2MB);
+}
+
+static struct ixev_ctx *bench_accept(struct ip_tuple *id)
+{
+	return NULL;
+}
+
+static void bench_release(struct ixev_ctx *ctx)
+{
+}
+
+static void bench_dialed(struct ixev_ctx *ctx, long ret)
+{
+}
+
+static struct ixev_conn_ops bench_conn_ops = {
+	.accept		= bench_accept,
+	.release	= bench_release,
+	.dialed		= bench_dialed,
+};
+
+/* the memory held by @nr contexts, including overflow receive rings */
+static size_t bench_bytes(struct ixev_ctx *ctxs, int nr)
+{
+	size_t bytes = sizeof(struct ixev_ctx) * nr;
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (ctxs[i].recv != ctxs[i].recv_inline)
+			bytes += sizeof(struct sg_entry) * (ctxs[i].recv_mask + 1);
+
+	return bytes;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n CONNS] [-b SEGMENTS] [-e EVERY]\n", prog);
+	fprintf(stderr, "  -n  number of contexts (default %d)\n", opt_conns);
+	fprintf(stderr, "  -b  unread segments queued on a bursty context (default %d)\n", opt_burst);
+	fprintf(stderr, "  -e  one in EVERY contexts is bursty (default %d)\n", opt_burst_every);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t idle, burst, drained;
+	struct ixev_ctx *ctxs;
+	uint64_t start, cycles;
+	unsigned long events = 0;
+	char buf[4096];
+	int i, j, c;
+
+	while ((c = getopt(argc, argv, "n:b:e:h")) != -1) {
+		switch (c) {
+		case 'n':
+			opt_conns = atoi(optarg);
+			break;
+		case 'b':
+			opt_burst = atoi(optarg);
+			break;
+		case 'e':
+			opt_burst_every = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (opt_conns <= 0 || opt_burst <= 0 || opt_burst_every <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (ixev_init(&bench_conn_ops) || ixev_init_thread()) {
+		fprintf(stderr, "membench: failed to initialize ixev\n");
+		return 1;
+	}
+
+	ctxs = calloc(opt_conns, sizeof(struct ixev_ctx));
+	if (!ctxs) {
+		fprintf(stderr, "membench: out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < opt_conns; i++) {
+		ixev_ctx_init(&ctxs[i]);
+		ctxs[i].handle = i;
+	}
+	idle = bench_bytes(ctxs, opt_conns);
+
+	start = rdtsc();
+	for (i = 0; i < opt_conns; i++) {
+		int nr = (i % opt_burst_every) ? 1 : opt_burst;
+
+		for (j = 0; j < nr; j++)
+			bench_ops->tcp_recv(i, (unsigned long) &ctxs[i],
+					    bench_payload, sizeof(bench_payload));
+		events += nr;
+	}
+	cycles = rdtsc() - start;
+	burst = bench_bytes(ctxs, opt_conns);
+
+	for (i = 0; i < opt_conns; i++)
+		while (ixev_recv(&ctxs[i], buf, sizeof(buf)) > 0)
+			;
+	ixev_wait();
+	drained = bench_bytes(ctxs, opt_conns);
+
+	printf("{\"name\": \"ixev_ctx\", \"conns\": %d, \"ctx_bytes\": %zu, "
+	       "\"idle_bytes_per_conn\": %.1f, \"burst_bytes_per_conn\": %.1f, "
+	       "\"drained_bytes_per_conn\": %.1f, \"cycles_per_recv\": %.1f}\n",
+	       opt_conns, sizeof(struct ixev_ctx),
+	       (double) idle / opt_conns, (double) burst / opt_conns,
+	       (double) drained / opt_conns, (double) cycles / events);
+
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ixev_wheel.c - cost of the user-level timers of the ixev library
+ *
+ * Links the libix timer wheel on its own and reports the cycles it takes
+ * to add, cancel and fire each of a large number of timers. The timers
+ * are spread over a range of delays, so adding them fills all levels of
+ * the wheel, and firing them includes moving them down the levels. All
+ * the timers are fired in one batch, like after a USYS_TIMER event that
+ * finds them all expired. The kernel timer is never armed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <asm/cpu.h>
+
+#include "ixev_timer.h"
+
+static int opt_timers = 1000000;
+static long opt_spread_us = 100000;
+
+static unsigned long bench_fired;
+
+static void bench_fire(void *arg)
+{
+	bench_fired++;
+}
+
+static uint64_t bench_random(uint64_t *seed)
+{
+	/* xorshift64* */
+	*seed ^= *seed >> 12;
+	*seed ^= *seed << 25;
+	*seed ^= *seed >> 27;
+	return *seed * 2685821657736338717ull;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n TIMERS] [-s SPREAD_US]\n", prog);
+	fprintf(stderr, "  -n  number of timers (default %d)\n", opt_timers);
+	fprintf(stderr, "  -s  timers are due in SPREAD_US / 2 to SPREAD_US "
+		"(default %ld)\n", opt_spread_us);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t start, add, cancel, fire, seed = 1;
+	struct ixev_timer *timers;
+	struct timeval tv;
+	unsigned long cancelled = 0;
+	long delay;
+	int i, c;
+
+	while ((c = getopt(argc, argv, "n:s:h")) != -1) {
+		switch (c) {
+		case 'n':
+			opt_timers = atoi(optarg);
+			break;
+		case 's':
+			opt_spread_us = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (opt_timers <= 0 || opt_spread_us < 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	timers = calloc(opt_timers, sizeof(struct ixev_timer));
+	if (!timers) {
+		fprintf(stderr, "timerbench: out of memory\n");
+		return 1;
+	}
+
+	ixev_wheel_init();
+	ixev_wheel_init_thread();
+
+	for (i = 0; i < opt_timers; i++)
+		ixev_timer_init(&timers[i], bench_fire, NULL);
+
+	start = rdtsc();
+	for (i = 0; i < opt_timers; i++) {
+		delay = opt_spread_us / 2 +
+			bench_random(&seed) % (opt_spread_us / 2);
+		tv.tv_sec = delay / 1000000;
+		tv.tv_usec = delay % 1000000;
+		ixev_timer_add(&timers[i], tv);
+	}
+	add = rdtsc() - start;
+
+	start = rdtsc();
+	for (i = 0; i < opt_timers; i += 2) {
+		ixev_timer_del(&timers[i]);
+		cancelled++;
+	}
+	cancel = rdtsc() - start;
+
+	usleep(opt_spread_us + 10000);
+
+	start = rdtsc();
+	ixev_wheel_run();
+	fire = rdtsc() - start;
+
+	if (bench_fired != opt_timers - cancelled) {
+		fprintf(stderr, "timerbench: %lu of %lu timers fired\n",
+			bench_fired, opt_timers - cancelled);
+		return 1;
+	}
+
+	printf("{\"name\": \"ixev_timer\", \"timers\": %d, \"spread_us\": %ld, "
+	       "\"cycles_per_add\": %.1f, \"cycles_per_cancel\": %.1f, "
+	       "\"cycles_per_fire\": %.1f}\n",
+	       opt_timers, opt_spread_us, (double) add / opt_timers,
+	       (double) cancel / cancelled, (double) fire / bench_fired);
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * stubs.c - stand-ins for the parts of the dataplane that need Dune,
+ * DPDK or a configuration file
+ *
+ * Memory comes from anonymous mappings aligned to the requested page
+ * size. The TCP application callbacks live in bench_tcp.c.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <asm/prctl.h>
+
+#include <ix/stddef.h>
+#include <ix/errno.h>
+#include <ix/cpu.h>
+#include <ix/cfg.h>
+#include <ix/mem.h>
+#include <ix/page.h>
+#include <ix/vm.h>
+#include <ix/mbuf.h>
+#include <ix/ethfg.h>
+#include <ix/control_plane.h>
+
+#include <net/ip.h>
+#include <net/udp.h>
+
+#include "../dp/net/net.h"
+
+#include "bench.h"
+
+struct cfg_parameters CFG;
+
+volatile struct cp_shmem *cp_shmem;
+DEFINE_PERCPU(volatile struct command_struct *, cp_cmd);
+DEFINE_PERCPU(unsigned long, idle_cycles);
+double energy_unit;
+
+/**
+ * dune_enter_ex - installs the per-cpu segment
+ * @percpu: the per-cpu area set up by cpu_init_percpu()
+ *
+ * Instead of entering Dune, point %gs at the per-cpu area directly.
+ */
+int dune_enter_ex(void *percpu)
+{
+	return syscall(SYS_arch_prctl, ARCH_SET_GS, (unsigned long) percpu);
+}
+
+static void *bench_map(size_t len, size_t align)
+{
+	uintptr_t addr;
+
+	addr = (uintptr_t) mmap(NULL, len + align, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+				-1, 0);
+	if ((void *) addr == MAP_FAILED)
+		return NULL;
+
+	return (void *) align_up(addr, align);
+}
+
+void *mem_alloc_pages(int nr, int size, struct bitmask *mask, int numa_policy)
+{
+	void *addr = bench_map((size_t) nr * size, size);
+
+	return addr ? addr : MAP_FAILED;
+}
+
+void *mem_alloc_pages_onnode(int nr, int size, int node, int numa_policy)
+{
+	void *addr = bench_map((size_t) nr * size, size);
+
+	return addr ? addr : MAP_FAILED;
+}
+
+void mem_free_pages(void *addr, int nr, int size)
+{
+	munmap(addr, (size_t) nr * size);
+}
+
+void *page_alloc_contig_on_node(unsigned int nr, int numa_node)
+{
+	return bench_map((size_t) nr * PGSIZE_2MB, PGSIZE_2MB);
+}
+
+void page_free_contig(void *addr, unsigned int nr)
+{
+	munmap(addr, (size_t) nr * PGSIZE_2MB);
+}
+
+void *vm_map_to_user(void *kern_addr, int nr, int size, int perm)
+{
+	return kern_addr;
+}
+
+void vm_unmap(void *addr, int nr, int size)
+{
+}
+
+void udp_input(struct mbuf *pkt, struct ip_hdr *iphdr, struct udp_hdr *udphdr)
+{
+	mbuf_free(pkt);
+}
+
+void icmp_input(struct eth_fg *cur_fg, struct mbuf *pkt,
+		struct icmp_hdr *hdr, int len)
+{
+	mbuf_free(pkt);
+}
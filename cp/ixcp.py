@@ -40,6 +40,9 @@ ETH_MAX_NUM_FG = 512
 NETHDEV = 16
 ETH_MAX_TOTAL_FG = ETH_MAX_NUM_FG * NETHDEV
 IDLE_FIFO_SIZE = 256
+LATSKETCH_SUB_BITS = 4
+LATSKETCH_MAX_BITS = 36
+LATSKETCH_BUCKETS = (LATSKETCH_MAX_BITS - LATSKETCH_SUB_BITS + 1) << LATSKETCH_SUB_BITS
 
 class CpuMetrics(ctypes.Structure):
   _fields_ = [
@@ -48,13 +51,19 @@ class CpuMetrics(ctypes.Structure):
     ('queue_size', ctypes.c_double * 3),
     ('loop_duration', ctypes.c_long),
     ('idle', ctypes.c_double * 3),
-    ('padding', ctypes.c_byte * 56),
+    ('rx_batch', ctypes.c_uint),
+    ('rx_slo_miss', ctypes.c_uint),
+    ('padding', ctypes.c_byte * 48),
   ]
 
 class FlowGroupMetrics(ctypes.Structure):
   _fields_ = [
     ('cpu', ctypes.c_uint),
-    ('padding', ctypes.c_byte * 60),
+    ('conns', ctypes.c_int),
+    ('pkts', ctypes.c_ulong),
+    ('bytes', ctypes.c_ulong),
+    ('cycles', ctypes.c_ulong),
+    ('padding', ctypes.c_byte * 32),
   ]
 
 class CmdParamsMigrate(ctypes.Structure):
@@ -113,6 +122,20 @@ class Scratchpad(ctypes.Structure):
     ('ts_last_pkt_at_target', ctypes.c_long),
   ]
 
+class LatSketch(ctypes.Structure):
+  _fields_ = [
+    ('count', ctypes.c_ulong),
+    ('sum', ctypes.c_ulong),
+    ('bucket', ctypes.c_uint * LATSKETCH_BUCKETS),
+    ('padding', ctypes.c_byte * 48),
+  ]
+
+class CpLatency(ctypes.Structure):
+  _fields_ = [
+    ('rx_delay', LatSketch),
+    ('app', LatSketch),
+  ]
+
 class ShMem(ctypes.Structure):
   _fields_ = [
     ('nr_flow_groups', ctypes.c_uint),
@@ -126,6 +149,9 @@ class ShMem(ctypes.Structure):
     ('cycles_per_us', ctypes.c_uint),
     ('scratchpad_idx', ctypes.c_uint),
     ('scratchpad', Scratchpad * 1024),
+    ('trace_mask', ctypes.c_uint),
+    ('padding2', ctypes.c_byte * 52),
+    ('latency', CpLatency * NCPU),
   ]
 
 def bitmap_create(size, on):
@@ -368,6 +394,45 @@ def get_all_metrics(shmem, attr):
       ret.append(getattr(shmem.cpu_metrics[cpu], attr))
   return ret
 
+def get_fg_load(shmem, interval):
+  prv = [shmem.flow_group[i].cycles for i in xrange(shmem.nr_flow_groups)]
+  time.sleep(interval)
+  ret = []
+  for i in xrange(shmem.nr_flow_groups):
+    ret.append((shmem.flow_group[i].cycles - prv[i]) / (interval * 1000000 * shmem.cycles_per_us))
+  return ret
+
+def latsketch_value(bucket):
+  if bucket < 1 << LATSKETCH_SUB_BITS:
+    return bucket
+  shift = (bucket >> LATSKETCH_SUB_BITS) - 1
+  return ((1 << LATSKETCH_SUB_BITS) | (bucket & ((1 << LATSKETCH_SUB_BITS) - 1))) << shift
+
+def latsketch_quantile(buckets, q):
+  total = sum(buckets)
+  if total == 0:
+    return 0
+  target = min(int(q * total), total - 1)
+  acc = 0
+  for i in xrange(LATSKETCH_BUCKETS - 1):
+    acc += buckets[i]
+    if acc > target:
+      return (latsketch_value(i) + latsketch_value(i + 1)) / 2
+  return latsketch_value(LATSKETCH_BUCKETS - 1)
+
+def get_latency(shmem, name, interval, cpus):
+  def snapshot():
+    ret = [0] * LATSKETCH_BUCKETS
+    for cpu in cpus:
+      buckets = getattr(shmem.latency[cpu], name).bucket
+      for i in xrange(LATSKETCH_BUCKETS):
+        ret[i] += buckets[i]
+    return ret
+  prv = snapshot()
+  time.sleep(interval)
+  cur = snapshot()
+  return [(cur[i] - prv[i]) & 0xffffffff for i in xrange(LATSKETCH_BUCKETS)]
+
 def avg(list):
   return sum(list) / len(list)
 
@@ -443,6 +508,8 @@ def main():
   parser.add_argument('--background-cpus', type=str)
   parser.add_argument('--print-power', action='store_true')
   parser.add_argument('--print-queues', action='store_true')
+  parser.add_argument('--print-fg-load', action='store_true')
+  parser.add_argument('--print-latency', action='store_true')
   args = parser.parse_args()
 
   if args.background_cpus is not None:
@@ -470,7 +537,7 @@ def main():
     wake_up(shmem, args.wake_up)
   elif args.show_metrics:
     for cpu in xrange(shmem.nr_cpus):
-      print 'CPU %d: queuing delay: %d us, batch size: %d pkts' % (cpu, shmem.cpu_metrics[cpu].queuing_delay, shmem.cpu_metrics[cpu].batch_size)
+      print 'CPU %d: queuing delay: %d us, batch size: %d pkts, batch bound: %d pkts, over SLO: %.1f%%' % (cpu, shmem.cpu_metrics[cpu].queuing_delay, shmem.cpu_metrics[cpu].batch_size, shmem.cpu_metrics[cpu].rx_batch, shmem.cpu_metrics[cpu].rx_slo_miss / 10.0)
   elif args.control is not None:
     if args.control == 'eff':
       mode = STEPS_MODE_ENERGY_EFFICIENCY
@@ -555,6 +622,21 @@ def main():
       if shmem.command[cpu].cpu_state == Command.CP_CPU_STATE_RUNNING:
         q = shmem.cpu_metrics[cpu].queue_size
         print '%d %f/%f/%f' % (cpu, q[0], q[1], q[2])
+  elif args.print_fg_load:
+    load = get_fg_load(shmem, 1)
+    for cpu in xrange(NCPU):
+      if len(fg_per_cpu[cpu]) == 0:
+        continue
+      print 'CPU %02d: load %f' % (cpu, sum(load[fg] for fg in fg_per_cpu[cpu]))
+      for fg in sorted(fg_per_cpu[cpu], key=lambda fg: load[fg], reverse=True):
+        m = shmem.flow_group[fg]
+        print '  fg %4d: load %f conns %d pkts %d bytes %d' % (fg, load[fg], m.conns, m.pkts, m.bytes)
+  elif args.print_latency:
+    cpus = [cpu for cpu in xrange(shmem.nr_cpus) if shmem.command[cpu].cpu_state == Command.CP_CPU_STATE_RUNNING]
+    for name in ['rx_delay', 'app']:
+      buckets = get_latency(shmem, name, 1, cpus)
+      print '%-8s count %d p50 %d p99 %d p99.9 %d (ns)' % (name, sum(buckets),
+            latsketch_quantile(buckets, .5), latsketch_quantile(buckets, .99), latsketch_quantile(buckets, .999))
 
 if __name__ == '__main__':
   main()
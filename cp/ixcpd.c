@@ -0,0 +1,607 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ixcpd.c - native control plane daemon
+ *
+ * Maps the dataplane control shared memory, samples the per-cpu metrics
+ * at a fixed cadence, and lets the policy decide how many cpus should
+ * be running. Flow groups are then redistributed according to the load
+ * each of them generated, and unused cpus are put to sleep.
+ *
+ * The daemon can record the samples it feeds to the policy and replay
+ * such a trace without a running dataplane. Every evaluation of the
+ * policy is logged, whether it changes the cpu count or holds it.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ix/control_plane.h>
+
+#include "policy.h"
+
+#define cpu_relax() asm volatile("pause")
+
+/* minimum load difference (in cores) worth a migration when balancing */
+#define BALANCE_THRESHOLD 0.1
+
+volatile struct cp_shmem *cp_shmem;
+
+static FILE *log_file;
+static FILE *record_file;
+static unsigned long interval = 1000;
+static bool dry_run;
+static double quantile;
+static struct latsketch rx_delay_prv[NCPU];
+
+static int fg_cpu[ETH_MAX_TOTAL_FG];
+static int fg_new_cpu[ETH_MAX_TOTAL_FG];
+static double fg_load[ETH_MAX_TOTAL_FG];
+static uint64_t fg_prv_cycles[ETH_MAX_TOTAL_FG];
+static unsigned long fg_prv_ts;
+static double cpu_load[NCPU];
+
+static unsigned long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void get_fifo(int cpu, char *buf, size_t len)
+{
+	char cwd[PATH_MAX];
+
+	if (!getcwd(cwd, sizeof(cwd)))
+		strcpy(cwd, ".");
+	snprintf(buf, len, "%s/block-%d.fifo", cwd, cpu);
+}
+
+static bool is_idle(int cpu)
+{
+	char fifo[IDLE_FIFO_SIZE];
+
+	get_fifo(cpu, fifo, sizeof(fifo));
+	return access(fifo, F_OK) == 0;
+}
+
+static void cpu_idle(int cpu)
+{
+	volatile struct command_struct *cmd = &cp_shmem->command[cpu];
+	char fifo[IDLE_FIFO_SIZE];
+
+	if (is_idle(cpu))
+		return;
+
+	get_fifo(cpu, fifo, sizeof(fifo));
+	if (mkfifo(fifo, 0600)) {
+		perror("mkfifo");
+		return;
+	}
+
+	strcpy((char *) cmd->idle.fifo, fifo);
+	cmd->status = CP_STATUS_RUNNING;
+	cmd->cmd_id = CP_CMD_IDLE;
+	while (cmd->status != CP_STATUS_READY)
+		cpu_relax();
+
+	fprintf(log_file, "%lu idle cpu %d\n", now_us(), cpu);
+}
+
+static void cpu_wake_up(int cpu)
+{
+	volatile struct command_struct *cmd = &cp_shmem->command[cpu];
+	char fifo[IDLE_FIFO_SIZE];
+	int fd;
+
+	if (!is_idle(cpu))
+		return;
+
+	get_fifo(cpu, fifo, sizeof(fifo));
+	fd = open(fifo, O_WRONLY);
+	if (fd == -1) {
+		perror("open");
+		return;
+	}
+	if (write(fd, "1", 1) != 1)
+		perror("write");
+	close(fd);
+	unlink(fifo);
+
+	while (cmd->cpu_state != CP_CPU_STATE_RUNNING)
+		cpu_relax();
+
+	fprintf(log_file, "%lu wakeup cpu %d\n", now_us(), cpu);
+}
+
+static void migrate(int src, int dst, unsigned long *fg_bitmap, int count)
+{
+	volatile struct command_struct *cmd = &cp_shmem->command[src];
+	unsigned long start = now_us();
+
+	cmd->no_idle = 1;
+	memcpy((void *) cmd->migrate.fg_bitmap, fg_bitmap,
+	       sizeof(cmd->migrate.fg_bitmap));
+	cmd->migrate.cpu = dst;
+	cmd->status = CP_STATUS_RUNNING;
+	cmd->cmd_id = CP_CMD_MIGRATE;
+	while (cmd->status != CP_STATUS_READY)
+		cpu_relax();
+	cmd->no_idle = 0;
+
+	fprintf(log_file, "%lu migrate cpu %d -> %d fgs %d duration %lu us\n",
+		now_us(), src, dst, count, now_us() - start);
+}
+
+static void update_fg_load(void)
+{
+	unsigned long now = now_us();
+	double elapsed = (double) (now - fg_prv_ts) * cp_shmem->cycles_per_us;
+	uint64_t cycles;
+	int i;
+
+	for (i = 0; i < cp_shmem->nr_flow_groups; i++) {
+		cycles = cp_shmem->flow_group[i].cycles;
+		fg_load[i] = elapsed > 0 ? (cycles - fg_prv_cycles[i]) / elapsed : 0;
+		fg_prv_cycles[i] = cycles;
+	}
+	fg_prv_ts = now;
+}
+
+static int least_loaded_cpu(int nr_cpus)
+{
+	int cpu, best = 0;
+
+	for (cpu = 1; cpu < nr_cpus; cpu++)
+		if (cpu_load[cpu] < cpu_load[best])
+			best = cpu;
+
+	return best;
+}
+
+static void place_fgs(int nr_cpus)
+{
+	int i, j, cpu, hi, lo, best;
+	int nr_fgs = cp_shmem->nr_flow_groups;
+	int order[ETH_MAX_TOTAL_FG];
+
+	for (cpu = 0; cpu < NCPU; cpu++)
+		cpu_load[cpu] = 0;
+	for (i = 0; i < nr_fgs; i++) {
+		fg_new_cpu[i] = fg_cpu[i];
+		if (fg_cpu[i] < nr_cpus)
+			cpu_load[fg_cpu[i]] += fg_load[i];
+	}
+
+	/* orphaned flow groups go, hottest first, to the least loaded cpu */
+	for (i = 0, j = 0; i < nr_fgs; i++)
+		if (fg_cpu[i] >= nr_cpus)
+			order[j++] = i;
+	while (j) {
+		best = 0;
+		for (i = 1; i < j; i++)
+			if (fg_load[order[i]] > fg_load[order[best]])
+				best = i;
+		i = order[best];
+		order[best] = order[--j];
+
+		cpu = least_loaded_cpu(nr_cpus);
+		fg_new_cpu[i] = cpu;
+		cpu_load[cpu] += fg_load[i];
+	}
+
+	/* then shift load from the busiest to the least busy cpu */
+	for (j = 0; j < nr_fgs; j++) {
+		hi = lo = 0;
+		for (cpu = 1; cpu < nr_cpus; cpu++) {
+			if (cpu_load[cpu] > cpu_load[hi])
+				hi = cpu;
+			if (cpu_load[cpu] < cpu_load[lo])
+				lo = cpu;
+		}
+		if (cpu_load[hi] - cpu_load[lo] < BALANCE_THRESHOLD)
+			break;
+
+		best = -1;
+		for (i = 0; i < nr_fgs; i++) {
+			if (fg_new_cpu[i] != hi ||
+			    fg_load[i] >= cpu_load[hi] - cpu_load[lo])
+				continue;
+			if (best == -1 || fg_load[i] > fg_load[best])
+				best = i;
+		}
+		if (best == -1 || fg_load[best] == 0)
+			break;
+
+		fg_new_cpu[best] = lo;
+		cpu_load[hi] -= fg_load[best];
+		cpu_load[lo] += fg_load[best];
+	}
+}
+
+static void apply_placement(void)
+{
+	DEFINE_BITMAP(fg_bitmap, ETH_MAX_TOTAL_FG);
+	int i, src, dst, count;
+	int nr_fgs = cp_shmem->nr_flow_groups;
+
+	for (src = 0; src < NCPU; src++) {
+		for (;;) {
+			dst = -1;
+			for (i = 0; i < nr_fgs; i++) {
+				if (fg_cpu[i] == src && fg_new_cpu[i] != src) {
+					dst = fg_new_cpu[i];
+					break;
+				}
+			}
+			if (dst == -1)
+				break;
+
+			bitmap_init(fg_bitmap, ETH_MAX_TOTAL_FG, 0);
+			count = 0;
+			for (; i < nr_fgs; i++) {
+				if (fg_cpu[i] == src && fg_new_cpu[i] == dst) {
+					bitmap_set(fg_bitmap, i);
+					fg_cpu[i] = dst;
+					count++;
+				}
+			}
+			migrate(src, dst, fg_bitmap, count);
+		}
+	}
+}
+
+/*
+ * set_cpus - runs the dataplane on the first @nr_cpus cpus
+ */
+static void set_cpus(int nr_cpus)
+{
+	int cpu, i;
+	bool used;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		cp_shmem->command[cpu].no_idle = 1;
+		cpu_wake_up(cpu);
+	}
+
+	update_fg_load();
+	place_fgs(nr_cpus);
+	apply_placement();
+
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		cp_shmem->command[cpu].no_idle = 0;
+
+	for (cpu = nr_cpus; cpu < cp_shmem->nr_cpus; cpu++) {
+		used = false;
+		for (i = 0; i < cp_shmem->nr_flow_groups; i++)
+			used |= fg_cpu[i] == cpu;
+		if (!used)
+			cpu_idle(cpu);
+	}
+}
+
+static int running_cpus(void)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < cp_shmem->nr_flow_groups; i++) {
+		fg_cpu[i] = cp_shmem->flow_group[i].cpu;
+		if (fg_cpu[i] + 1 > nr)
+			nr = fg_cpu[i] + 1;
+	}
+
+	return nr;
+}
+
+/*
+ * The RX delay quantile of the last interval, merged over the running
+ * cpus. The baseline of every cpu is kept current so that a cpu that is
+ * woken up only contributes what it received since.
+ */
+static double rx_delay_quantile(int nr_cpus)
+{
+	static struct latsketch acc, cur;
+	int cpu;
+
+	memset(&acc, 0, sizeof(acc));
+	for (cpu = 0; cpu < cp_shmem->nr_cpus; cpu++) {
+		memset(&cur, 0, sizeof(cur));
+		latsketch_merge(&cur, &cp_shmem->latency[cpu].rx_delay, 1);
+		if (cpu < nr_cpus) {
+			latsketch_merge(&acc, &cur, 1);
+			latsketch_merge(&acc, &rx_delay_prv[cpu], -1);
+		}
+		rx_delay_prv[cpu] = cur;
+	}
+
+	return latsketch_quantile(&acc, quantile) / 1000.0;
+}
+
+static void sample(struct cp_sample *s, int nr_cpus)
+{
+	volatile struct cpu_metrics *m;
+	int cpu;
+
+	s->ts = now_us();
+	s->nr_cpus = nr_cpus;
+	s->queuing_delay = 0;
+	s->idle = 0;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		m = &cp_shmem->cpu_metrics[cpu];
+		if (m->queuing_delay > s->queuing_delay)
+			s->queuing_delay = m->queuing_delay;
+		s->idle += m->idle[0];
+	}
+	if (nr_cpus)
+		s->idle /= nr_cpus;
+
+	if (quantile)
+		s->queuing_delay = rx_delay_quantile(nr_cpus);
+}
+
+static void record_sample(const struct cp_sample *s)
+{
+	fprintf(record_file, "%lu %d %f %f\n", s->ts, s->nr_cpus,
+		s->queuing_delay, s->idle);
+}
+
+static void log_decision(const struct cp_sample *s, const struct cp_decision *d,
+			 bool change)
+{
+	fprintf(log_file, "%lu decision %s cpus %d -> %d want %d delay %.1f "
+		"idle %.3f error %.3f integral %.3f output %.3f reason %s\n",
+		s->ts, change ? "change" : "hold", s->nr_cpus, d->cpus, d->want,
+		s->queuing_delay, s->idle, d->error, d->integral, d->output,
+		d->reason);
+}
+
+static int replay(struct cp_policy_params *params, const char *path)
+{
+	struct cp_policy pol;
+	struct cp_sample s;
+	struct cp_decision d;
+	char line[256];
+	bool first = true, change;
+	int nr_cpus = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror("fopen");
+		return 1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%lu %d %lf %lf", &s.ts, &s.nr_cpus,
+			   &s.queuing_delay, &s.idle) != 4)
+			continue;
+		if (first) {
+			cp_policy_init(&pol, params, s.ts);
+			nr_cpus = s.nr_cpus;
+			first = false;
+			if (record_file)
+				fprintf(record_file, "# ts nr_cpus queuing_delay idle\n");
+		}
+
+		/* the recorded metrics are taken as they are, but the cpu
+		 * count follows the decisions of the policy under test */
+		s.nr_cpus = nr_cpus;
+		if (record_file)
+			record_sample(&s);
+		change = cp_policy_update(&pol, &s, &d);
+		log_decision(&s, &d, change);
+		if (change)
+			nr_cpus = d.cpus;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static int run(struct cp_policy_params *params)
+{
+	struct cp_policy pol;
+	struct cp_sample s;
+	struct cp_decision d;
+	struct timespec next;
+	int fd, nr_cpus;
+	bool change;
+
+	fd = shm_open("/ix", O_RDWR, 0);
+	if (fd == -1) {
+		perror("shm_open");
+		return 1;
+	}
+
+	cp_shmem = mmap(NULL, sizeof(struct cp_shmem), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if (cp_shmem == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	if (params->max_cpus > cp_shmem->nr_cpus)
+		params->max_cpus = cp_shmem->nr_cpus;
+
+	nr_cpus = running_cpus();
+	if (quantile)
+		rx_delay_quantile(0);
+	fg_prv_ts = now_us();
+	cp_policy_init(&pol, params, fg_prv_ts);
+
+	if (record_file)
+		fprintf(record_file, "# ts nr_cpus queuing_delay idle\n");
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (;;) {
+		next.tv_nsec += interval * 1000;
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		sample(&s, nr_cpus);
+		if (record_file)
+			record_sample(&s);
+
+		change = cp_policy_update(&pol, &s, &d);
+		log_decision(&s, &d, change);
+		fflush(log_file);
+		if (!change || dry_run)
+			continue;
+
+		set_cpus(d.cpus);
+		nr_cpus = d.cpus;
+		fflush(log_file);
+	}
+
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	struct cp_policy_params p;
+
+	cp_policy_default_params(&p);
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d DELAY    queuing delay setpoint in us (%.0f)\n"
+		"  -q QUANTILE control the given RX delay quantile (e.g. 0.99)\n"
+		"              instead of the worst per-cpu average\n"
+		"  -I IDLE     tolerated idle fraction (%.2f)\n"
+		"  -P KP       proportional gain (%.2f)\n"
+		"  -i KI       integral gain (%.2f)\n"
+		"  -D KD       derivative gain (%.2f)\n"
+		"  -u MS       dwell time before scaling up (%lu)\n"
+		"  -w MS       dwell time before scaling down (%lu)\n"
+		"  -m CPUS     minimum number of cpus (%d)\n"
+		"  -M CPUS     maximum number of cpus\n"
+		"  -t US       sampling interval (%lu)\n"
+		"  -l FILE     log decisions to FILE instead of stdout\n"
+		"  -r FILE     record the metric samples to FILE\n"
+		"  -R FILE     replay a recorded trace and print the decisions;\n"
+		"              with -r, re-record the samples as replayed\n"
+		"  -n          decide but do not act\n",
+		argv0, p.target_delay, p.target_idle, p.kp, p.ki, p.kd,
+		p.up_dwell / 1000, p.down_dwell / 1000, p.min_cpus, interval);
+}
+
+int main(int argc, char **argv)
+{
+	struct cp_policy_params params;
+	const char *trace = NULL;
+	int c;
+
+	log_file = stdout;
+	cp_policy_default_params(&params);
+
+	while ((c = getopt(argc, argv, "d:q:I:P:i:D:u:w:m:M:t:l:r:R:nh")) != -1) {
+		switch (c) {
+		case 'd':
+			params.target_delay = atof(optarg);
+			break;
+		case 'I':
+			params.target_idle = atof(optarg);
+			break;
+		case 'q':
+			quantile = atof(optarg);
+			if (quantile <= 0 || quantile > 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'P':
+			params.kp = atof(optarg);
+			break;
+		case 'i':
+			params.ki = atof(optarg);
+			break;
+		case 'D':
+			params.kd = atof(optarg);
+			break;
+		case 'u':
+			params.up_dwell = strtoul(optarg, NULL, 0) * 1000;
+			break;
+		case 'w':
+			params.down_dwell = strtoul(optarg, NULL, 0) * 1000;
+			break;
+		case 'm':
+			params.min_cpus = atoi(optarg);
+			break;
+		case 'M':
+			params.max_cpus = atoi(optarg);
+			break;
+		case 't':
+			interval = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			log_file = fopen(optarg, "w");
+			if (!log_file) {
+				perror("fopen");
+				return 1;
+			}
+			break;
+		case 'r':
+			record_file = fopen(optarg, "w");
+			if (!record_file) {
+				perror("fopen");
+				return 1;
+			}
+			break;
+		case 'R':
+			trace = optarg;
+			break;
+		case 'n':
+			dry_run = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (trace)
+		return replay(&params, trace);
+
+	return run(&params);
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * policy.c - closed-loop core allocation policy
+ *
+ * A PID controller drives the number of running cpus. The error is the
+ * relative excess of queuing delay over its setpoint or, when the delay
+ * is within bounds, the excess of idle time over what we tolerate.
+ * Scaling up reacts within a few milliseconds, scaling down only after
+ * the cores have been consistently underused.
+ */
+
+#include <limits.h>
+#include <math.h>
+
+#include "policy.h"
+
+/**
+ * cp_policy_default_params - fills in the default controller parameters
+ * @params: the parameters
+ */
+void cp_policy_default_params(struct cp_policy_params *params)
+{
+	params->target_delay = 50;
+	params->target_idle = 0.3;
+	params->kp = 0.5;
+	params->ki = 2;
+	params->kd = 0;
+	params->integral_max = 0.5;
+	params->deadband = 0.6;
+	params->up_dwell = 20000;
+	params->down_dwell = 500000;
+	params->min_cpus = 1;
+	params->max_cpus = INT_MAX;
+}
+
+/**
+ * cp_policy_init - initializes the controller state
+ * @pol: the policy
+ * @params: the controller parameters
+ * @now: the current time (us)
+ */
+void cp_policy_init(struct cp_policy *pol,
+		    const struct cp_policy_params *params,
+		    unsigned long now)
+{
+	pol->params = *params;
+	pol->integral = 0;
+	pol->prv_error = 0;
+	pol->prv_ts = now;
+	pol->last_change = now;
+}
+
+static double cp_policy_error(const struct cp_policy_params *p,
+			      const struct cp_sample *s)
+{
+	if (s->queuing_delay > p->target_delay)
+		return (s->queuing_delay - p->target_delay) / p->target_delay;
+	if (s->idle > p->target_idle)
+		return p->target_idle - s->idle;
+	return 0;
+}
+
+/**
+ * cp_policy_update - feeds a sample to the controller
+ * @pol: the policy
+ * @s: the metrics sample
+ * @d: filled in with the decision and the reason behind it
+ *
+ * Returns true if the number of cpus should change.
+ */
+int cp_policy_update(struct cp_policy *pol, const struct cp_sample *s,
+		     struct cp_decision *d)
+{
+	const struct cp_policy_params *p = &pol->params;
+	double error, deriv = 0, output, delta;
+	double dt = 0, integral = pol->integral;
+	int cpus, step;
+
+	if (s->ts > pol->prv_ts)
+		dt = (double) (s->ts - pol->prv_ts) / 1000000;
+
+	error = cp_policy_error(p, s);
+	if (dt > 0) {
+		pol->integral += error * dt;
+		pol->integral = fmin(fmax(pol->integral, -p->integral_max),
+				     p->integral_max);
+		deriv = (error - pol->prv_error) / dt;
+	}
+	pol->prv_error = error;
+	pol->prv_ts = s->ts;
+
+	output = p->kp * error + p->ki * pol->integral + p->kd * deriv;
+	delta = output * (s->nr_cpus > 0 ? s->nr_cpus : 1);
+
+	d->error = error;
+	d->integral = pol->integral;
+	d->output = output;
+	d->cpus = s->nr_cpus;
+	d->want = s->nr_cpus;
+
+	if (fabs(delta) < p->deadband) {
+		d->reason = "deadband";
+		return 0;
+	}
+
+	step = (int) lround(fabs(delta));
+	if (step < 1)
+		step = 1;
+	cpus = delta > 0 ? s->nr_cpus + step : s->nr_cpus - step;
+
+	if (cpus > p->max_cpus)
+		cpus = p->max_cpus;
+	if (cpus < p->min_cpus)
+		cpus = p->min_cpus;
+	d->want = cpus;
+
+	if (cpus == s->nr_cpus) {
+		/* the actuator is saturated, stop winding up */
+		pol->integral = integral;
+		d->integral = integral;
+		d->reason = "clamped";
+		return 0;
+	}
+
+	if (cpus > s->nr_cpus && s->ts - pol->last_change < p->up_dwell) {
+		d->reason = "up dwell";
+		return 0;
+	}
+
+	if (cpus < s->nr_cpus && s->ts - pol->last_change < p->down_dwell) {
+		d->reason = "down dwell";
+		return 0;
+	}
+
+	d->cpus = cpus;
+	d->reason = cpus > s->nr_cpus ? "delay" : "idle";
+	pol->last_change = s->ts;
+	pol->integral = 0;
+
+	return 1;
+}
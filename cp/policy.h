@@ -0,0 +1,75 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * policy.h - core allocation policy of the control plane daemon
+ *
+ * The policy is a pure function of the metric samples it is fed, so it
+ * can be driven either by the live shared memory or by a recorded trace.
+ */
+
+#pragma once
+
+struct cp_policy_params {
+	double target_delay;		/* queuing delay setpoint (us) */
+	double target_idle;		/* idle fraction tolerated before scaling down */
+	double kp, ki, kd;		/* PID gains, output is a relative change in cpus */
+	double integral_max;		/* anti-windup clamp of the integral term */
+	double deadband;		/* minimum change (in cpus) worth acting upon */
+	unsigned long up_dwell;		/* us to wait after a change before scaling up */
+	unsigned long down_dwell;	/* us to wait after a change before scaling down */
+	int min_cpus;
+	int max_cpus;
+};
+
+struct cp_sample {
+	unsigned long ts;		/* us */
+	int nr_cpus;			/* running cpus */
+	double queuing_delay;		/* worst EMA over the running cpus, or a
+					 * quantile of the last interval (us) */
+	double idle;			/* average idle EMA over the running cpus */
+};
+
+struct cp_decision {
+	int cpus;			/* the new number of cpus */
+	int want;			/* the cpus asked for before any hold */
+	double error;
+	double integral;
+	double output;
+	const char *reason;
+};
+
+struct cp_policy {
+	struct cp_policy_params params;
+	double integral;
+	double prv_error;
+	unsigned long prv_ts;
+	unsigned long last_change;
+};
+
+extern void cp_policy_default_params(struct cp_policy_params *params);
+extern void cp_policy_init(struct cp_policy *pol,
+			   const struct cp_policy_params *params,
+			   unsigned long now);
+extern int cp_policy_update(struct cp_policy *pol, const struct cp_sample *s,
+			    struct cp_decision *d);
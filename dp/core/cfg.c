@@ -43,6 +43,7 @@
 #include <ix/types.h>
 #include <ix/cfg.h>
 #include <ix/cpu.h>
+#include <ix/kstats.h>
 
 #include <net/ethernet.h>
 #include <net/ip.h>
@@ -65,7 +66,10 @@ static int parse_arp(void);
 static int parse_devices(void);
 static int parse_cpu(void);
 static int parse_batch(void);
+static int parse_mtu(void);
 static int parse_loader_path(void);
+static int parse_kstats_pmu(void);
+static int parse_pcap_replay(void);
 
 struct config_vector_t {
 	const char *name;
@@ -80,7 +84,10 @@ static struct config_vector_t config_tbl[] = {
 	{ "devices",      parse_devices},
 	{ "cpu",          parse_cpu},
 	{ "batch",        parse_batch},
+	{ "mtu",          parse_mtu},
 	{ "loader_path",  parse_loader_path},
+	{ "kstats_pmu",   parse_kstats_pmu},
+	{ "pcap_replay",  parse_pcap_replay},
 	{ NULL,           NULL}
 };
 
@@ -224,13 +231,31 @@ static int add_dev(const char *dev)
 	int ret, i;
 	struct pci_addr addr;
 
+	if (!strncmp(dev, CFG_LOOPBACK_PREFIX, strlen(CFG_LOOPBACK_PREFIX))) {
+		dev += strlen(CFG_LOOPBACK_PREFIX);
+		if (!*dev || strlen(dev) >= sizeof(CFG.ethdev_loopback[0])) {
+			log_err("cfg: invalid loopback device name %s\n", dev);
+			return -EINVAL;
+		}
+		for (i = 0; i < CFG.num_ethdev; ++i) {
+			if (!strcmp(CFG.ethdev_loopback[i], dev))
+				return 0;
+		}
+		if (CFG.num_ethdev >= CFG_MAX_ETHDEV)
+			return -E2BIG;
+		memset(&CFG.ethdev[CFG.num_ethdev], 0, sizeof(struct pci_addr));
+		strcpy(CFG.ethdev_loopback[CFG.num_ethdev++], dev);
+		return 0;
+	}
+
 	ret = pci_str_to_addr(dev, &addr);
 	if (ret) {
 		log_err("cfg: invalid device name %s\n", dev);
 		return ret;
 	}
 	for (i = 0; i < CFG.num_ethdev; ++i) {
-		if (!memcmp(&CFG.ethdev[i], &addr, sizeof(struct pci_addr)))
+		if (!CFG.ethdev_loopback[i][0] &&
+		    !memcmp(&CFG.ethdev[i], &addr, sizeof(struct pci_addr)))
 			return 0;
 	}
 	if (CFG.num_ethdev >= CFG_MAX_ETHDEV)
@@ -305,12 +330,36 @@ static int parse_cpu(void)
 
 static int parse_batch(void)
 {
-	int batch = -1;
+	int batch = -1, min, max, slo = 0;
 	config_lookup_int(&cfg, "batch", &batch);
 	if (!batch || batch <= 0) {
 		return -EINVAL;
 	}
 	eth_rx_max_batch = batch;
+
+	/* the adaptive bound is optional and starts out at "batch" */
+	min = min(8, batch);
+	max = batch;
+	config_lookup_int(&cfg, "batch_min", &min);
+	config_lookup_int(&cfg, "batch_max", &max);
+	config_lookup_int(&cfg, "batch_slo", &slo);
+	if (min <= 0 || min > batch || max < batch || slo < 0) {
+		return -EINVAL;
+	}
+	eth_rx_batch_min = min;
+	eth_rx_batch_max = max;
+	eth_rx_batch_slo = slo;
+	return 0;
+}
+
+static int parse_mtu(void)
+{
+	int mtu = ETH_MTU;
+
+	config_lookup_int(&cfg, "mtu", &mtu);
+	if (mtu < ETH_MIN_MTU || mtu > ETH_MAX_LEN_JUMBO - ETH_HDR_LEN - ETH_CRC_LEN)
+		return -EINVAL;
+	CFG.mtu = mtu;
 	return 0;
 }
 
@@ -326,6 +375,68 @@ static int parse_loader_path(void)
 	return 0;
 }
 
+static int add_kstats_pmu(const char *name)
+{
+	static const char *names[] = KSTATS_PMU_NAMES;
+	int i;
+
+	for (i = 0; i < KSTATS_PMU_NR_EVENTS; i++) {
+		if (!strcmp(name, names[i])) {
+			CFG.kstats_pmu |= 1 << i;
+			return 0;
+		}
+	}
+
+	log_err("cfg: unknown PMU event '%s'\n", name);
+	return -EINVAL;
+}
+
+static int parse_kstats_pmu(void)
+{
+	const config_setting_t *events = NULL;
+	const char *event = NULL;
+	int i, ret;
+
+	events = config_lookup(&cfg, "kstats_pmu");
+	if (!events)
+		return 0;
+	event = config_setting_get_string(events);
+	if (event)
+		return add_kstats_pmu(event);
+	for (i = 0; i < config_setting_length(events); ++i) {
+		event = config_setting_get_string_elem(events, i);
+		if (!event)
+			return -EINVAL;
+		ret = add_kstats_pmu(event);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int parse_pcap_replay(void)
+{
+	const char *parsed = NULL;
+	double speed;
+	int ispeed;
+
+	CFG.pcap_replay_speed = 1.0;
+	config_lookup_string(&cfg, "pcap_replay", &parsed);
+	if (!parsed)
+		return 0;
+	if (strlen(parsed) >= sizeof(CFG.pcap_replay))
+		return -EINVAL;
+	strcpy(CFG.pcap_replay, parsed);
+
+	if (config_lookup_float(&cfg, "pcap_replay_speed", &speed))
+		CFG.pcap_replay_speed = speed;
+	else if (config_lookup_int(&cfg, "pcap_replay_speed", &ispeed))
+		CFG.pcap_replay_speed = ispeed;
+	if (CFG.pcap_replay_speed < 0)
+		return -EINVAL;
+	return 0;
+}
+
 static int parse_conf_file(const char *path)
 {
 	int ret, i;
@@ -37,6 +37,7 @@
 #include <ix/cpu.h>
 #include <ix/mem.h>
 #include <ix/mempool.h>
+#include <ix/mbuf.h>
 
 int cpu_count;
 int cpus_active;
@@ -59,19 +60,86 @@ struct cpu_runner {
 	void *data;
 };
 
+/*
+ * The runlist is an intrusive multi-producer single-consumer queue.
+ * Producers append with a single atomic exchange on @tail and then link
+ * the previous tail to the new runner. The owning core is the only
+ * consumer and pops from @head without any atomic operation. The @stub
+ * runner keeps the queue non-empty so that neither side ever has to
+ * update both ends.
+ */
 struct cpu_runlist {
-	spinlock_t lock;
-	struct cpu_runner *next_runner;
+	struct cpu_runner *tail;
+	char pad[CACHE_LINE_SIZE - sizeof(struct cpu_runner *)];
+	struct cpu_runner *head;
+	struct cpu_runner stub;
 } __aligned(CACHE_LINE_SIZE);
 
 static DEFINE_PERCPU(struct cpu_runlist, runlist);
 
 static struct mempool_datastore runners_datastore;
 
-#define MAX_RUNNERS 1024
+/* enough runners for every core to cache a couple of chunks */
+#define MAX_RUNNERS	(NCPU * MEMPOOL_DEFAULT_CHUNKSIZE * 2)
 
 static DEFINE_PERCPU(struct mempool, runners_mempool);
 
+static void cpu_runlist_init(struct cpu_runlist *rlist)
+{
+	rlist->stub.next = NULL;
+	rlist->head = &rlist->stub;
+	rlist->tail = &rlist->stub;
+}
+
+static void cpu_runlist_push(struct cpu_runlist *rlist,
+			     struct cpu_runner *runner)
+{
+	struct cpu_runner *prev;
+
+	runner->next = NULL;
+	prev = __sync_lock_test_and_set(&rlist->tail, runner);
+	__atomic_store_n(&prev->next, runner, __ATOMIC_RELEASE);
+}
+
+/*
+ * cpu_runlist_pop - removes the oldest runner from the local runlist
+ *
+ * Returns NULL if the runlist is empty, or if a producer has swapped
+ * the tail but not yet linked its runner. In the latter case the runner
+ * is picked up by a later call.
+ */
+static struct cpu_runner *cpu_runlist_pop(struct cpu_runlist *rlist)
+{
+	struct cpu_runner *head = rlist->head;
+	struct cpu_runner *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+
+	if (head == &rlist->stub) {
+		if (!next)
+			return NULL;
+		rlist->head = next;
+		head = next;
+		next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	}
+
+	if (next) {
+		rlist->head = next;
+		return head;
+	}
+
+	if (head != __atomic_load_n(&rlist->tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	/* @head is the last runner, requeue the stub behind it */
+	cpu_runlist_push(rlist, &rlist->stub);
+	next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		rlist->head = next;
+		return head;
+	}
+
+	return NULL;
+}
+
 /**
  * cpu_run_on_one - calls a function on the specified CPU
  * @func: the function to call
@@ -83,9 +151,9 @@ static DEFINE_PERCPU(struct mempool, runners_mempool);
 int cpu_run_on_one(cpu_func_t func, void *data, unsigned int cpu)
 {
 	struct cpu_runner *runner;
-	struct cpu_runlist *rlist;
 
-	if (cpu >= cpu_count)
+	/* the runlist of a core exists once its percpu area does */
+	if (cpu >= cpu_count || !cpu_is_active(cpu))
 		return -EINVAL;
 
 	runner = mempool_alloc(&percpu_get(runners_mempool));
@@ -94,14 +162,8 @@ int cpu_run_on_one(cpu_func_t func, void *data, unsigned int cpu)
 
 	runner->func = func;
 	runner->data = data;
-	runner->next = NULL;
 
-	rlist = &percpu_get_remote(runlist, cpu);
-
-	spin_lock(&rlist->lock);
-	runner->next = rlist->next_runner;
-	rlist->next_runner = runner;
-	spin_unlock(&rlist->lock);
+	cpu_runlist_push(&percpu_get_remote(runlist, cpu), runner);
 
 	return 0;
 }
@@ -114,18 +176,16 @@ void cpu_do_bookkeeping(void)
 	struct cpu_runlist *rlist = &percpu_get(runlist);
 	struct cpu_runner *runner;
 
-	if (rlist->next_runner) {
-		spin_lock(&rlist->lock);
-		runner = rlist->next_runner;
-		rlist->next_runner = NULL;
-		spin_unlock(&rlist->lock);
-
-		do {
-			struct cpu_runner *last = runner;
-			runner->func(runner->data);
-			runner = runner->next;
-			mempool_free(&percpu_get(runners_mempool), last);
-		} while (runner);
+	mbuf_do_bookkeeping();
+
+	/* cheap check that only touches the consumer side */
+	if (rlist->head == &rlist->stub &&
+	    !__atomic_load_n(&rlist->stub.next, __ATOMIC_ACQUIRE))
+		return;
+
+	while ((runner = cpu_runlist_pop(rlist))) {
+		runner->func(runner->data);
+		mempool_free(&percpu_get(runners_mempool), runner);
 	}
 }
 
@@ -142,9 +202,11 @@ static void *cpu_init_percpu(unsigned int cpu, unsigned int numa_node)
 	addr_percpu = addr + PERCPU_DUNE_LEN;
 
 	memset(addr_percpu, 0, len);
+	cpu_runlist_init((struct cpu_runlist *)
+			 ((uintptr_t) &runlist + (uintptr_t) addr_percpu));
 
 	*((char **) addr) = addr_percpu;
-	percpu_offsets[cpu] = addr_percpu;
+	__atomic_store_n(&percpu_offsets[cpu], addr_percpu, __ATOMIC_RELEASE);
 
 	return addr;
 }
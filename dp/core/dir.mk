@@ -21,10 +21,10 @@
 
 # Makefile for the core system
 
-SRC = ethdev.c ethfg.c ethqueue.c cfg.c control_plane.c cpu.c init.c log.c mbuf.c mem.c mempool.c page.c pci.c utimer.c syscall.c timer.c vm.c dpdk.c perf.c stats.c
+SRC = ethdev.c ethfg.c ethqueue.c cfg.c control_plane.c cpu.c init.c log.c mbuf.c mem.c mempool.c page.c pci.c utimer.c syscall.c timer.c vm.c dpdk.c perf.c stats.c trace.c pcap.c
 
 ifneq ($(ENABLE_KSTATS),)
-SRC += kstats.c tailqueue.c
+SRC += kstats.c
 endif
 
 $(eval $(call register_dir, core, $(SRC)))
@@ -63,6 +63,15 @@ int dpdk_init(void)
 	const int pool_cache_size = 0;
 	/* pool_size sets an implicit limit on cores * NICs that DPDK allows */
 	const int pool_size = 32768;
+	int i;
+
+	/* software devices (e.g. loopback links) don't need DPDK */
+	for (i = 0; i < CFG.num_ethdev; i++) {
+		if (!CFG.ethdev_loopback[i][0])
+			break;
+	}
+	if (i == CFG.num_ethdev)
+		return 0;
 
 	/* We want to place DPDK in the desired NUMA node. Otherwise, its memory
 	 * allocations will fail. */
@@ -327,6 +327,11 @@ struct ix_rte_eth_dev *eth_dev_alloc(size_t private_len)
 
 	memset(dev->data, 0, sizeof(struct ix_rte_eth_dev_data));
 	dev->data->dev_conf = default_conf;
+	if (CFG.mtu > ETH_MTU) {
+		dev->data->dev_conf.rxmode.jumbo_frame = 1;
+		dev->data->dev_conf.rxmode.max_rx_pkt_len =
+			CFG.mtu + ETH_HDR_LEN + ETH_CRC_LEN;
+	}
 
 	dev->data->dev_private = malloc(private_len);
 	if (!dev->data->dev_private) {
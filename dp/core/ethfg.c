@@ -32,6 +32,7 @@
 #include <ix/ethdev.h>
 #include <ix/control_plane.h>
 #include <ix/cfg.h>
+#include <ix/trace.h>
 
 #define TRANSITION_TIMEOUT (1 * ONE_MS)
 
@@ -137,6 +138,34 @@ void eth_fg_free(struct eth_fg *fg)
 		mem_free_pages(fg->perfg, div_up(len, PGSIZE_2MB), PGSIZE_2MB);
 }
 
+/**
+ * eth_fg_publish_metrics - exports the load of local flow groups
+ *
+ * Copies the counters accumulated by this CPU into the control plane
+ * shared memory. The counters are cumulative; the control plane
+ * derives rates by sampling them periodically.
+ */
+void eth_fg_publish_metrics(void)
+{
+	int i, j;
+	struct eth_fg *fg;
+	volatile struct flow_group_metrics *m;
+
+	for (i = 0; i < CFG.num_ethdev; i++) {
+		for (j = 0; j < nr_flow_groups; j++) {
+			fg = fgs[i * ETH_MAX_NUM_FG + j];
+			if (!fg || fg->cur_cpu != percpu_get(cpu_id))
+				continue;
+
+			m = &cp_shmem->flow_group[i * ETH_MAX_NUM_FG + j];
+			m->conns = fg->tcp_active_pcbs;
+			m->pkts = fg->acc_pkts;
+			m->bytes = fg->acc_bytes;
+			m->cycles = fg->acc_cycles;
+		}
+	}
+}
+
 static int eth_fg_assign_single_to_cpu(int fg_id, int cpu, struct rte_eth_rss_reta *rss_reta, struct ix_rte_eth_dev **eth)
 {
 	struct eth_fg *fg = fgs[fg_id];
@@ -236,6 +265,7 @@ void eth_fg_assign_to_cpu(bitmap_ptr fg_bitmap, int cpu)
 	SCRATCHPAD->backlog_before = count;
 
 	SCRATCHPAD->ts_migration_start = rdtsc();
+	trace_event(TRACE_MIGRATE_START, cpu);
 
 	assert(percpu_get(migration_info).prev_cpu == -1);
 	assert(percpu_get_remote(migration_info, CFG.cpu[cpu]).prev_cpu == -1);
@@ -418,6 +448,8 @@ static void transition_handler_target(void *info_)
 	migrate_timers_from_remote();
 
 	SCRATCHPAD->ts_migration_end = rdtsc();
+	trace_event(TRACE_MIGRATE_END, SCRATCHPAD->remote_queue_pkts_end +
+					SCRATCHPAD->local_queue_pkts);
 
 	count = 0;
 	for (i = 0; i < percpu_get(eth_num_queues); i++)
@@ -515,9 +547,9 @@ int eth_recv_handle_fg_transition(struct eth_rx_queue *rx_queue, struct mbuf *pk
 		eth_recv_at_target(rx_queue, pkt);
 		return 1;
 	} else {
-		/* FIXME: somebody must mbuf_free(pkt) but we cannot do it here
-		   because we don't own the memory pool */
 		log_warn("dropping packet: flow group %d of device %d should be handled by cpu %d\n", fg->idx, fg->dev_idx, fg->cur_cpu);
+		trace_event(TRACE_DROP, TRACE_DROP_FG_TRANSITION);
+		mbuf_free(pkt);
 		return 1;
 	}
 }
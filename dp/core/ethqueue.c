@@ -30,6 +30,8 @@
 #include <ix/ethdev.h>
 #include <ix/log.h>
 #include <ix/control_plane.h>
+#include <ix/trace.h>
+#include <ix/pcap.h>
 
 /* Accumulate metrics period (in us) */
 #define METRICS_PERIOD_US 10000
@@ -54,6 +56,8 @@ struct metrics_accumulator {
 	long queue_size;
 	long loop_duration;
 	long prv_timestamp;
+	int busy;
+	int slo_miss;
 };
 
 static DEFINE_PERCPU(struct metrics_accumulator, metrics_acc);
@@ -70,6 +74,52 @@ static struct power_accumulator power_acc;
 
 unsigned int eth_rx_max_batch = 64;
 
+/* adaptive RX batching, enabled by a non-zero SLO (in us) */
+unsigned int eth_rx_batch_min = 8;
+unsigned int eth_rx_batch_max = 64;
+unsigned int eth_rx_batch_slo;
+
+static DEFINE_PERCPU(unsigned int, eth_rx_batch);
+
+/**
+ * eth_rx_batch_bound - returns the RX batch bound of this core
+ */
+static inline unsigned int eth_rx_batch_bound(void)
+{
+	unsigned int batch = percpu_get(eth_rx_batch);
+
+	return batch ? batch : eth_rx_max_batch;
+}
+
+/**
+ * eth_rx_batch_update - adjusts the RX batch bound after an iteration
+ * @delay: the queuing delay of the oldest packet processed, in us
+ * @backlog: the number of packets left in the queues
+ *
+ * Only iterations that the bound cut short, i.e. that left a backlog,
+ * say anything about it. If the backlog has waited past the SLO, the
+ * core is falling behind, so the bound doubles to amortize more
+ * per-iteration overhead. If it is still well within the SLO, the bound
+ * decays by an eighth so that packets get back to the application
+ * sooner. Idle iterations and those that drain the queues leave the
+ * bound alone.
+ */
+static void eth_rx_batch_update(unsigned int delay, int backlog)
+{
+	unsigned int batch;
+
+	if (!eth_rx_batch_slo || !backlog)
+		return;
+
+	batch = eth_rx_batch_bound();
+	if (delay >= eth_rx_batch_slo)
+		batch = min(batch * 2, eth_rx_batch_max);
+	else if (delay < eth_rx_batch_slo / 2)
+		batch = max(batch - max(batch / 8, 1u), eth_rx_batch_min);
+
+	percpu_get(eth_rx_batch) = batch;
+}
+
 /**
  * eth_process_poll - polls HW for new packets
  *
@@ -88,9 +138,20 @@ int eth_process_poll(void)
 	return count;
 }
 
-static int eth_process_recv_queue(struct eth_rx_queue *rxq)
+/*
+ * eth_process_recv_queue - processes one packet from a receive queue
+ * @rxq: the receive queue
+ * @tsc: the timestamp of the end of the previous packet, updated on return
+ *
+ * The cycles since @tsc are charged to the flow group of the packet, and
+ * the time the packet waited in the queue is recorded in the RX delay
+ * sketch of the core.
+ */
+static int eth_process_recv_queue(struct eth_rx_queue *rxq, unsigned long *tsc)
 {
 	struct mbuf *pos = rxq->head;
+	struct eth_fg *fg;
+	unsigned long now;
 #ifdef ENABLE_KSTATS
 	kstats_accumulate tmp;
 #endif
@@ -101,11 +162,22 @@ static int eth_process_recv_queue(struct eth_rx_queue *rxq)
 	/* NOTE: pos could get freed after eth_input(), so check next here */
 	rxq->head = pos->next;
 	rxq->len--;
+	fg = fgs[pos->fg_id];
+
+	if (likely(*tsc > pos->timestamp))
+		latsketch_add(&cp_shmem->latency[percpu_get(cpu_nr)].rx_delay,
+			      (*tsc - pos->timestamp) * 1000 / cycles_per_us);
+
+	pcap_capture(PCAP_DIR_RX, pos);
 
 	KSTATS_PUSH(eth_input, &tmp);
 	eth_input(rxq, pos);
 	KSTATS_POP(&tmp);
 
+	now = rdtsc();
+	fg->acc_cycles += now - *tsc;
+	*tsc = now;
+
 	return 0;
 }
 
@@ -117,9 +189,10 @@ static int eth_process_recv_queue(struct eth_rx_queue *rxq)
 int eth_process_recv(void)
 {
 	int i, count = 0;
+	unsigned int batch = eth_rx_batch_bound();
 	bool empty;
 	unsigned long min_timestamp = -1;
-	unsigned long timestamp;
+	unsigned long timestamp, tsc;
 	int value;
 	struct metrics_accumulator *this_metrics_acc = &percpu_get(metrics_acc);
 	int backlog;
@@ -134,6 +207,7 @@ int eth_process_recv(void)
 	 * going a little over the batch limit if it means
 	 * we're not favoring one queue over another.
 	 */
+	tsc = rdtsc();
 	do {
 		empty = true;
 		for (i = 0; i < percpu_get(eth_num_queues); i++) {
@@ -141,12 +215,12 @@ int eth_process_recv(void)
 			struct mbuf *pos = rxq->head;
 			if (pos)
 				min_timestamp = min(min_timestamp, pos->timestamp);
-			if (!eth_process_recv_queue(rxq)) {
+			if (!eth_process_recv_queue(rxq, &tsc)) {
 				count++;
 				empty = false;
 			}
 		}
-	} while (!empty && count < eth_rx_max_batch);
+	} while (!empty && count < batch);
 
 	backlog = 0;
 	for (i = 0; i < percpu_get(eth_num_queues); i++)
@@ -155,6 +229,12 @@ int eth_process_recv(void)
 	timestamp = rdtsc();
 	this_metrics_acc->count++;
 	value = count ? (timestamp - min_timestamp) / cycles_per_us : 0;
+	eth_rx_batch_update(value, backlog);
+	if (count) {
+		this_metrics_acc->busy++;
+		if (eth_rx_batch_slo && value >= eth_rx_batch_slo)
+			this_metrics_acc->slo_miss++;
+	}
 	this_metrics_acc->queuing_delay += value;
 	this_metrics_acc->batch_size += count;
 	this_metrics_acc->queue_size += count + backlog;
@@ -165,6 +245,9 @@ int eth_process_recv(void)
 		EMA_UPDATE(cp_shmem->cpu_metrics[percpu_get(cpu_nr)].idle[0], idle, EMA_SMOOTH_FACTOR_0);
 		EMA_UPDATE(cp_shmem->cpu_metrics[percpu_get(cpu_nr)].idle[1], idle, EMA_SMOOTH_FACTOR_1);
 		EMA_UPDATE(cp_shmem->cpu_metrics[percpu_get(cpu_nr)].idle[2], idle, EMA_SMOOTH_FACTOR_2);
+		cp_shmem->cpu_metrics[percpu_get(cpu_nr)].rx_batch = eth_rx_batch_bound();
+		cp_shmem->cpu_metrics[percpu_get(cpu_nr)].rx_slo_miss = this_metrics_acc->busy ?
+			this_metrics_acc->slo_miss * 1000 / this_metrics_acc->busy : 0;
 		if (this_metrics_acc->count) {
 			this_metrics_acc->loop_duration -= percpu_get(idle_cycles);
 			this_metrics_acc->loop_duration /= cycles_per_us;
@@ -182,6 +265,7 @@ int eth_process_recv(void)
 			EMA_UPDATE(cp_shmem->cpu_metrics[percpu_get(cpu_nr)].queue_size[2], 0, EMA_SMOOTH_FACTOR_2);
 			EMA_UPDATE(cp_shmem->cpu_metrics[percpu_get(cpu_nr)].loop_duration, 0, EMA_SMOOTH_FACTOR_0);
 		}
+		eth_fg_publish_metrics();
 		this_metrics_acc->timestamp = timestamp;
 		percpu_get(idle_cycles) = 0;
 		this_metrics_acc->count = 0;
@@ -189,6 +273,8 @@ int eth_process_recv(void)
 		this_metrics_acc->batch_size = 0;
 		this_metrics_acc->queue_size = 0;
 		this_metrics_acc->loop_duration = 0;
+		this_metrics_acc->busy = 0;
+		this_metrics_acc->slo_miss = 0;
 	}
 	/* NOTE: assuming that the first CPU never idles */
 	if (percpu_get(cpu_nr) == 0 && timestamp - power_acc.prv_timestamp > (long) cycles_per_us * POWER_PERIOD_US) {
@@ -205,10 +291,13 @@ int eth_process_recv(void)
 		power_acc.prv_energy = energy;
 	}
 
+	if (count)
+		trace_event(TRACE_RX_BATCH, count);
+
 	KSTATS_PACKETS_INC(count);
 	KSTATS_BATCH_INC(count);
 #ifdef ENABLE_KSTATS
-	backlog = div_up(backlog, eth_rx_max_batch);
+	backlog = div_up(backlog, batch);
 	KSTATS_BACKLOG_INC(backlog);
 #endif
 
@@ -220,12 +309,17 @@ int eth_process_recv(void)
  */
 void eth_process_send(void)
 {
-	int i, nr;
+	int i, j, nr;
 	struct eth_tx_queue *txq;
 
 	for (i = 0; i < percpu_get(eth_num_queues); i++) {
 		txq = percpu_get(eth_txqs[i]);
 
+		if (unlikely(pcap_active())) {
+			for (j = 0; j < txq->len; j++)
+				pcap_capture(PCAP_DIR_TX, txq->bufs[j]);
+		}
+
 		nr = eth_tx_xmit(txq, txq->len, txq->bufs);
 		if (unlikely(nr != txq->len))
 			panic("transmit buffer size mismatch\n");
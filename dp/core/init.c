@@ -46,6 +46,8 @@
 #include <ix/log.h>
 #include <ix/drivers.h>
 #include <ix/stats.h>
+#include <ix/trace.h>
+#include <ix/pcap.h>
 
 #include <net/ip.h>
 
@@ -94,6 +96,12 @@ static struct init_vector_t init_tbl[] = {
 	{ "cp",      cp_init,      NULL, NULL},
 #if CONFIG_STATS
 	{ "stats", stats_init, stats_init_cpu, NULL},
+#endif
+#if CONFIG_TRACE
+	{ "trace",   trace_init,   NULL, NULL},               // after cp
+#endif
+#if CONFIG_PCAP
+	{ "pcap",    pcap_init,    NULL, NULL},               // after cp
 #endif
 	{ "pci",     init_pci,     NULL, NULL},
 	{ "dpdk",    dpdk_init,    NULL, NULL},
@@ -106,7 +114,7 @@ static struct init_vector_t init_tbl[] = {
 	{ "hw",      init_hw,      NULL, NULL},               // spaws per-cpu init sequence
 	{ "syscall", NULL,         syscall_init_cpu, NULL},
 #ifdef ENABLE_KSTATS
-	{ "kstats",  NULL,         kstats_init_cpu, NULL},    // after timer
+	{ "kstats",  kstats_init,  kstats_init_cpu, NULL},    // after timer and cfg
 #endif
 	{ "init-net", NULL,         init_network_cpu, NULL},  // FIXME should be split
 	{ NULL, NULL, NULL, NULL}
@@ -143,12 +151,15 @@ pgflt_handler(uintptr_t addr, uint64_t fec, struct dune_tf *tf)
 
 static int init_pci(void)
 {
-	int ret;
+	int ret = 0;
 	int i;
 	for (i = 0; i < CFG.num_ethdev; i++) {
 		const struct pci_addr *addr = &CFG.ethdev[i];
 		struct pci_dev *dev;
 
+		if (CFG.ethdev_loopback[i][0])
+			continue;
+
 		dev = pci_alloc_dev(addr);
 		if (!dev)
 			return -ENOMEM;
@@ -189,7 +200,10 @@ static int init_ethdev(void)
 	for (i = 0; i < CFG.num_ethdev; i++) {
 		struct ix_rte_eth_dev *eth;
 
-		ret = driver_init(pci_devices[i], &eth);
+		if (CFG.ethdev_loopback[i][0])
+			ret = loopback_init(CFG.ethdev_loopback[i], &eth);
+		else
+			ret = driver_init(pci_devices[i], &eth);
 		if (ret) {
 			log_err("init: failed to start driver\n");
 			goto err;
@@ -24,172 +24,197 @@
 
 /*
  * kstats.c -- "kstats" (tree-based) statistics
- *    reports min/avg/max latency and occupancy for the various IX services
- *    printfs at regular intervals, which reset the counters.
+ *    accumulates latency histograms and occupancy for the various IX
+ *    services, and periodically publishes them to shared memory.
  */
 
-
-
+#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <linux/perf_event.h>
 #include <ix/kstats.h>
+#include <ix/errno.h>
 #include <ix/log.h>
 #include <ix/timer.h>
 #include <ix/perf.h>
+#include <ix/cfg.h>
 
-#define KSTATS_INTERVAL (5 * ONE_SECOND)
+#define KSTATS_INTERVAL (1 * ONE_SECOND)
 
 DEFINE_PERCPU(kstats, _kstats);
 DEFINE_PERCPU(kstats_accumulate, _kstats_accumulate);
-DEFINE_PERCPU(int, _kstats_packets);
-DEFINE_PERCPU(int, _kstats_batch_histogram[KSTATS_BATCH_HISTOGRAM_SIZE]);
-DEFINE_PERCPU(int, _kstats_backlog_histogram[KSTATS_BACKLOG_HISTOGRAM_SIZE]);
+DEFINE_PERCPU(uint64_t, _kstats_packets);
+DEFINE_PERCPU(uint32_t, _kstats_batch_histogram[KSTATS_BATCH_HISTOGRAM_SIZE]);
+DEFINE_PERCPU(uint32_t, _kstats_backlog_histogram[KSTATS_BACKLOG_HISTOGRAM_SIZE]);
 DEFINE_PERCPU(int, llc_load_misses_fd);
 DEFINE_PERCPU(int, hw_instructions_fd);
+static DEFINE_PERCPU(struct kstats_pmu, _kstats_pmu);
 
 static DEFINE_PERCPU(struct timer, _kstats_timer);
 
+static struct ix_kstats *ix_kstats;
+
+static inline void kstats_pmu_read(struct kstats_pmu *pmu, uint64_t *val)
+{
+	int i;
+
+	for (i = 0; i < pmu->nr; i++)
+		val[i] = rdpmc(pmu->counter[i]);
+}
+
 void kstats_enter(kstats_distr *n, kstats_accumulate *saved_accu)
 {
-	kstats_distr *old = percpu_get(_kstats_accumulate).cur;
+	struct kstats_pmu *pmu = &percpu_get(_kstats_pmu);
+	kstats_accumulate *acc = &percpu_get(_kstats_accumulate);
+	kstats_distr *old = acc->cur;
 	uint64_t now = rdtsc();
+	uint64_t now_pmu[KSTATS_PMU_NR_EVENTS];
+	int i;
+
+	if (pmu->nr)
+		kstats_pmu_read(pmu, now_pmu);
+
 	if (old && saved_accu) {
-		*saved_accu = percpu_get(_kstats_accumulate);
+		*saved_accu = *acc;
 		saved_accu->cur = old;
 		saved_accu->accum_time = now - saved_accu->start_occ;
+		for (i = 0; i < pmu->nr; i++)
+			saved_accu->accum_pmu[i] += now_pmu[i] - saved_accu->start_pmu[i];
 	}
 
-	percpu_get(_kstats_accumulate).cur = n;
-	percpu_get(_kstats_accumulate).start_lat = now;
-	percpu_get(_kstats_accumulate).start_occ = now;
-	percpu_get(_kstats_accumulate).accum_time = 0;
+	acc->cur = n;
+	acc->start_lat = now;
+	acc->start_occ = now;
+	acc->accum_time = 0;
+	for (i = 0; i < pmu->nr; i++) {
+		acc->start_pmu[i] = now_pmu[i];
+		acc->accum_pmu[i] = 0;
+	}
 }
 
 void kstats_leave(kstats_accumulate *saved_accu)
 {
+	struct kstats_pmu *pmu = &percpu_get(_kstats_pmu);
 	kstats_accumulate *acc = &percpu_get(_kstats_accumulate);
 	uint64_t now = rdtsc();
 	uint64_t diff_lat = now - acc->start_lat;
 	uint64_t diff_occ = now - acc->start_occ + acc->accum_time;
+	uint64_t now_pmu[KSTATS_PMU_NR_EVENTS];
 	kstats_distr *cur = acc->cur;
+	int i;
 
 	if (cur)  {
+		if (pmu->nr) {
+			kstats_pmu_read(pmu, now_pmu);
+			for (i = 0; i < pmu->nr; i++)
+				cur->pmu[pmu->event[i]] += (now_pmu[i] - acc->start_pmu[i] +
+							   acc->accum_pmu[i]) & pmu->width_mask[i];
+		}
 		cur->tot_lat += diff_lat;
 		cur->tot_occ += diff_occ;
-		if (cur->count == 0) {
-			cur->min_lat = diff_lat;
-			cur->max_lat = diff_lat;
-			cur->min_occ = diff_occ;
-			cur->max_occ = diff_occ;
-		} else {
-			if (cur->min_lat > diff_lat)
-				cur->min_lat = diff_lat;
-			if (cur->max_lat < diff_lat)
-				cur->max_lat = diff_lat;
-			if (cur->min_occ > diff_occ)
-				cur->min_occ = diff_occ;
-			if (cur->max_occ < diff_occ)
-				cur->max_occ = diff_occ;
-		}
+		cur->lat_hist[kstats_hist_bucket(diff_lat)]++;
 		cur->count++;
 		if (saved_accu) {
 			*acc = *saved_accu;
 			acc->start_occ = now;
+			for (i = 0; i < pmu->nr; i++)
+				acc->start_pmu[i] = now_pmu[i];
 		}
 	}
 }
 
-static void kstats_printone(kstats_distr *d, const char *name, long total_cycles)
+/*
+ * copy the counters to the spare buffer, then flip
+ */
+static void kstats_publish(struct timer *t, struct eth_fg *none)
 {
-	if (d->count) {
-		log_info("kstat: %2d %-30s %9lu %2d%% latency %7lu | %7lu | %7lu "
-			 "occupancy %6lu | %6lu | %6lu\n",
-			 percpu_get(cpu_id),
-			 name,
-			 d->count,
-			 100 * d->tot_occ / total_cycles,
-			 d->min_lat,
-			 d->tot_lat / d->count,
-			 d->max_lat,
-			 d->min_occ,
-			 d->tot_occ / d->count,
-			 d->max_occ);
-	}
+	struct ix_kstats_percpu *pc = &ix_kstats->percpu[percpu_get(cpu_nr)];
+	struct kstats_snapshot *snap = &pc->snap[(pc->gen + 1) & 1];
+
+	KSTATS_VECTOR(publish_kstats);
+
+	snap->tsc = rdtsc();
+	snap->packets = percpu_get(_kstats_packets);
+	snap->hw_instructions = read_perf_event(percpu_get(hw_instructions_fd));
+	snap->llc_load_misses = read_perf_event(percpu_get(llc_load_misses_fd));
+	memcpy(snap->batch_histogram, percpu_get(_kstats_batch_histogram),
+	       sizeof(snap->batch_histogram));
+	memcpy(snap->backlog_histogram, percpu_get(_kstats_backlog_histogram),
+	       sizeof(snap->backlog_histogram));
+	snap->ks = percpu_get(_kstats);
+
+	asm volatile("" ::: "memory");
+	pc->gen++;
+
+	timer_add(&percpu_get(_kstats_timer), NULL, KSTATS_INTERVAL);
 }
 
-static void histogram_to_str(int *histogram, int size, char *buffer, int *avg)
+int kstats_init(void)
 {
-	int i, avg_, sum;
-	char *target;
-
-	target = buffer;
-	buffer[0] = 0;
-	avg_ = 0;
-	sum = 0;
-	for (i = 0; i < size; i++) {
-		if (histogram[i]) {
-			target += sprintf(target, "%d:%d ", i, histogram[i]);
-			avg_ += histogram[i] * i;
-			sum += histogram[i];
-		}
+	int fd, ret;
+	void *vaddr;
+
+	fd = shm_open("/ix-kstats", O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (fd == -1)
+		return -EIO;
+
+	ret = ftruncate(fd, sizeof(struct ix_kstats));
+	if (ret) {
+		close(fd);
+		return -EIO;
 	}
-	if (sum)
-		*avg = avg_ / sum;
-	else
-		*avg = -1;
+
+	vaddr = mmap(NULL, sizeof(struct ix_kstats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (vaddr == MAP_FAILED)
+		return -ENOMEM;
+
+	ix_kstats = vaddr;
+
+	bzero(ix_kstats, sizeof(struct ix_kstats));
+	ix_kstats->cpus = CFG.num_cpus;
+	ix_kstats->cycles_per_us = cycles_per_us;
+	ix_kstats->pmu_mask = CFG.kstats_pmu;
+	return 0;
 }
 
-/*
- * print and reinitialize
+/**
+ * kstats_init_pmu - opens the counters selected by CFG.kstats_pmu
+ *
+ * Returns 0 if successful, otherwise -ENODEV if an event can't be read
+ * with rdpmc.
  */
-static void kstats_print(struct timer *t, struct eth_fg *none)
+int kstats_init_pmu(void)
 {
-	uint64_t total_cycles = (uint64_t) cycles_per_us * KSTATS_INTERVAL;
-	char batch_histogram[2048], backlog_histogram[2048];
-	int avg_batch, avg_backlog;
-	uint64_t total_occ = 0;
-
-	histogram_to_str(percpu_get(_kstats_batch_histogram), KSTATS_BATCH_HISTOGRAM_SIZE, batch_histogram, &avg_batch);
-	histogram_to_str(percpu_get(_kstats_backlog_histogram), KSTATS_BACKLOG_HISTOGRAM_SIZE, backlog_histogram, &avg_backlog);
-
-	kstats *ks = &(percpu_get(_kstats));
-	log_info("--- BEGIN KSTATS --- %ld%% idle, %ld%% user, %ld%% sys, non idle cycles=%lld, HW instructions=%lld, LLC load misses=%lld (%d pkts, avg batch=%d [%s], avg backlog=%d [%s])\n",
-		 ks->idle.tot_lat * 100 / total_cycles,
-		 ks->user.tot_lat * 100 / total_cycles,
-		 max(0, (int64_t)(total_cycles - ks->idle.tot_lat - ks->user.tot_lat)) * 100 / total_cycles,
-		 max(0, (int64_t)(total_cycles - ks->idle.tot_lat)),
-		 read_perf_event(percpu_get(hw_instructions_fd)),
-		 read_perf_event(percpu_get(llc_load_misses_fd)),
-		 percpu_get(_kstats_packets),
-		 avg_batch,
-		 batch_histogram,
-		 avg_backlog,
-		 backlog_histogram);
-#undef DEF_KSTATS
-#define DEF_KSTATS(_c)  kstats_printone(&ks->_c, # _c, total_cycles);
-#include <ix/kstatvectors.h>
-
-#undef DEF_KSTATS
-#undef DEF_KSTATS_COUNTER
-#define DEF_KSTATS(_c)  total_occ += ks->_c.tot_occ;
-#define DEF_KSTATS_COUNTER(_c)
-#include <ix/kstatvectors.h>
-
-	log_info("kstat: %2d %-30s %9lu %2d%%\n",
-		 percpu_get(cpu_id),
-		 "-- REST --",
-		 0,
-		 max(0, (int64_t)(total_cycles - total_occ)) * 100 / total_cycles);
-	log_info("\n");
-
-	KSTATS_VECTOR(print_kstats);
-	bzero(ks, sizeof(*ks));
-	bzero(percpu_get(_kstats_batch_histogram), sizeof(*percpu_get(_kstats_batch_histogram))*KSTATS_BATCH_HISTOGRAM_SIZE);
-	bzero(percpu_get(_kstats_backlog_histogram), sizeof(*percpu_get(_kstats_backlog_histogram))*KSTATS_BACKLOG_HISTOGRAM_SIZE);
-	percpu_get(_kstats_packets) = 0;
+	static const char *names[] = KSTATS_PMU_NAMES;
+	static const struct perf_event_attr attrs[] = {
+		[KSTATS_PMU_CYCLES] = {.type = PERF_TYPE_HARDWARE, .config = PERF_COUNT_HW_CPU_CYCLES},
+		[KSTATS_PMU_INSTRUCTIONS] = {.type = PERF_TYPE_HARDWARE, .config = PERF_COUNT_HW_INSTRUCTIONS},
+		[KSTATS_PMU_LLC_MISSES] = {.type = PERF_TYPE_HARDWARE, .config = PERF_COUNT_HW_CACHE_MISSES},
+		[KSTATS_PMU_BRANCH_MISSES] = {.type = PERF_TYPE_HARDWARE, .config = PERF_COUNT_HW_BRANCH_MISSES},
+	};
+	struct kstats_pmu *pmu = &percpu_get(_kstats_pmu);
+	struct perf_event_attr attr;
+	int i;
+
+	for (i = 0; i < KSTATS_PMU_NR_EVENTS; i++) {
+		if (!(CFG.kstats_pmu & (1 << i)))
+			continue;
+
+		attr = attrs[i];
+		if (init_perf_event_rdpmc(&attr, &pmu->counter[pmu->nr],
+					  &pmu->width_mask[pmu->nr]) < 0) {
+			log_err("kstats: unable to read PMU event '%s' with rdpmc\n",
+				names[i]);
+			return -ENODEV;
+		}
+		pmu->event[pmu->nr++] = i;
+	}
 
-	timer_add(&percpu_get(_kstats_timer), NULL, KSTATS_INTERVAL);
+	return 0;
 }
 
 int kstats_init_cpu(void)
@@ -197,11 +222,11 @@ int kstats_init_cpu(void)
 	struct perf_event_attr llc_load_misses_attr = {.type = PERF_TYPE_HW_CACHE, .config = (PERF_COUNT_HW_CACHE_LL) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
 	struct perf_event_attr hw_instructions_attr = {.type = PERF_TYPE_HARDWARE, .config = PERF_COUNT_HW_INSTRUCTIONS};
 
-	timer_init_entry(&percpu_get(_kstats_timer), kstats_print);
+	timer_init_entry(&percpu_get(_kstats_timer), kstats_publish);
 	timer_add(&percpu_get(_kstats_timer), NULL, KSTATS_INTERVAL);
 
 	percpu_get(llc_load_misses_fd) = init_perf_event(&llc_load_misses_attr);
 	percpu_get(hw_instructions_fd) = init_perf_event(&hw_instructions_attr);
-	return 0;
-}
 
+	return kstats_init_pmu();
+}
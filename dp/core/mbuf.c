@@ -32,19 +32,197 @@
 #include <ix/mempool.h>
 #include <ix/mbuf.h>
 #include <ix/cpu.h>
+#include <ix/bitmap.h>
+#include <ix/stats.h>
+#include <ix/errno.h>
+#include <ix/cfg.h>
 
-/* Capacity should be at least RX queues per CPU * ETH_DEV_RX_QUEUE_SZ */
+#include <net/ethernet.h>
+
+/*
+ * Capacity should be at least RX queues per CPU * ETH_DEV_RX_QUEUE_SZ.
+ * Builds that never touch a NIC (e.g. bench/) may provide smaller ones.
+ */
+#ifndef MBUF_CAPACITY
 #define MBUF_CAPACITY	(768*1024)
+#define MBUF_SMALL_CAPACITY	(256*1024)
+#define MBUF_JUMBO_CAPACITY	(32*1024)
+#endif
+
+/* Number of remotely freed mbufs accumulated before handing them back */
+#define MBUF_RETURN_BATCH	32
+
+const size_t mbuf_class_data_len[MBUF_NR_CLASSES] = {
+	[MBUF_CLASS_SMALL]	= MBUF_SMALL_DATA_LEN,
+	[MBUF_CLASS_DEFAULT]	= MBUF_DATA_LEN,
+	[MBUF_CLASS_JUMBO]	= MBUF_JUMBO_DATA_LEN,
+};
+
+static const int mbuf_class_capacity[MBUF_NR_CLASSES] = {
+	[MBUF_CLASS_SMALL]	= MBUF_SMALL_CAPACITY,
+	[MBUF_CLASS_DEFAULT]	= MBUF_CAPACITY,
+	[MBUF_CLASS_JUMBO]	= MBUF_JUMBO_CAPACITY,
+};
+
+static const char *mbuf_class_name[MBUF_NR_CLASSES] = {
+	[MBUF_CLASS_SMALL]	= "mbuf-256",
+	[MBUF_CLASS_DEFAULT]	= "mbuf",
+	[MBUF_CLASS_JUMBO]	= "mbuf-9k",
+};
+
+/* the number of size classes in use */
+int mbuf_nr_classes;
+
+/* the size class used for receive buffers */
+int mbuf_rx_class = MBUF_CLASS_DEFAULT;
+
+static struct mempool_datastore mbuf_datastore[MBUF_NR_CLASSES];
+
+DEFINE_PERCPU(struct mempool, mbuf_mempool[MBUF_NR_CLASSES] __attribute__((aligned(64))));
+
+/*
+ * Each core owns a return queue where other cores hand back mbufs that
+ * belong to its pool. Producers push whole batches with a compare-and-swap
+ * on the head; the owner takes the entire list with an atomic exchange, so
+ * no lock is needed on either side.
+ */
+struct mbuf_return_queue {
+	struct mbuf *head;
+	unsigned int cpu;
+} __aligned(CACHE_LINE_SIZE);
+
+struct mbuf_return_batch {
+	struct mbuf *head;
+	struct mbuf *tail;
+	int count;
+};
+
+static DEFINE_PERCPU(struct mbuf_return_queue, mbuf_return_queue);
+static DEFINE_PERCPU(struct mbuf_return_batch, mbuf_return_batch[NCPU]);
+static DEFINE_PERCPU(unsigned long, mbuf_return_pending[BITMAP_LONG_SIZE(NCPU)]);
+
+/**
+ * mbuf_pool_to_returnq - finds the return queue of the core owning a pool
+ * @pool: the mbuf memory pool
+ *
+ * Both variables are percpu, so they are at the same distance from each
+ * other in every core's percpu region.
+ */
+static inline struct mbuf_return_queue *
+mbuf_pool_to_returnq(struct mempool *pool)
+{
+	int cls = pool->datastore - mbuf_datastore;
+
+	return (struct mbuf_return_queue *)
+	       ((uintptr_t) pool + (uintptr_t) &mbuf_return_queue -
+		(uintptr_t) &mbuf_mempool[cls]);
+}
+
+static void mbuf_return_flush(unsigned int cpu)
+{
+	struct mbuf_return_batch *b = &percpu_get(mbuf_return_batch[cpu]);
+	struct mbuf_return_queue *q = &percpu_get_remote(mbuf_return_queue, cpu);
+	struct mbuf *head;
+
+	do {
+		head = *(struct mbuf * volatile *) &q->head;
+		b->tail->next = head;
+	} while (!__sync_bool_compare_and_swap(&q->head, head, b->head));
+
+	b->head = NULL;
+	b->tail = NULL;
+	b->count = 0;
+	bitmap_clear(percpu_get(mbuf_return_pending), cpu);
+}
+
+/**
+ * mbuf_free_remote - frees an mbuf owned by another core
+ * @m: the mbuf
+ */
+void mbuf_free_remote(struct mbuf *m)
+{
+	unsigned int cpu = mbuf_pool_to_returnq(m->pool)->cpu;
+	struct mbuf_return_batch *b = &percpu_get(mbuf_return_batch[cpu]);
+
+	m->next = b->head;
+	if (!b->head) {
+		b->tail = m;
+		bitmap_set(percpu_get(mbuf_return_pending), cpu);
+	}
+	b->head = m;
+
+	stats_counter_mbuf_remote_free(1);
 
-static struct mempool_datastore mbuf_datastore;
+	if (++b->count >= MBUF_RETURN_BATCH)
+		mbuf_return_flush(cpu);
+}
 
-DEFINE_PERCPU(struct mempool, mbuf_mempool __attribute__((aligned(64))));
+/**
+ * mbuf_do_bookkeeping - exchanges remotely freed mbufs with other cores
+ *
+ * Pushes partial batches of foreign mbufs to their owners and takes back
+ * the mbufs that other cores freed on behalf of this core.
+ */
+void mbuf_do_bookkeeping(void)
+{
+	unsigned long *pending = percpu_get(mbuf_return_pending);
+	struct mbuf_return_queue *q = &percpu_get(mbuf_return_queue);
+	struct mbuf *m, *next;
+	int i, count = 0;
+
+	for (i = 0; i < BITMAP_LONG_SIZE(NCPU); i++) {
+		while (pending[i])
+			mbuf_return_flush(i * BITS_PER_LONG + __builtin_ctzl(pending[i]));
+	}
+
+	if (!*(struct mbuf * volatile *) &q->head)
+		return;
+
+	m = __sync_lock_test_and_set(&q->head, NULL);
+	while (m) {
+		next = m->next;
+		mempool_free(m->pool, m);
+		m = next;
+		count++;
+	}
+
+	stats_counter_mbuf_remote_return(count);
+}
 
 void mbuf_default_done(struct mbuf *m)
 {
 	mbuf_free(m);
 }
 
+/**
+ * mbuf_from_iomap - finds the mbuf containing an IOMAP address
+ * @iomap: a pointer anywhere inside the mbuf, in the IOMAP region
+ *
+ * Returns an mbuf, or NULL if the address is not inside an mbuf datastore.
+ */
+struct mbuf *mbuf_from_iomap(void *iomap)
+{
+	struct mempool_datastore *mds;
+	uintptr_t addr;
+	int cls;
+
+	for (cls = 0; cls < mbuf_nr_classes; cls++) {
+		mds = &mbuf_datastore[cls];
+		addr = (uintptr_t) iomap - mds->iomap_offset;
+		if (addr < (uintptr_t) mds->buf ||
+		    addr >= (uintptr_t) mds->buf + mds->nr_pages * PGSIZE_2MB)
+			continue;
+
+		/* datastores are created with nostraddle, so each page starts
+		 * with a new element */
+		return (struct mbuf *)(PGADDR_2MB(addr) +
+				       (PGOFF_2MB(addr) / mds->elem_len) *
+				       mds->elem_len);
+	}
+
+	return NULL;
+}
+
 /**
  * mbuf_init_cpu - allocates the core-local mbuf region
  *
@@ -53,8 +231,19 @@ void mbuf_default_done(struct mbuf *m)
 
 int mbuf_init_cpu(void)
 {
-	struct mempool *m = &percpu_get(mbuf_mempool);
-	return mempool_create(m, &mbuf_datastore, MEMPOOL_SANITY_PERCPU, percpu_get(cpu_id));
+	int cls, ret;
+
+	percpu_get(mbuf_return_queue).cpu = percpu_get(cpu_id);
+
+	for (cls = 0; cls < mbuf_nr_classes; cls++) {
+		ret = mempool_create(&percpu_get(mbuf_mempool[cls]),
+				     &mbuf_datastore[cls], MEMPOOL_SANITY_PERCPU,
+				     percpu_get(cpu_id));
+		if (ret)
+			return ret;
+	}
+
+	return 0;
 }
 
 /**
@@ -63,21 +252,38 @@ int mbuf_init_cpu(void)
 
 int mbuf_init(void)
 {
-	int ret;
-	struct mempool_datastore *m = &mbuf_datastore;
+	int cls, ret;
+	struct mempool_datastore *m;
 	BUILD_ASSERT(sizeof(struct mbuf) <= MBUF_HEADER_LEN);
 
-	ret = mempool_create_datastore(m, MBUF_CAPACITY, MBUF_LEN, 1, MEMPOOL_DEFAULT_CHUNKSIZE, "mbuf");
-	if (ret) {
-		assert(0);
-		return ret;
+	mbuf_nr_classes = CFG.mtu > ETH_MTU ? MBUF_NR_CLASSES : MBUF_CLASS_JUMBO;
+	mbuf_rx_class = mbuf_class_fit(CFG.mtu + ETH_HDR_LEN + ETH_CRC_LEN);
+	if (mbuf_rx_class < 0) {
+		log_err("mbuf: no mbuf size class fits an MTU of %d\n", CFG.mtu);
+		return -EINVAL;
 	}
-	ret = mempool_pagemem_map_to_user(m);
-	if (ret) {
-		assert(0);
-		mempool_pagemem_destroy(m);
-		return ret;
+	/* NIC receive buffers are sized in 1 KB units */
+	if (mbuf_rx_class < MBUF_CLASS_DEFAULT)
+		mbuf_rx_class = MBUF_CLASS_DEFAULT;
+
+	for (cls = 0; cls < mbuf_nr_classes; cls++) {
+		m = &mbuf_datastore[cls];
+		ret = mempool_create_datastore(m, mbuf_class_capacity[cls],
+					       MBUF_HEADER_LEN + mbuf_class_data_len[cls],
+					       1, MEMPOOL_DEFAULT_CHUNKSIZE,
+					       mbuf_class_name[cls]);
+		if (ret) {
+			assert(0);
+			return ret;
+		}
+		ret = mempool_pagemem_map_to_user(m);
+		if (ret) {
+			assert(0);
+			mempool_pagemem_destroy(m);
+			return ret;
+		}
 	}
+
 	return 0;
 }
 
@@ -86,6 +292,8 @@ int mbuf_init(void)
  */
 void mbuf_exit_cpu(void)
 {
-	mempool_pagemem_destroy(&mbuf_datastore);
-}
+	int cls;
 
+	for (cls = 0; cls < mbuf_nr_classes; cls++)
+		mempool_pagemem_destroy(&mbuf_datastore[cls]);
+}
@@ -396,11 +396,11 @@ void mempool_pagemem_destroy(struct mempool_datastore *m)
 static void mempool_printstats(struct timer *t, struct eth_fg *cur_fg)
 {
 	struct mempool_datastore *mds = mempool_all_datastores;
-	printf("DATASTORE name             free%% lock/s\n");
+	printf("DATASTORE name             elem  free%% lock/s\n");
 
 	for (; mds; mds = mds->next_ds)  {
-		printf("DATASTORE %-15s  %4ld  %5ld\n",
-		       mds->prettyname,
+		printf("DATASTORE %-15s  %5ld  %4ld  %5ld\n",
+		       mds->prettyname, mds->elem_len,
 		       100L * mds->free_chunks / mds->num_chunks,
 		       mds->num_locks / 5);
 		mds->num_locks = 0;
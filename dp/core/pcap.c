@@ -0,0 +1,407 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * pcap.c - sampled packet capture and pcap file replay
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ix/stddef.h>
+#include <ix/errno.h>
+#include <ix/log.h>
+#include <ix/byteorder.h>
+#include <ix/hash.h>
+#include <ix/cfg.h>
+#include <ix/control_plane.h>
+#include <ix/ethdev.h>
+#include <ix/ethqueue.h>
+#include <ix/mbuf.h>
+#include <ix/pcap.h>
+#include <ix/timer.h>
+#include <ix/trace.h>
+
+#include <net/ethernet.h>
+#include <net/ip.h>
+
+#if CONFIG_PCAP
+
+#define PCAP_REPLAY_BATCH	64
+
+DEFINE_PERCPU(uint32_t, pcap_sample);
+static DEFINE_PERCPU(uint32_t, pcap_skip);
+static DEFINE_PERCPU(struct pcap_filter, pcap_filter);
+
+static struct ix_pcap *ix_pcap;
+
+struct pcap_replay_pkt {
+	uint64_t ts_ns;		/* relative to the first frame */
+	uint32_t len;
+	uint32_t off;		/* of the frame in the file */
+};
+
+static struct pcap_replay {
+	uint8_t *file;
+	struct pcap_replay_pkt *pkts;
+	int nr;
+} replay;
+
+struct pcap_replay_cpu {
+	int next;		/* the next frame to consider */
+	int skipped;		/* frames too large for the rx mbufs */
+	uint64_t start_tsc;
+	uint8_t rss_key[40];
+};
+
+static DEFINE_PERCPU(struct pcap_replay_cpu, replay_cpu);
+
+/**
+ * pcap_ipv4_ports - finds the IPv4 header and L4 ports of a frame
+ * @data: the frame
+ * @len: the bytes available
+ * @ports: set to the source and destination ports, or NULL if not TCP/UDP
+ *
+ * Returns the IP header, or NULL if the frame is not IPv4.
+ */
+static struct ip_hdr *pcap_ipv4_ports(uint8_t *data, size_t len,
+				      uint16_t **ports)
+{
+	struct eth_hdr *ethhdr = (struct eth_hdr *) data;
+	struct ip_hdr *iphdr = (struct ip_hdr *) (ethhdr + 1);
+
+	*ports = NULL;
+	if (len < sizeof(struct eth_hdr) + sizeof(struct ip_hdr) ||
+	    ethhdr->type != hton16(ETHTYPE_IP))
+		return NULL;
+
+	if ((iphdr->proto == IPPROTO_TCP || iphdr->proto == IPPROTO_UDP) &&
+	    !(ntoh16(iphdr->off) & (IP_MF | IP_OFFMASK)) &&
+	    len >= sizeof(struct eth_hdr) + iphdr->header_len * 4 + 4)
+		*ports = (uint16_t *) ((uint8_t *) iphdr + iphdr->header_len * 4);
+
+	return iphdr;
+}
+
+static bool pcap_match(struct pcap_filter *f, struct mbuf *pkt)
+{
+	struct ip_hdr *iphdr;
+	uint16_t *ports;
+
+	iphdr = pcap_ipv4_ports(mbuf_mtod(pkt, uint8_t *), pkt->len, &ports);
+	if (!iphdr)
+		return false;
+
+	if (f->ip && iphdr->src_addr.addr != hton32(f->ip) &&
+	    iphdr->dst_addr.addr != hton32(f->ip))
+		return false;
+
+	if (f->port && (!ports || (ports[0] != hton16(f->port) &&
+				   ports[1] != hton16(f->port))))
+		return false;
+
+	return true;
+}
+
+/**
+ * pcap_refresh - picks up the capture filter set by the control plane
+ *
+ * Called once per bpoll iteration.
+ */
+void pcap_refresh(void)
+{
+	struct pcap_filter *f = &percpu_get(pcap_filter);
+
+	*f = *(struct pcap_filter *) &cp_shmem->pcap;
+	percpu_get(pcap_sample) = f->dirs ? f->sample : 0;
+}
+
+/**
+ * __pcap_capture - applies the filter and records a frame
+ * @dir: PCAP_DIR_RX or PCAP_DIR_TX
+ * @pkt: the frame
+ */
+void __pcap_capture(int dir, struct mbuf *pkt)
+{
+	struct pcap_filter *f = &percpu_get(pcap_filter);
+	struct ix_pcap_ring *ring;
+	struct pcap_rec *rec;
+	size_t len, caplen, n;
+	int i;
+
+	if (!(f->dirs & dir))
+		return;
+	if ((f->ip || f->port) && !pcap_match(f, pkt))
+		return;
+	if (percpu_get(pcap_skip)) {
+		percpu_get(pcap_skip)--;
+		return;
+	}
+	percpu_get(pcap_skip) = f->sample - 1;
+
+	ring = &ix_pcap->ring[percpu_get(cpu_nr)];
+	rec = &ring->rec[ring->head & (PCAP_RING_SIZE - 1)];
+
+	caplen = min(pkt->len, PCAP_SNAPLEN);
+	memcpy(rec->data, mbuf_mtod(pkt, void *), caplen);
+	len = pkt->len;
+
+	/* only transmitted mbufs carry scatter-gather payload */
+	if (dir == PCAP_DIR_TX) {
+		for (i = 0; i < pkt->nr_iov; i++) {
+			n = min(pkt->iovs[i].len, PCAP_SNAPLEN - caplen);
+			memcpy(rec->data + caplen, pkt->iovs[i].base, n);
+			caplen += n;
+			len += pkt->iovs[i].len;
+		}
+	}
+
+	rec->tsc = rdtsc();
+	rec->len = len;
+	rec->caplen = caplen;
+	rec->dir = dir;
+	asm volatile("" ::: "memory");
+	ring->head++;
+}
+
+static struct eth_fg *pcap_replay_fg(struct ix_rte_eth_dev *dev,
+				     struct pcap_replay_cpu *rc,
+				     uint8_t *data, size_t len)
+{
+	struct ip_hdr *iphdr;
+	uint16_t *ports;
+	uint32_t hash;
+
+	iphdr = pcap_ipv4_ports(data, len, &ports);
+	if (!iphdr || !ports)
+		return NULL;
+
+	hash = hash_toeplitz(rc->rss_key, iphdr->src_addr.addr,
+			     iphdr->dst_addr.addr, ports[0], ports[1]);
+	return &dev->data->rx_fgs[hash & (dev->data->nb_rx_fgs - 1)];
+}
+
+/**
+ * pcap_replay_poll - injects the replayed frames that are due
+ *
+ * Every core walks the whole file but only injects the frames of the
+ * flow groups it owns, through its first RX queue, so they take the
+ * same path as received frames. Frames without a flow group (not
+ * TCP or UDP) are injected by the core owning the first flow group and
+ * tagged with MBUF_INVALID_FG_ID, as the drivers do.
+ *
+ * Returns the number of frames injected.
+ */
+int pcap_replay_poll(void)
+{
+	struct pcap_replay_cpu *rc = &percpu_get(replay_cpu);
+	struct ix_rte_eth_rss_conf rss_conf;
+	struct pcap_replay_pkt *p;
+	struct eth_rx_queue *rxq;
+	struct eth_fg *fg, *owner;
+	struct mbuf *b;
+	uint64_t now, elapsed_ns;
+	int count = 0;
+
+	if (likely(rc->next >= replay.nr) || !percpu_get(eth_num_queues))
+		return 0;
+
+	rxq = percpu_get(eth_rxqs[0]);
+	now = rdtsc();
+	if (!rc->start_tsc) {
+		rc->start_tsc = now;
+		if (!rxq->dev->dev_ops->rss_hash_conf_get(rxq->dev, &rss_conf) &&
+		    rss_conf.rss_key)
+			memcpy(rc->rss_key, rss_conf.rss_key, sizeof(rc->rss_key));
+	}
+	elapsed_ns = (now - rc->start_tsc) * 1000 / cycles_per_us;
+
+	while (rc->next < replay.nr && count < PCAP_REPLAY_BATCH) {
+		p = &replay.pkts[rc->next];
+		if (CFG.pcap_replay_speed > 0 &&
+		    p->ts_ns > elapsed_ns * CFG.pcap_replay_speed)
+			break;
+
+		fg = pcap_replay_fg(rxq->dev, rc, replay.file + p->off, p->len);
+		owner = fg ? fg : &rxq->dev->data->rx_fgs[0];
+		if (owner->cur_cpu != percpu_get(cpu_id)) {
+			rc->next++;
+			continue;
+		}
+		if (unlikely(p->len > mbuf_class_data_len[rxq->mbuf_class])) {
+			rc->next++;
+			rc->skipped++;
+			continue;
+		}
+
+		b = mbuf_alloc_local_class(rxq->mbuf_class);
+		if (unlikely(!b)) {
+			trace_event(TRACE_DROP, TRACE_DROP_NOBUFS);
+			break;
+		}
+		rc->next++;
+
+		memcpy(mbuf_mtod(b, void *), replay.file + p->off, p->len);
+		b->len = p->len;
+		b->fg_id = fg ? fg->fg_id : MBUF_INVALID_FG_ID;
+		b->timestamp = now;
+		if (unlikely(eth_recv(rxq, b)))
+			mbuf_free(b);
+		count++;
+	}
+
+	if (rc->next >= replay.nr)
+		log_info("pcap: replay finished on cpu %d (%d oversized skipped)\n",
+			 percpu_get(cpu_id), rc->skipped);
+
+	return count;
+}
+
+static int pcap_replay_load(const char *path)
+{
+	struct pcap_file_hdr *fh;
+	struct pcap_pkt_hdr *ph;
+	uint64_t first_ns = 0, ts_ns;
+	size_t size, off;
+	int nr = 0, skipped = 0, ret;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		log_err("pcap: unable to open %s\n", path);
+		return -ENOENT;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	rewind(f);
+
+	replay.file = malloc(size);
+	if (!replay.file || fread(replay.file, 1, size, f) != size) {
+		fclose(f);
+		ret = -ENOMEM;
+		goto fail;
+	}
+	fclose(f);
+
+	fh = (struct pcap_file_hdr *) replay.file;
+	if (size < sizeof(*fh) ||
+	    (fh->magic != PCAP_MAGIC_US && fh->magic != PCAP_MAGIC_NS) ||
+	    fh->linktype != PCAP_LINKTYPE_ETHERNET) {
+		log_err("pcap: %s is not a native-endian Ethernet pcap file\n", path);
+		ret = -EINVAL;
+		goto fail;
+	}
+
+	/* at most one frame per 16-byte record header */
+	replay.pkts = malloc(sizeof(*replay.pkts) * (size / sizeof(*ph)));
+	if (!replay.pkts) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	for (off = sizeof(*fh); off + sizeof(*ph) <= size;
+	     off += sizeof(*ph) + ph->caplen) {
+		ph = (struct pcap_pkt_hdr *) (replay.file + off);
+		if (off + sizeof(*ph) + ph->caplen > size)
+			break;
+
+		ts_ns = ph->ts_sec * 1000000000ul + ph->ts_frac *
+			(fh->magic == PCAP_MAGIC_US ? 1000 : 1);
+		if (!nr && !skipped)
+			first_ns = ts_ns;
+
+		/*
+		 * truncated frames can't be processed by the stack; frames
+		 * larger than the rx mbuf class are skipped when replayed
+		 */
+		if (ph->caplen != ph->len || ph->caplen > MBUF_JUMBO_DATA_LEN) {
+			skipped++;
+			continue;
+		}
+
+		replay.pkts[nr].ts_ns = ts_ns > first_ns ? ts_ns - first_ns : 0;
+		replay.pkts[nr].len = ph->caplen;
+		replay.pkts[nr].off = off + sizeof(*ph);
+		nr++;
+	}
+
+	replay.nr = nr;
+	log_info("pcap: replaying %d frames from %s (%d truncated skipped)\n",
+		 nr, path, skipped);
+	return 0;
+
+fail:
+	free(replay.file);
+	replay.file = NULL;
+	return ret;
+}
+
+int pcap_init(void)
+{
+	struct timespec ts;
+	int fd, ret;
+	void *vaddr;
+	size_t len;
+
+	len = sizeof(struct ix_pcap) +
+	      CFG.num_cpus * sizeof(struct ix_pcap_ring);
+
+	fd = shm_open("/ix-pcap", O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (fd == -1)
+		return -EIO;
+
+	ret = ftruncate(fd, len);
+	if (ret) {
+		close(fd);
+		return -EIO;
+	}
+
+	vaddr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (vaddr == MAP_FAILED)
+		return -ENOMEM;
+
+	ix_pcap = vaddr;
+
+	bzero(ix_pcap, len);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ix_pcap->base_tsc = rdtsc();
+	ix_pcap->base_ns = ts.tv_sec * 1000000000ul + ts.tv_nsec;
+	ix_pcap->cpus = CFG.num_cpus;
+	ix_pcap->cycles_per_us = cycles_per_us;
+	ix_pcap->ring_size = PCAP_RING_SIZE;
+	ix_pcap->snaplen = PCAP_SNAPLEN;
+
+	if (CFG.pcap_replay[0])
+		return pcap_replay_load(CFG.pcap_replay);
+
+	return 0;
+}
+
+#endif /* CONFIG_PCAP */
@@ -1,5 +1,6 @@
 #include <linux/perf_event.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <sys/syscall.h>
 
@@ -32,3 +33,42 @@ int init_perf_event(struct perf_event_attr *attr)
 	ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
 	return fd;
 }
+
+/**
+ * init_perf_event_rdpmc - opens a counter that can be read with rdpmc
+ * @attr: the event to count
+ * @counter: the rdpmc index of the counter
+ * @width_mask: mask of the implemented counter bits
+ *
+ * The counter is pinned so that its index does not change while the
+ * event is scheduled. Returns the file descriptor, or -1 on failure.
+ */
+int init_perf_event_rdpmc(struct perf_event_attr *attr, unsigned int *counter,
+			  uint64_t *width_mask)
+{
+	struct perf_event_mmap_page *pc;
+	int fd;
+
+	attr->pinned = 1;
+	fd = init_perf_event(attr);
+	if (fd < 0)
+		return -1;
+
+	pc = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+	if (pc == MAP_FAILED)
+		goto err;
+
+	if (!pc->cap_user_rdpmc || !pc->index) {
+		munmap(pc, sysconf(_SC_PAGESIZE));
+		goto err;
+	}
+
+	*counter = pc->index - 1;
+	*width_mask = pc->pmc_width < 64 ? (1UL << pc->pmc_width) - 1 : ~0UL;
+	munmap(pc, sysconf(_SC_PAGESIZE));
+	return fd;
+
+err:
+	close(fd);
+	return -1;
+}
@@ -44,20 +44,53 @@
 #include <ix/ethfg.h>
 #include <ix/utimer.h>
 #include <ix/stats.h>
+#include <ix/trace.h>
+#include <ix/pcap.h>
 
 #include <dune.h>
 
 #define UARR_MIN_CAPACITY	8192
+#define BRING_MIN_CAPACITY	8192
+#define USG_CAPACITY		8192
 
 DEFINE_PERCPU(struct bsys_arr *, usys_arr);
 DEFINE_PERCPU(void *, usys_iomap);
+DEFINE_PERCPU(unsigned long, usys_sg_len);
+DEFINE_PERCPU(unsigned long, usys_sealed);
+DEFINE_PERCPU(struct bsys_ring *, bsys_ring);
+DEFINE_PERCPU(void *, bsys_ring_iomap);
 DEFINE_PERCPU(unsigned long, syscall_cookie);
 DEFINE_PERCPU(unsigned long, idle_cycles);
 
 static const int usys_nr = div_up(sizeof(struct bsys_arr) +
-				  UARR_MIN_CAPACITY * sizeof(struct bsys_desc),
+				  UARR_MIN_CAPACITY * sizeof(struct bsys_desc) +
+				  USG_CAPACITY * sizeof(struct sg_entry),
 				  PGSIZE_2MB);
 
+/* the scatter-gather lists of merged events fill the end of the array */
+#define USG_OFFSET \
+	(usys_nr * PGSIZE_2MB - USG_CAPACITY * sizeof(struct sg_entry))
+
+static const int bring_nr = div_up(sizeof(struct bsys_ring) +
+				   BRING_MIN_CAPACITY * sizeof(struct bsys_desc),
+				   PGSIZE_2MB);
+
+#define BRING_CAPACITY \
+	((bring_nr * PGSIZE_2MB - sizeof(struct bsys_ring)) / \
+	 sizeof(struct bsys_desc))
+
+/**
+ * bsys_lat_record - records the latency of an application request
+ * @ns: the latency in nanoseconds
+ *
+ * Returns 0.
+ */
+long bsys_lat_record(uint64_t ns)
+{
+	latsketch_add(&cp_shmem->latency[percpu_get(cpu_nr)].app, ns);
+	return 0;
+}
+
 static bsysfn_t bsys_tbl[] = {
 	(bsysfn_t) bsys_udp_send,
 	(bsysfn_t) bsys_udp_sendv,
@@ -69,8 +102,60 @@ static bsysfn_t bsys_tbl[] = {
 	(bsysfn_t) bsys_tcp_sendv,
 	(bsysfn_t) bsys_tcp_recv_done,
 	(bsysfn_t) bsys_tcp_close,
+	(bsysfn_t) bsys_lat_record,
+	(bsysfn_t) bsys_tcp_acceptv,
+	(bsysfn_t) bsys_tcp_admit,
 };
 
+static inline uint64_t bsys_call(uint64_t sysnr, uint64_t arga,
+				 uint64_t argb, uint64_t argc, uint64_t argd)
+{
+	if (unlikely(sysnr >= KSYS_NR))
+		return (uint64_t) - ENOSYS;
+
+	return bsys_tbl[sysnr](arga, argb, argc, argd);
+}
+
+/**
+ * usys_tcp_recv_merge - appends received data to the last receive event
+ * @d: the last event, a USYS_TCP_RECV or USYS_TCP_RECVV for the same flow
+ * @addr: the address of the received data
+ * @len: the length of the received data
+ *
+ * The scatter-gather list of the last event is always the most recently
+ * allocated one, so it can grow in place.
+ *
+ * Returns true if the data was merged, or false if there is no room left.
+ */
+bool usys_tcp_recv_merge(struct bsys_desc *d, void *addr, size_t len)
+{
+	struct sg_entry *ents = (struct sg_entry *)
+		((uintptr_t) percpu_get(usys_arr) + USG_OFFSET);
+	unsigned long n = percpu_get(usys_sg_len);
+
+	if (d->sysnr == USYS_TCP_RECV) {
+		if (unlikely(n + 2 > USG_CAPACITY))
+			return false;
+
+		ents[n].base = (void *) d->argc;
+		ents[n].len = d->argd;
+		d->sysnr = USYS_TCP_RECVV;
+		d->argc = (uint64_t) percpu_get(usys_iomap) + USG_OFFSET +
+			  n * sizeof(struct sg_entry);
+		d->argd = 1;
+		n++;
+	} else if (unlikely(n + 1 > USG_CAPACITY)) {
+		return false;
+	}
+
+	ents[n].base = addr;
+	ents[n].len = len;
+	d->argd++;
+	percpu_get(usys_sg_len) = n + 1;
+
+	return true;
+}
+
 static int bsys_dispatch_one(struct bsys_desc __user *d)
 {
 	uint64_t sysnr, arga, argb, argc, argd, ret;
@@ -83,14 +168,9 @@ static int bsys_dispatch_one(struct bsys_desc __user *d)
 
 	if (unlikely(uaccess_check_fault()))
 		return -EFAULT;
-	if (unlikely(sysnr >= KSYS_NR)) {
-		ret = (uint64_t) - ENOSYS;
-		goto out;
-	}
 
-	ret = bsys_tbl[sysnr](arga, argb, argc, argd);
+	ret = bsys_call(sysnr, arga, argb, argc, argd);
 
-out:
 	arga = percpu_get(syscall_cookie);
 	uaccess_pokeq(&d->arga, arga);
 	uaccess_pokeq(&d->argb, ret);
@@ -125,13 +205,45 @@ static int bsys_dispatch(struct bsys_desc __user *d, unsigned int nr)
 }
 
 /**
- * sys_bpoll - performs I/O processing and issues a batch of system calls
- * @d: the batched system call descriptor array
- * @nr: the number of batched system calls
+ * bsys_ring_dispatch - executes the commands queued on the submission ring
  *
- * Returns 0 if successful, otherwise failure.
+ * The ring is kernel memory, so descriptors are read without uaccess
+ * checks. Each index and descriptor is loaded once, since other threads
+ * of the application can still write to the ring.
+ *
+ * Returns the number of commands executed, or -EINVAL if the ring indices
+ * are corrupt.
  */
-static int sys_bpoll(struct bsys_desc __user *d, unsigned int nr)
+static int bsys_ring_dispatch(void)
+{
+	struct bsys_ring *r = percpu_get(bsys_ring);
+	unsigned long i, head, tail;
+#ifdef ENABLE_KSTATS
+	kstats_accumulate save;
+#endif
+
+	head = *(volatile unsigned long *) &r->head;
+	tail = *(volatile unsigned long *) &r->sq.len;
+	if (head == tail)
+		return 0;
+	if (unlikely(head > tail || tail > BRING_CAPACITY))
+		return -EINVAL;
+
+	for (i = head; i < tail; i++) {
+		struct bsys_desc d = ((volatile struct bsys_desc *) r->sq.descs)[i];
+		struct bsys_ret *ret = (struct bsys_ret *) &r->sq.descs[i];
+
+		KSTATS_PUSH(bsys_dispatch_one, &save);
+		ret->ret = bsys_call(d.sysnr, d.arga, d.argb, d.argc, d.argd);
+		ret->cookie = percpu_get(syscall_cookie);
+		KSTATS_POP(&save);
+	}
+
+	r->head = tail;
+	return tail - head;
+}
+
+static int __sys_bpoll(struct bsys_desc __user *d, unsigned int nr)
 {
 	int ret, empty;
 
@@ -143,6 +255,13 @@ static int sys_bpoll(struct bsys_desc __user *d, unsigned int nr)
 
 	KSTATS_PUSH(bsys, NULL);
 	ret = bsys_dispatch(d, nr);
+	if (!ret) {
+		ret = bsys_ring_dispatch();
+		if (ret > 0) {
+			nr += ret;
+			ret = 0;
+		}
+	}
 	KSTATS_POP(NULL);
 
 	if (ret)
@@ -186,6 +305,7 @@ again:
 
 	KSTATS_PUSH(rx_poll, NULL);
 	eth_process_poll();
+	pcap_replay_poll();
 	KSTATS_POP(NULL);
 
 	KSTATS_PUSH(rx_recv, NULL);
@@ -205,7 +325,9 @@ again:
 				KSTATS_PUSH(idle, NULL);
 
 				start = rdtsc();
+				trace_event(TRACE_IDLE_ENTER, 0);
 				eth_rx_idle_wait(deadline);
+				trace_event(TRACE_IDLE_EXIT, 0);
 				percpu_get(idle_cycles) += rdtsc() - start;
 				KSTATS_POP(NULL);
 			}
@@ -221,6 +343,26 @@ again:
 	return 0;
 }
 
+/**
+ * sys_bpoll - performs I/O processing and issues a batch of system calls
+ * @d: the batched system call descriptor array
+ * @nr: the number of batched system calls
+ *
+ * Returns 0 if successful, otherwise failure.
+ */
+static int sys_bpoll(struct bsys_desc __user *d, unsigned int nr)
+{
+	int ret;
+
+	trace_refresh();
+	pcap_refresh();
+	trace_event(TRACE_BPOLL_ENTER, nr);
+	ret = __sys_bpoll(d, nr);
+	trace_event(TRACE_BPOLL_EXIT, percpu_get(usys_arr)->len);
+
+	return ret;
+}
+
 /**
  * sys_bcall - issues a batch of system calls
  * @d: the batched system call descriptor array
@@ -232,12 +374,20 @@ static int sys_bcall(struct bsys_desc __user *d, unsigned int nr)
 {
 	int ret;
 
+	/* the application may be partway through the current events */
+	usys_seal();
+
 	KSTATS_PUSH(tx_reclaim, NULL);
 	eth_process_reclaim();
 	KSTATS_POP(NULL);
 
 	KSTATS_PUSH(bsys, NULL);
 	ret = bsys_dispatch(d, nr);
+	if (!ret) {
+		ret = bsys_ring_dispatch();
+		if (ret > 0)
+			ret = 0;
+	}
 	KSTATS_POP(NULL);
 
 	KSTATS_PUSH(tx_send, NULL);
@@ -257,6 +407,16 @@ static void *sys_baddr(void)
 	return percpu_get(usys_iomap);
 }
 
+/**
+ * sys_bring - get the address of the submission ring
+ *
+ * Returns an IOMAP pointer.
+ */
+static void *sys_bring(void)
+{
+	return percpu_get(bsys_ring_iomap);
+}
+
 /**
  * sys_mmap - maps pages of memory into userspace
  * @addr: the start address of the mapping
@@ -386,6 +546,7 @@ static sysfn_t sys_tbl[] = {
 	(sysfn_t) sys_nrcpus,
 	(sysfn_t) sys_timer_init,
 	(sysfn_t) sys_timer_ctl,
+	(sysfn_t) sys_bring,
 };
 
 /**
@@ -407,35 +568,65 @@ void do_syscall(struct dune_tf *tf, uint64_t sysnr)
 }
 
 /**
- * syscall_init_cpu - creates a user-mapped page for batched system calls
+ * syscall_init_cpu - creates user-mapped pages for batched system calls
+ *
+ * The event array is read-only to the application, while the submission
+ * ring is writable.
  *
  * Returns 0 if successful, otherwise fail.
  */
 int syscall_init_cpu(void)
 {
 	struct bsys_arr *arr;
-	void *iomap;
+	struct bsys_ring *ring;
+	void *iomap, *ring_iomap;
 
 	arr = (struct bsys_arr *) page_alloc_contig(usys_nr);
 	if (!arr)
 		return -ENOMEM;
 
 	iomap = vm_map_to_user((void *) arr, usys_nr, PGSIZE_2MB, VM_PERM_R);
-	if (!iomap) {
-		page_free_contig((void *) arr, usys_nr);
-		return -ENOMEM;
-	}
+	if (!iomap)
+		goto fail_arr;
+
+	ring = (struct bsys_ring *) page_alloc_contig(bring_nr);
+	if (!ring)
+		goto fail_iomap;
+
+	ring->head = 0;
+	ring->sq.len = 0;
+	ring->sq.max_len = BRING_CAPACITY;
+
+	ring_iomap = vm_map_to_user((void *) ring, bring_nr, PGSIZE_2MB,
+				    VM_PERM_R | VM_PERM_W);
+	if (!ring_iomap)
+		goto fail_ring;
 
 	percpu_get(usys_arr) = arr;
 	percpu_get(usys_iomap) = iomap;
+	percpu_get(bsys_ring) = ring;
+	percpu_get(bsys_ring_iomap) = ring_iomap;
 	return 0;
+
+fail_ring:
+	page_free_contig((void *) ring, bring_nr);
+fail_iomap:
+	vm_unmap(iomap, usys_nr, PGSIZE_2MB);
+fail_arr:
+	page_free_contig((void *) arr, usys_nr);
+	return -ENOMEM;
 }
 
 /**
- * syscall_exit_cpu - frees the user-mapped page for batched system calls
+ * syscall_exit_cpu - frees the user-mapped pages for batched system calls
  */
 void syscall_exit_cpu(void)
 {
+	vm_unmap(percpu_get(bsys_ring_iomap), bring_nr, PGSIZE_2MB);
+	page_free_contig((void *) percpu_get(bsys_ring), bring_nr);
+	percpu_get(bsys_ring) = NULL;
+	percpu_get(bsys_ring_iomap) = NULL;
+
 	vm_unmap(percpu_get(usys_iomap), usys_nr, PGSIZE_2MB);
 	page_free_contig((void *) percpu_get(usys_arr), usys_nr);
 	percpu_get(usys_arr) = NULL;
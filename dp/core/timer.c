@@ -30,6 +30,12 @@
  *
  * Specificially, we use Scheme 7 described in the paper, where
  * hierarchical sets of buckets are used.
+ *
+ * Timers that are due within PRECISE_DELAY_US are kept apart on a short
+ * list sorted by expiry, so that pacing and short RPC deadlines fire on
+ * the microsecond instead of being rounded up to the next bucket. Timers
+ * in the high precision wheel are parked on a bucket that never runs
+ * late and move to the sorted list when their bucket comes up.
  */
 
 #define DEBUG_TIMER
@@ -40,6 +46,8 @@
 #include <ix/cpu.h>
 #include <ix/kstats.h>
 #include <ix/ethfg.h>
+#include <ix/trace.h>
+#include <ix/bitmap.h>
 #include <assert.h>
 #include <time.h>
 #include <ix/log.h>
@@ -62,6 +70,8 @@
 #define WHEEL_OFFSET(val, idx) \
 	(((val) >> WHEEL_IDX_TO_SHIFT(idx)) & WHEEL_MASK)
 
+#define PRECISE_DELAY_US	(MIN_DELAY_US * 4)
+
 /*
  * NOTE: these parameters may need to be tweaked.
  *
@@ -72,6 +82,13 @@
  * low precision wheel: 256 x 1 second increments
  *
  * Total range 0 to 256 seconds...
+ *
+ * and a sorted list for the last PRECISE_DELAY_US of every timer.
+ *
+ * Each wheel has an occupancy bitmap so that empty buckets can be skipped
+ * without touching them. A bit is set when a timer is inserted but only
+ * cleared lazily, when the bucket is run or found empty, because
+ * timer_del() does not know which bucket the timer was on.
  */
 
 
@@ -79,6 +96,8 @@
 struct timerwheel {
 	uint64_t now_us;
 	uint64_t timer_pos;
+	struct hlist_head precise;
+	DEFINE_BITMAP(occupied[WHEEL_COUNT], WHEEL_SIZE);
 	struct hlist_head wheels[WHEEL_COUNT][WHEEL_SIZE];
 
 };
@@ -108,11 +127,44 @@ static inline bool timer_expired(struct timerwheel *tw, struct timer *t)
 }
 
 
+/**
+ * timer_insert_precise - adds a timer to the sorted list of imminent timers
+ * @tw: the timer wheel
+ * @t: the timer
+ *
+ * The list only holds timers due within a few buckets, so it stays short
+ * and a linear walk is cheaper than a heap.
+ */
+static void timer_insert_precise(struct timerwheel *tw, struct timer *t)
+{
+	struct hlist_head *h = &tw->precise;
+	struct hlist_node *n;
+
+	hlist_for_each(&tw->precise, n) {
+		if (hlist_entry(n, struct timer, link)->expires > t->expires)
+			break;
+		/* @next lines up with @head, so this inserts after @n */
+		h = (struct hlist_head *) n;
+	}
+
+	hlist_add_head(h, &t->link);
+}
+
 static void timer_insert(struct eth_fg *cur_fg, struct timerwheel *tw, struct timer *t)
 {
 	uint64_t expire_us, delay_us;
 	int index, offset;
 
+	if (cur_fg)
+		t->fg_id = cur_fg->fg_id;
+	else
+		t->fg_id = -1;
+
+	if ((int64_t) (t->expires - tw->now_us) < PRECISE_DELAY_US) {
+		timer_insert_precise(tw, t);
+		return;
+	}
+
 	/*
 	 * Round up to the next bucket because part of the time
 	 * between buckets has likely already passed.
@@ -131,15 +183,51 @@ static void timer_insert(struct eth_fg *cur_fg, struct timerwheel *tw, struct ti
 	 */
 	index = ((63 - clz64(delay_us) - MIN_DELAY_SHIFT)
 		 >> WHEEL_SHIFT_LOG2);
-	offset = WHEEL_OFFSET(expire_us, index);
+
+	/*
+	 * The high precision wheel rounds down instead: the timer is at
+	 * least PRECISE_DELAY_US away, and timer_run_bucket() hands it to
+	 * the sorted list if the bucket comes up before it is due.
+	 */
+	if (index)
+		offset = WHEEL_OFFSET(expire_us, index);
+	else
+		offset = WHEEL_OFFSET(t->expires, 0);
 
 	hlist_add_head(&tw->wheels[index][offset], &t->link);
+	bitmap_set(tw->occupied[index], offset);
+}
 
-	if (cur_fg)
-		t->fg_id = cur_fg->fg_id;
-	else
-		t->fg_id = -1;
+/**
+ * timer_next_bucket - finds the next non-empty bucket of a wheel
+ * @tw: the timer wheel
+ * @wheel: the wheel index
+ * @off: the offset of the first bucket to look at
+ * @n: the number of buckets to look at, wrapping around (at most WHEEL_SIZE)
+ *
+ * Stale occupancy bits found on the way are cleared.
+ *
+ * Returns the distance from @off to the first non-empty bucket, or @n if
+ * there is none.
+ */
+static int timer_next_bucket(struct timerwheel *tw, int wheel, int off, int n)
+{
+	unsigned long *bits = tw->occupied[wheel];
+	int d = 0, pos, next;
+
+	while (d < n) {
+		pos = (off + d) & WHEEL_MASK;
+		next = bitmap_next_set(bits, WHEEL_SIZE, pos);
+		d += next - pos;
+		if (next == WHEEL_SIZE || d >= n)
+			continue;
+		if (!hlist_empty(&tw->wheels[wheel][next]))
+			return d;
+		bitmap_clear(bits, next);
+		d++;
+	}
 
+	return n;
 }
 
 /**
@@ -210,8 +298,9 @@ void timer_add_for_next_tick(struct timer *t, struct eth_fg *cur_fg)
 }
 
 
-static void timer_run_bucket(struct timerwheel *tw, struct hlist_head *h)
+static void timer_run_bucket(struct timerwheel *tw, int off)
 {
+	struct hlist_head *h = &tw->wheels[0][off];
 	struct hlist_node *n, *tmp;
 	struct timer *t;
 #ifdef ENABLE_KSTATS
@@ -221,13 +310,40 @@ static void timer_run_bucket(struct timerwheel *tw, struct hlist_head *h)
 	hlist_for_each_safe(h, n, tmp) {
 		t = hlist_entry(n, struct timer, link);
 		__timer_del(t);
+		if (!timer_expired(tw, t)) {
+			timer_insert_precise(tw, t);
+			continue;
+		}
 		KSTATS_PUSH(timer_handler, &save);
 		if (t->fg_id >= 0)
 			eth_fg_set_current(fgs[t->fg_id]);
+		trace_event(TRACE_TIMER, t->fg_id);
 		t->handler(t, fgs[t->fg_id]);
 		KSTATS_POP(&save);
 	}
 	h->head = NULL;
+	bitmap_clear(tw->occupied[0], off);
+}
+
+static void timer_run_precise(struct timerwheel *tw)
+{
+	struct timer *t;
+#ifdef ENABLE_KSTATS
+	kstats_accumulate save;
+#endif
+
+	while (!hlist_empty(&tw->precise)) {
+		t = hlist_entry(tw->precise.head, struct timer, link);
+		if (!timer_expired(tw, t))
+			break;
+		__timer_del(t);
+		KSTATS_PUSH(timer_handler, &save);
+		if (t->fg_id >= 0)
+			eth_fg_set_current(fgs[t->fg_id]);
+		trace_event(TRACE_TIMER, t->fg_id);
+		t->handler(t, fgs[t->fg_id]);
+		KSTATS_POP(&save);
+	}
 }
 
 static int timer_reinsert_bucket(struct timerwheel *tw, struct hlist_head *h, uint64_t now_us)
@@ -247,6 +363,7 @@ static int timer_reinsert_bucket(struct timerwheel *tw, struct hlist_head *h, ui
 			KSTATS_PUSH(timer_handler, &save);
 			if (t->fg_id >= 0)
 				eth_fg_set_current(fgs[t->fg_id]);
+			trace_event(TRACE_TIMER, t->fg_id);
 			t->handler(t, fgs[t->fg_id]);
 			KSTATS_POP(&save);
 			continue;
@@ -265,15 +382,19 @@ static int timer_collapse(uint64_t pos)
 {
 	struct timerwheel *tw;
 	int wheel;
-	int count;
+	int count = 0;
 	KSTATS_VECTOR(timer_collapse);
 
 
+	tw = &percpu_get(timer_wheel_cpu);
 	for (wheel = 1; wheel < WHEEL_COUNT; wheel++) {
 		int off = WHEEL_OFFSET(pos, wheel);
 
-		tw = &percpu_get(timer_wheel_cpu);
-		count = timer_reinsert_bucket(tw, &tw->wheels[wheel][off], pos);
+		if (bitmap_test(tw->occupied[wheel], off)) {
+			count = timer_reinsert_bucket(tw, &tw->wheels[wheel][off], pos);
+			if (hlist_empty(&tw->wheels[wheel][off]))
+				bitmap_clear(tw->occupied[wheel], off);
+		}
 
 		// only need to go to the next wheel if offset is zero
 		if (off)
@@ -302,9 +423,23 @@ void timer_run(void)
 		if (!high_off)
 			timer_collapse(pos);
 
-		timer_run_bucket(tw, &tw->wheels[0][high_off]);
+		/* skip empty buckets, but stop at the next collapse */
+		high_off += timer_next_bucket(tw, 0, high_off,
+					      WHEEL_SIZE - high_off);
+		if (high_off == WHEEL_SIZE) {
+			pos = (pos | (WHEEL_SIZE * MIN_DELAY_US - 1)) + 1 -
+			      MIN_DELAY_US;
+			continue;
+		}
+		pos = (pos & ~((uint64_t) WHEEL_SIZE * MIN_DELAY_US - 1)) +
+		      high_off * MIN_DELAY_US;
+		if (pos > tw->now_us)
+			break;
+
+		timer_run_bucket(tw, high_off);
 	}
-	tw->timer_pos = pos;
+	tw->timer_pos = min(pos, (tw->now_us & ~MIN_DELAY_MASK) + MIN_DELAY_US);
+	timer_run_precise(tw);
 	unset_current_fg();
 }
 
@@ -318,7 +453,8 @@ void timer_run(void)
  * performance.
  *
  * NOTE: If a timer is about to be cascaded, this function could
- * underestimate the next deadline.
+ * underestimate the next deadline. Timers on the sorted list are
+ * reported exactly, so an idle wait wakes up on time for them.
  *
  * Returns time in microseconds until the next timer expires or
  * @max_deadline_us, whichever is smaller.
@@ -331,7 +467,17 @@ timer_deadline(uint64_t max_deadline_us)
 	struct timerwheel *tw = &percpu_get(timer_wheel_cpu);
 	uint64_t now_us = tw->now_us;
 	uint64_t future_us = now_us + max_deadline_us;
-	int idx;
+	int idx, n, d;
+
+	if (!hlist_empty(&tw->precise)) {
+		struct timer *t = hlist_entry(tw->precise.head, struct timer, link);
+		uint64_t tsc_us = rdtsc() / cycles_per_us;
+
+		if (t->expires <= tsc_us)
+			return 0;
+		max_deadline_us = min(max_deadline_us, t->expires - tsc_us);
+		future_us = now_us + max_deadline_us;
+	}
 
 	for (idx = 0; idx < WHEEL_COUNT; idx++) {
 		uint64_t start = (now_us >> WHEEL_IDX_TO_SHIFT(idx));
@@ -341,15 +487,15 @@ timer_deadline(uint64_t max_deadline_us)
 			break;
 
 		end = min(end, start + WHEEL_SIZE);
-		for (start++; start <= end; start++) {
-			if (!hlist_empty(&tw->wheels[idx][start & WHEEL_MASK])) {
-				uint64_t deadline_us = (start << WHEEL_IDX_TO_SHIFT(idx));
-				uint64_t tsc_us = rdtsc() / cycles_per_us;
-				if (deadline_us <= tsc_us)
-					return 0;
-				else
-					return deadline_us - tsc_us;
-			}
+		n = end - start;
+		d = timer_next_bucket(tw, idx, (start + 1) & WHEEL_MASK, n);
+		if (d < n) {
+			uint64_t deadline_us = (start + 1 + d) << WHEEL_IDX_TO_SHIFT(idx);
+			uint64_t tsc_us = rdtsc() / cycles_per_us;
+			if (deadline_us <= tsc_us)
+				return 0;
+			else
+				return deadline_us - tsc_us;
 		}
 	}
 
@@ -375,6 +521,15 @@ timer_collect_fgs(uint8_t *fg_vector, struct hlist_head *list, uint64_t *timer_p
 
 	*timer_pos = tw->timer_pos;
 
+	hlist_for_each_safe(&tw->precise, x, tmp) {
+		t = hlist_entry(x, struct timer, link);
+		if (t->fg_id >= 0 && fg_vector[t->fg_id]) {
+			hlist_del(&t->link);
+			hlist_add_head(list, &t->link);
+			count++;
+		}
+	}
+
 	for (wheel = 0; wheel < WHEEL_COUNT; wheel++)
 		for (pos = 0; pos < WHEEL_SIZE; pos++)
 			hlist_for_each_safe(&tw->wheels[wheel][pos], x, tmp) {
@@ -464,7 +619,8 @@ int timer_init_cpu(void)
 {
 	struct timerwheel *tw = &percpu_get(timer_wheel_cpu);
 	tw->now_us = rdtsc() / cycles_per_us;
-	tw->timer_pos = tw->now_us;
+	/* aligned, so that a bucket runs as soon as its time has come */
+	tw->timer_pos = tw->now_us & ~MIN_DELAY_MASK;
 	return 0;
 }
 /**
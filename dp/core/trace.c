@@ -0,0 +1,90 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * trace.c - per-core binary flight recorder
+ */
+
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <ix/errno.h>
+#include <ix/trace.h>
+#include <ix/cfg.h>
+#include <ix/control_plane.h>
+#include <ix/timer.h>
+
+#if CONFIG_TRACE
+
+DEFINE_PERCPU(uint32_t, trace_mask);
+DEFINE_PERCPU(struct ix_trace_ring *, trace_ring);
+
+static struct ix_trace *ix_trace;
+
+/**
+ * trace_refresh - picks up the event mask set by the control plane
+ *
+ * Called once per bpoll iteration.
+ */
+void trace_refresh(void)
+{
+	percpu_get(trace_mask) = cp_shmem->trace_mask;
+	percpu_get(trace_ring) = &ix_trace->ring[percpu_get(cpu_nr)];
+}
+
+int trace_init(void)
+{
+	int fd, ret;
+	void *vaddr;
+	size_t len;
+
+	len = sizeof(struct ix_trace) +
+	      CFG.num_cpus * sizeof(struct ix_trace_ring);
+
+	fd = shm_open("/ix-trace", O_RDWR | O_CREAT | O_TRUNC, 0660);
+	if (fd == -1)
+		return -EIO;
+
+	ret = ftruncate(fd, len);
+	if (ret) {
+		close(fd);
+		return -EIO;
+	}
+
+	vaddr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (vaddr == MAP_FAILED)
+		return -ENOMEM;
+
+	ix_trace = vaddr;
+
+	bzero(ix_trace, len);
+	ix_trace->cpus = CFG.num_cpus;
+	ix_trace->cycles_per_us = cycles_per_us;
+	ix_trace->ring_size = TRACE_RING_SIZE;
+	return 0;
+}
+
+#endif /* CONFIG_TRACE */
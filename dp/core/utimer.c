@@ -1,15 +1,23 @@
 #include <ix/syscall.h>
+#include <ix/errno.h>
 #include <ix/timer.h>
 
-/* max number of supported user level timers */
+/*
+ * max number of supported user level timers per CPU; libix multiplexes
+ * all the timers of a thread onto a single one
+ */
 #define UTIMER_COUNT 32
 
+/* longest delay accepted, well within the range of the timer wheel */
+#define UTIMER_MAX_DELAY (60 * ONE_SECOND)
+
 struct utimer {
 	struct timer t;
 	void *cookie;
 };
 
 struct utimer_list {
+	int nr;		/* the number of timers handed out */
 	struct utimer arr[UTIMER_COUNT];
 };
 
@@ -24,12 +32,10 @@ void generic_handler(struct timer *t, struct eth_fg *unused)
 
 static int find_available(struct utimer_list *tl)
 {
-	static int next;
-
-	if (next >= UTIMER_COUNT)
+	if (tl->nr >= UTIMER_COUNT)
 		return -1;
 
-	return next++;
+	return tl->nr++;
 }
 
 int utimer_init(struct utimer_list *tl, void *udata)
@@ -48,9 +54,22 @@ int utimer_init(struct utimer_list *tl, void *udata)
 	return index;
 }
 
+/**
+ * utimer_arm - arms (or re-arms) a user level timer
+ * @tl: the timer list of the CPU
+ * @timer_id: the timer returned by utimer_init()
+ * @delay: the delay in microseconds
+ *
+ * Returns 0 if successful, otherwise -EINVAL.
+ */
 int utimer_arm(struct utimer_list *tl, int timer_id, uint64_t delay)
 {
 	struct timer *t;
+
+	if (timer_id < 0 || timer_id >= tl->nr ||
+	    !delay || delay > UTIMER_MAX_DELAY)
+		return -EINVAL;
+
 	t = &tl->arr[timer_id].t;
-	return timer_add(t, NULL, delay);
+	return timer_mod(t, NULL, delay);
 }
@@ -157,6 +157,7 @@ static void translate_conf(struct rte_eth_conf *out, struct ix_rte_eth_conf *in)
 	COPY_AND_RESET(rxmode.hw_strip_crc);
 	COPY_AND_RESET(rxmode.hw_vlan_filter);
 	COPY_AND_RESET(rxmode.jumbo_frame);
+	COPY_AND_RESET(rxmode.max_rx_pkt_len);
 	COPY_AND_RESET2(rxmode.mq_mode, translate_conf_rxmode_mq_mode);
 	COPY_AND_RESET(rxmode.split_hdr_size);
 	COPY_AND_RESET2(txmode.mq_mode, translate_conf_txmode_mq_mode);
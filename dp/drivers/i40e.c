@@ -90,6 +90,7 @@
 #include <ix/drivers.h>
 #include <ix/ethdev.h>
 #include <ix/log.h>
+#include <ix/trace.h>
 
 #define I40E_RING_BASE_ALIGN 128
 #define I40E_RDT_THRESH 32
@@ -144,7 +145,7 @@ static int i40e_alloc_rx_mbufs(struct rx_queue *rxq)
 
 	for (i = 0; i < rxq->len; i++) {
 		machaddr_t maddr;
-		struct mbuf *b = mbuf_alloc_local();
+		struct mbuf *b = mbuf_alloc_local_class(rxq->erxq.mbuf_class);
 		if (!b)
 			goto fail;
 
@@ -208,7 +209,7 @@ static int dev_start(struct ix_rte_eth_dev *dev)
 		#endif
 		rx_ctx.dtype = 0;
 		rx_ctx.hsplit_0 = I40E_HEADER_SPLIT_NONE;
-		rx_ctx.rxmax = 0x5ee;
+		rx_ctx.rxmax = CFG.mtu > ETH_MTU ? CFG.mtu + ETH_HDR_LEN + ETH_CRC_LEN : 0x5ee;
 		rx_ctx.tphrdesc_ena = 1;
 		rx_ctx.tphwdesc_ena = 1;
 		rx_ctx.tphdata_ena = 1;
@@ -385,9 +386,10 @@ static int i40e_rx_poll(struct eth_rx_queue *rx)
 		}
 		b->timestamp = timestamp;
 
-		new_b = mbuf_alloc_local();
+		new_b = mbuf_alloc_local_class(rx->mbuf_class);
 		if (unlikely(!new_b)) {
 			log_err("i40e: unable to allocate RX mbuf\n");
+			trace_event(TRACE_DROP, TRACE_DROP_NOBUFS);
 			goto out;
 		}
 
@@ -508,6 +510,7 @@ static int rx_queue_setup(struct ix_rte_eth_dev *dev, int queue_idx, int numa_no
 	//rxq->reg_idx = drxq->reg_idx;
 	//rxq->rdt_reg_addr = (uint32_t*) drxq->qrx_tail;
 
+	rxq->erxq.mbuf_class = mbuf_rx_class;
 	rxq->erxq.poll = i40e_rx_poll;
 	rxq->erxq.ready = i40e_rx_ready;
 	dev->data->rx_queues[queue_idx] = &rxq->erxq;
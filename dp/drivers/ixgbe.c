@@ -82,6 +82,7 @@
 #include <ix/dpdk.h>
 #include <ix/drivers.h>
 #include <ix/cfg.h>
+#include <ix/trace.h>
 
 #define IXGBE_ALIGN		128
 #define IXGBE_MIN_RING_DESC	64
@@ -147,6 +148,7 @@ static int dev_start(struct ix_rte_eth_dev *dev)
 {
 	int i;
 	int ret;
+	uint32_t srrctl;
 	struct ixgbe_hw *hw;
 
 	hw = IXGBE_DEV_PRIVATE_TO_HW(rte_eth_devices[dev->port].data->dev_private);
@@ -167,6 +169,12 @@ static int dev_start(struct ix_rte_eth_dev *dev)
 		IXGBE_WRITE_REG(hw, IXGBE_RDBAL(rxq->reg_idx), (uint32_t)(rxq->ring_physaddr & 0x00000000ffffffffULL));
 		IXGBE_WRITE_REG(hw, IXGBE_RDBAH(rxq->reg_idx), (uint32_t)(rxq->ring_physaddr >> 32));
 		IXGBE_WRITE_REG(hw, IXGBE_RDLEN(rxq->reg_idx), rxq->len * sizeof(union ixgbe_adv_rx_desc));
+
+		/* Size the receive buffers after the mbuf class of the queue */
+		srrctl = IXGBE_READ_REG(hw, IXGBE_SRRCTL(rxq->reg_idx));
+		srrctl &= ~IXGBE_SRRCTL_BSIZEPKT_MASK;
+		srrctl |= (mbuf_class_data_len[rxq->erxq.mbuf_class] >> IXGBE_SRRCTL_BSIZEPKT_SHIFT) & IXGBE_SRRCTL_BSIZEPKT_MASK;
+		IXGBE_WRITE_REG(hw, IXGBE_SRRCTL(rxq->reg_idx), srrctl);
 	}
 
 	for (i = 0; i < dev->data->nb_tx_queues; i++) {
@@ -187,6 +195,7 @@ static int dev_start_vf(struct ix_rte_eth_dev *dev)
 {
 	int i;
 	int ret;
+	uint32_t srrctl;
 	struct ixgbe_hw *hw;
 
 	hw = IXGBE_DEV_PRIVATE_TO_HW(rte_eth_devices[dev->port].data->dev_private);
@@ -207,6 +216,12 @@ static int dev_start_vf(struct ix_rte_eth_dev *dev)
 		IXGBE_WRITE_REG(hw, IXGBE_VFRDBAL(i), (uint32_t)(rxq->ring_physaddr & 0x00000000ffffffffULL));
 		IXGBE_WRITE_REG(hw, IXGBE_VFRDBAH(i), (uint32_t)(rxq->ring_physaddr >> 32));
 		IXGBE_WRITE_REG(hw, IXGBE_VFRDLEN(i), rxq->len * sizeof(union ixgbe_adv_rx_desc));
+
+		/* Size the receive buffers after the mbuf class of the queue */
+		srrctl = IXGBE_READ_REG(hw, IXGBE_VFSRRCTL(i));
+		srrctl &= ~IXGBE_SRRCTL_BSIZEPKT_MASK;
+		srrctl |= (mbuf_class_data_len[rxq->erxq.mbuf_class] >> IXGBE_SRRCTL_BSIZEPKT_SHIFT) & IXGBE_SRRCTL_BSIZEPKT_MASK;
+		IXGBE_WRITE_REG(hw, IXGBE_VFSRRCTL(i), srrctl);
 	}
 
 	for (i = 0; i < dev->data->nb_tx_queues; i++) {
@@ -265,7 +280,7 @@ static int ixgbe_alloc_rx_mbufs(struct rx_queue *rxq)
 
 	for (i = 0; i < rxq->len; i++) {
 		machaddr_t maddr;
-		struct mbuf *b = mbuf_alloc_local();
+		struct mbuf *b = mbuf_alloc_local_class(rxq->erxq.mbuf_class);
 		if (!b)
 			goto fail;
 
@@ -335,9 +350,10 @@ static int ixgbe_rx_poll(struct eth_rx_queue *rx)
 		}
 		b->timestamp = timestamp;
 
-		new_b = mbuf_alloc_local();
+		new_b = mbuf_alloc_local_class(rx->mbuf_class);
 		if (unlikely(!new_b)) {
 			log_err("ixgbe: unable to allocate RX mbuf\n");
+			trace_event(TRACE_DROP, TRACE_DROP_NOBUFS);
 			goto out;
 		}
 
@@ -461,6 +477,7 @@ static int rx_queue_setup(struct ix_rte_eth_dev *dev, int queue_idx,
 	rxq->reg_idx = drxq->reg_idx;
 
 	rxq->rdt_reg_addr = drxq->rdt_reg_addr;
+	rxq->erxq.mbuf_class = mbuf_rx_class;
 	rxq->erxq.poll = ixgbe_rx_poll;
 	rxq->erxq.ready = ixgbe_rx_ready;
 	dev->data->rx_queues[queue_idx] = &rxq->erxq;
@@ -0,0 +1,587 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * loopback.c - a software ethernet device backed by shared memory
+ *
+ * Each loopback link is a shared-memory file (/dev/shm/ix-lo-NAME) with
+ * two ports. An IX instance attaches to one side and transmits into the
+ * RX rings of the other side, so two instances on the same host can run
+ * end-to-end experiments without a NIC. RSS is emulated in software: the
+ * transmitter computes the Toeplitz hash and picks the peer's RX queue
+ * through the redirection table that the peer publishes with reta_update,
+ * so flow group migration works exactly as with real hardware.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ix/stddef.h>
+#include <ix/errno.h>
+#include <ix/log.h>
+#include <ix/byteorder.h>
+#include <ix/atomic.h>
+#include <ix/lock.h>
+#include <ix/bitmap.h>
+#include <ix/hash.h>
+#include <ix/cfg.h>
+#include <ix/mbuf.h>
+#include <ix/ethdev.h>
+#include <ix/ethqueue.h>
+#include <ix/drivers.h>
+#include <ix/trace.h>
+
+#include <asm/chksum.h>
+
+#include <net/ethernet.h>
+#include <net/ip.h>
+
+#define LO_MAX_QUEUES		8
+#define LO_NB_FGS		128
+#define LO_RING_SZ		ETH_DEV_RX_QUEUE_SZ
+#define LO_SLOT_DATA_LEN	(MBUF_DATA_LEN - 8)
+#define LO_TCP_CHKSUM_OFF	16	/* offset of the checksum in a TCP header */
+
+struct lo_slot {
+	uint32_t len;
+	uint32_t hash;
+	uint8_t data[LO_SLOT_DATA_LEN];
+};
+
+struct lo_ring {
+	spinlock_t lock;		/* serializes the producers */
+	volatile uint32_t tail;		/* written by the producers */
+	uint8_t pad0[56];
+	volatile uint32_t head;		/* written by the consumer */
+	uint8_t pad1[60];
+	struct lo_slot slot[LO_RING_SZ];
+} __aligned(64);
+
+struct lo_port {
+	volatile uint32_t ready;	/* the owner has started the port */
+	volatile uint16_t nb_rx_queues;
+	volatile uint16_t reta[LO_NB_FGS];
+	uint64_t rx_dropped;		/* peer ring was full */
+	uint64_t tx_dropped;		/* peer not ready or frame too large */
+	struct lo_ring ring[LO_MAX_QUEUES];
+};
+
+struct lo_shm {
+	struct lo_port port[2];
+};
+
+struct lo_dev {
+	struct lo_shm *shm;
+	struct lo_port *own;
+	struct lo_port *peer;
+	struct eth_addr mac;
+};
+
+struct lo_rx_queue {
+	struct eth_rx_queue erxq;
+	struct lo_ring *ring;
+};
+
+#define eth_rx_queue_to_drv(rxq) container_of(rxq, struct lo_rx_queue, erxq)
+
+struct lo_tx_queue {
+	struct eth_tx_queue etxq;
+	struct lo_dev *lo;
+	int nr_pending;
+	struct mbuf *pending[ETH_DEV_TX_QUEUE_SZ];
+};
+
+#define eth_tx_queue_to_drv(txq) container_of(txq, struct lo_tx_queue, etxq)
+
+/* the default Intel RSS key, also used by the ixgbe and i40e drivers */
+static uint8_t lo_rss_key[40] = {
+	0x6D, 0x5A, 0x56, 0xDA, 0x25, 0x5B, 0x0E, 0xC2,
+	0x41, 0x67, 0x25, 0x3D, 0x43, 0xA3, 0x8F, 0xB0,
+	0xD0, 0xCA, 0x2B, 0xCB, 0xAE, 0x7B, 0x30, 0xB4,
+	0x77, 0xCB, 0x2D, 0xA3, 0x80, 0x30, 0xF2, 0x0C,
+	0x6A, 0x42, 0xB7, 0x3B, 0xBE, 0xAC, 0x01, 0xFA,
+};
+
+static inline struct lo_dev *lo_dev_private(struct ix_rte_eth_dev *dev)
+{
+	return (struct lo_dev *) dev->data->dev_private;
+}
+
+static int lo_dev_start(struct ix_rte_eth_dev *dev)
+{
+	struct lo_dev *lo = lo_dev_private(dev);
+
+	wmb();
+	lo->own->ready = 1;
+	return 0;
+}
+
+static void lo_dev_infos_get(struct ix_rte_eth_dev *dev, struct ix_rte_eth_dev_info *dev_info)
+{
+	dev_info->nb_rx_fgs = LO_NB_FGS;
+	dev_info->max_rx_queues = LO_MAX_QUEUES;
+	dev_info->max_tx_queues = LO_MAX_QUEUES;
+}
+
+static int lo_link_update(struct ix_rte_eth_dev *dev, int wait_to_complete)
+{
+	dev->data->dev_link.link_speed = ETH_LINK_SPEED_10000;
+	dev->data->dev_link.link_duplex = ETH_LINK_FULL_DUPLEX;
+	dev->data->dev_link.link_status = 1;
+	return 0;
+}
+
+static void lo_promiscuous_disable(struct ix_rte_eth_dev *dev)
+{
+}
+
+static void lo_allmulticast_enable(struct ix_rte_eth_dev *dev)
+{
+}
+
+static int lo_reta_update(struct ix_rte_eth_dev *dev, struct rte_eth_rss_reta *reta_conf)
+{
+	int i;
+	struct lo_dev *lo = lo_dev_private(dev);
+
+	spin_lock(&dev->lock);
+	for (i = 0; i < LO_NB_FGS; i++) {
+		if (bitmap_test(reta_conf->mask, i))
+			lo->own->reta[i] = reta_conf->reta[i];
+	}
+	spin_unlock(&dev->lock);
+
+	return 0;
+}
+
+static int lo_rx_poll(struct eth_rx_queue *rx)
+{
+	struct lo_rx_queue *rxq = eth_rx_queue_to_drv(rx);
+	struct lo_ring *ring = rxq->ring;
+	struct lo_slot *slot;
+	struct mbuf *b;
+	uint32_t head, tail;
+	int nb_descs = 0;
+	long timestamp;
+
+	head = ring->head;
+	tail = ring->tail;
+	rmb();
+
+	timestamp = rdtsc();
+	while (head != tail) {
+		slot = &ring->slot[head & (LO_RING_SZ - 1)];
+
+		b = mbuf_alloc_local_class(rx->mbuf_class);
+		if (unlikely(!b)) {
+			log_err("loopback: unable to allocate RX mbuf\n");
+			trace_event(TRACE_DROP, TRACE_DROP_NOBUFS);
+			break;
+		}
+
+		memcpy(mbuf_mtod(b, void *), slot->data, slot->len);
+		b->len = slot->len;
+		b->fg_id = rx->dev->data->rx_fgs[slot->hash &
+				(rx->dev->data->nb_rx_fgs - 1)].fg_id;
+		b->timestamp = timestamp;
+
+		head++;
+		nb_descs++;
+
+		if (unlikely(eth_recv(rx, b))) {
+			log_info("loopback: dropping packet\n");
+			mbuf_free(b);
+		}
+	}
+
+	/* release the slots to the producers */
+	wmb();
+	ring->head = head;
+
+	return nb_descs;
+}
+
+static bool lo_rx_ready(struct eth_rx_queue *rx)
+{
+	struct lo_rx_queue *rxq = eth_rx_queue_to_drv(rx);
+
+	return rxq->ring->head != rxq->ring->tail;
+}
+
+/**
+ * lo_rx_queue_setup - prepares an RX queue
+ * @dev: the ethernet device
+ * @queue_idx: the queue number
+ * @numa_node: the desired NUMA affinity, or -1 for no preference
+ * @nb_desc: the number of descriptors (ignored, rings are fixed size)
+ *
+ * Returns 0 if successful, otherwise failure.
+ */
+static int lo_rx_queue_setup(struct ix_rte_eth_dev *dev, int queue_idx,
+			     int numa_node, uint16_t nb_desc)
+{
+	struct lo_dev *lo = lo_dev_private(dev);
+	struct lo_rx_queue *rxq;
+
+	if (queue_idx >= LO_MAX_QUEUES)
+		return -EINVAL;
+
+	rxq = calloc(1, sizeof(*rxq));
+	if (!rxq)
+		return -ENOMEM;
+
+	rxq->ring = &lo->own->ring[queue_idx];
+	rxq->erxq.mbuf_class = mbuf_rx_class;
+	rxq->erxq.poll = lo_rx_poll;
+	rxq->erxq.ready = lo_rx_ready;
+	dev->data->rx_queues[queue_idx] = &rxq->erxq;
+
+	wmb();
+	lo->own->nb_rx_queues = queue_idx + 1;
+	return 0;
+}
+
+/**
+ * lo_rss_hash - computes the RSS hash a NIC would report for a packet
+ * @buf: the packet headers
+ * @len: the length of the headers
+ *
+ * Returns the Toeplitz hash for IPv4 TCP/UDP packets, otherwise 0.
+ */
+static uint32_t lo_rss_hash(uint8_t *buf, size_t len)
+{
+	struct eth_hdr *ethhdr = (struct eth_hdr *) buf;
+	struct ip_hdr *iphdr = (struct ip_hdr *) (ethhdr + 1);
+	uint16_t *ports;
+
+	if (len < sizeof(struct eth_hdr) + sizeof(struct ip_hdr) ||
+	    ethhdr->type != hton16(ETHTYPE_IP))
+		return 0;
+	if (iphdr->proto != IPPROTO_TCP && iphdr->proto != IPPROTO_UDP)
+		return 0;
+	if (ntoh16(iphdr->off) & (IP_MF | IP_OFFMASK))
+		return 0;
+	if (len < sizeof(struct eth_hdr) + iphdr->header_len * 4 + 4)
+		return 0;
+
+	ports = (uint16_t *) ((uint8_t *) iphdr + iphdr->header_len * 4);
+	return hash_toeplitz(lo_rss_key, iphdr->src_addr.addr,
+			     iphdr->dst_addr.addr, ports[0], ports[1]);
+}
+
+/**
+ * lo_tx_offload - performs in software the offloads a NIC would do
+ * @m: the packet
+ * @buf: the transmitted copy of the packet
+ * @len: the length of the copy
+ *
+ * With PKT_TX_TCP_CKSUM set, the TCP checksum field only holds the
+ * pseudo-header sum (see inet_chksum_pseudo()), so the checksum over
+ * the header and payload is completed here, as the NIC would.
+ */
+static void lo_tx_offload(struct mbuf *m, uint8_t *buf, size_t len)
+{
+	struct ip_hdr *iphdr = (struct ip_hdr *) (buf + sizeof(struct eth_hdr));
+	size_t hdr_len = iphdr->header_len * 4;
+	size_t l4_len;
+	uint8_t *l4;
+
+	if (m->ol_flags & PKT_TX_TCP_CKSUM) {
+		l4 = (uint8_t *) iphdr + hdr_len;
+		l4_len = ntoh16(iphdr->len) - hdr_len;
+		if (likely(sizeof(struct eth_hdr) + hdr_len + l4_len <= len &&
+			   l4_len >= LO_TCP_CHKSUM_OFF + sizeof(uint16_t)))
+			*(uint16_t *) (l4 + LO_TCP_CHKSUM_OFF) =
+				chksum_internet((void *) l4, l4_len);
+	}
+
+	if (m->ol_flags & PKT_TX_IP_CKSUM) {
+		iphdr->chksum = 0;
+		iphdr->chksum = chksum_internet((void *) iphdr, hdr_len);
+	}
+}
+
+static void lo_tx_one(struct lo_dev *lo, struct mbuf *m)
+{
+	struct lo_port *peer = lo->peer;
+	struct lo_ring *ring;
+	struct lo_slot *slot;
+	uint16_t nb_queues;
+	uint32_t hash;
+	size_t len, off;
+	int i, queue;
+
+	len = m->len;
+	for (i = 0; i < m->nr_iov; i++)
+		len += m->iovs[i].len;
+
+	nb_queues = peer->nb_rx_queues;
+	if (unlikely(!peer->ready || !nb_queues || len > LO_SLOT_DATA_LEN)) {
+		__sync_fetch_and_add(&lo->own->tx_dropped, 1);
+		return;
+	}
+
+	/* the headers are always in the linear part of the mbuf */
+	hash = lo_rss_hash(mbuf_mtod(m, uint8_t *), m->len);
+	queue = peer->reta[hash & (LO_NB_FGS - 1)];
+	if (unlikely(queue >= nb_queues))
+		queue = 0;
+	ring = &peer->ring[queue];
+
+	spin_lock(&ring->lock);
+	if (unlikely((uint32_t)(ring->tail - ring->head) >= LO_RING_SZ)) {
+		spin_unlock(&ring->lock);
+		__sync_fetch_and_add(&peer->rx_dropped, 1);
+		return;
+	}
+
+	slot = &ring->slot[ring->tail & (LO_RING_SZ - 1)];
+	memcpy(slot->data, mbuf_mtod(m, void *), m->len);
+	off = m->len;
+	for (i = 0; i < m->nr_iov; i++) {
+		memcpy(slot->data + off, m->iovs[i].base, m->iovs[i].len);
+		off += m->iovs[i].len;
+	}
+	if (m->ol_flags)
+		lo_tx_offload(m, slot->data, len);
+	slot->len = len;
+	slot->hash = hash;
+
+	wmb();
+	ring->tail++;
+	spin_unlock(&ring->lock);
+}
+
+static int lo_tx_reclaim(struct eth_tx_queue *tx)
+{
+	struct lo_tx_queue *txq = eth_tx_queue_to_drv(tx);
+	int i;
+
+	/* packets are copied on transmit, so everything pending is done */
+	for (i = 0; i < txq->nr_pending; i++)
+		mbuf_xmit_done(txq->pending[i]);
+	txq->nr_pending = 0;
+
+	return ETH_DEV_TX_QUEUE_SZ;
+}
+
+static int lo_tx_xmit(struct eth_tx_queue *tx, int nr, struct mbuf **mbufs)
+{
+	struct lo_tx_queue *txq = eth_tx_queue_to_drv(tx);
+	int nb_pkts;
+
+	for (nb_pkts = 0; nb_pkts < nr; nb_pkts++) {
+		if (unlikely(txq->nr_pending >= ETH_DEV_TX_QUEUE_SZ))
+			break;
+
+		lo_tx_one(txq->lo, mbufs[nb_pkts]);
+		txq->pending[txq->nr_pending++] = mbufs[nb_pkts];
+	}
+
+	return nb_pkts;
+}
+
+static int lo_tx_queue_setup(struct ix_rte_eth_dev *dev, int queue_idx,
+			     int numa_node, uint16_t nb_desc)
+{
+	struct lo_tx_queue *txq;
+
+	if (queue_idx >= LO_MAX_QUEUES)
+		return -EINVAL;
+
+	txq = calloc(1, sizeof(*txq));
+	if (!txq)
+		return -ENOMEM;
+
+	txq->lo = lo_dev_private(dev);
+	txq->etxq.reclaim = lo_tx_reclaim;
+	txq->etxq.xmit = lo_tx_xmit;
+	dev->data->tx_queues[queue_idx] = &txq->etxq;
+	return 0;
+}
+
+/*
+ * There is no flow director, so outbound connections fall back to
+ * searching for a local port whose RSS hash lands on the local CPU.
+ */
+static int lo_fdir_add_perfect_filter(struct ix_rte_eth_dev *dev, struct rte_fdir_filter *fdir_ftr, uint16_t soft_id, uint8_t rx_queue, uint8_t drop)
+{
+	return -ENODEV;
+}
+
+static int lo_fdir_remove_perfect_filter(struct ix_rte_eth_dev *dev, struct rte_fdir_filter *fdir_ftr, uint16_t soft_id)
+{
+	return -ENODEV;
+}
+
+static int lo_rss_hash_conf_get(struct ix_rte_eth_dev *dev, struct ix_rte_eth_rss_conf *ix_reta_conf)
+{
+	ix_reta_conf->rss_key = lo_rss_key;
+	ix_reta_conf->rss_hf = ETH_RSS_IPV4_TCP | ETH_RSS_IPV4_UDP;
+	return 0;
+}
+
+static void lo_mac_addr_add(struct ix_rte_eth_dev *dev, struct eth_addr *mac_addr, uint32_t index, uint32_t vmdq)
+{
+}
+
+static void lo_stats_get(struct ix_rte_eth_dev *dev, struct ix_rte_eth_stats *stats)
+{
+	struct lo_dev *lo = lo_dev_private(dev);
+
+	memset(stats, 0, sizeof(*stats));
+	stats->ierrors = lo->own->rx_dropped;
+	stats->oerrors = lo->own->tx_dropped;
+}
+
+static struct ix_eth_dev_ops lo_eth_dev_ops = {
+	.allmulticast_enable = lo_allmulticast_enable,
+	.dev_infos_get = lo_dev_infos_get,
+	.dev_start = lo_dev_start,
+	.link_update = lo_link_update,
+	.promiscuous_disable = lo_promiscuous_disable,
+	.reta_update = lo_reta_update,
+	.rx_queue_setup = lo_rx_queue_setup,
+	.tx_queue_setup = lo_tx_queue_setup,
+	.fdir_add_perfect_filter = lo_fdir_add_perfect_filter,
+	.fdir_remove_perfect_filter = lo_fdir_remove_perfect_filter,
+	.rss_hash_conf_get = lo_rss_hash_conf_get,
+	.mac_addr_add = lo_mac_addr_add,
+	.stats_get = lo_stats_get,
+};
+
+static struct lo_shm *lo_shm_attach(const char *name)
+{
+	char path[64];
+	void *vaddr;
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "/ix-lo-%s", name);
+
+	/* never truncate: the other side may already be attached */
+	fd = shm_open(path, O_RDWR | O_CREAT, 0660);
+	if (fd == -1)
+		return NULL;
+
+	ret = ftruncate(fd, sizeof(struct lo_shm));
+	if (ret) {
+		close(fd);
+		return NULL;
+	}
+
+	vaddr = mmap(NULL, sizeof(struct lo_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (vaddr == MAP_FAILED)
+		return NULL;
+
+	return vaddr;
+}
+
+/**
+ * loopback_init - attaches to one side of a shared-memory loopback link
+ * @name: the link as "NAME:SIDE", where SIDE is 0 or 1
+ * @ethp: a pointer to store the new ethernet device
+ *
+ * Returns 0 if successful, otherwise failure.
+ */
+int loopback_init(const char *name, struct ix_rte_eth_dev **ethp)
+{
+	char link[32];
+	char *sep;
+	int i, side;
+	uint32_t h;
+	struct ix_rte_eth_dev *dev;
+	struct lo_dev *lo;
+
+	strncpy(link, name, sizeof(link));
+	link[sizeof(link) - 1] = '\0';
+	sep = strrchr(link, ':');
+	if (!sep || sep == link || (strcmp(sep, ":0") && strcmp(sep, ":1"))) {
+		log_err("loopback: invalid device %s, expected NAME:SIDE\n", name);
+		return -EINVAL;
+	}
+	*sep = '\0';
+	side = sep[1] - '0';
+
+	if (CFG.mtu > ETH_MTU) {
+		log_err("loopback: jumbo frames are not supported\n");
+		return -EINVAL;
+	}
+
+	dev = eth_dev_alloc(sizeof(struct lo_dev));
+	if (!dev)
+		return -ENOMEM;
+	spin_lock_init(&dev->lock);
+
+	lo = lo_dev_private(dev);
+	lo->shm = lo_shm_attach(link);
+	if (!lo->shm) {
+		log_err("loopback: unable to map link %s\n", link);
+		eth_dev_destroy(dev);
+		return -ENOMEM;
+	}
+	lo->own = &lo->shm->port[side];
+	lo->peer = &lo->shm->port[!side];
+
+	/* we own our port: reset it in case of a previous run */
+	lo->own->ready = 0;
+	wmb();
+	lo->own->nb_rx_queues = 0;
+	lo->own->rx_dropped = 0;
+	lo->own->tx_dropped = 0;
+	for (i = 0; i < LO_NB_FGS; i++)
+		lo->own->reta[i] = 0;
+	for (i = 0; i < LO_MAX_QUEUES; i++) {
+		spin_lock_init(&lo->own->ring[i].lock);
+		lo->own->ring[i].head = 0;
+		lo->own->ring[i].tail = 0;
+	}
+
+	/* a locally administered MAC derived from the link name and side */
+	h = hash_crc32c_one(0, 0);
+	for (i = 0; link[i]; i++)
+		h = hash_crc32c_one(h, link[i]);
+	lo->mac.addr[0] = 0x02;
+	lo->mac.addr[1] = 0x00;
+	lo->mac.addr[2] = h >> 16;
+	lo->mac.addr[3] = h >> 8;
+	lo->mac.addr[4] = h;
+	lo->mac.addr[5] = side;
+
+	dev->dev_ops = &lo_eth_dev_ops;
+	dev->data->mac_addrs = calloc(1, ETH_ADDR_LEN);
+	if (!dev->data->mac_addrs) {
+		munmap(lo->shm, sizeof(struct lo_shm));
+		eth_dev_destroy(dev);
+		return -ENOMEM;
+	}
+	memcpy(&dev->data->mac_addrs[0], &lo->mac, ETH_ADDR_LEN);
+
+	log_info("loopback: attached to side %d of link %s\n", side, link);
+	*ethp = dev;
+	return 0;
+}
@@ -78,8 +78,10 @@ DEFINE_PERCPU(struct mempool, tcp_pcb_mempool __attribute__ ((aligned (64))));
 DEFINE_PERCPU(struct mempool, tcp_pcb_listen_mempool __attribute__ ((aligned (64))));
 DEFINE_PERCPU(struct mempool, tcp_seg_mempool __attribute__ ((aligned (64))));
 
+#ifndef MEMP_SIZE
 #define MEMP_SIZE (256*1024)
 #define PBUF_CAPACITY (768*1024)
+#endif
 
 #define PBUF_WITH_PAYLOAD_SIZE 4096
 
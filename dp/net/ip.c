@@ -126,6 +126,9 @@ void eth_input(struct eth_rx_queue *rx_queue, struct mbuf *pkt)
 	fg = fgs[pkt->fg_id];
 	eth_fg_set_current(fg);
 
+	fg->acc_pkts++;
+	fg->acc_bytes += pkt->len;
+
 	log_debug("ip: got ethernet packet of len %ld, type %x\n",
 		  pkt->len, ntoh16(ethhdr->type));
 
@@ -153,7 +156,8 @@ int ip_output_hinted(struct eth_fg *cur_fg, struct pbuf *p, struct ip_addr *src,
 	struct pbuf *curp;
 	struct ip_addr dst_addr;
 
-	pkt = mbuf_alloc_local();
+	pkt = mbuf_alloc_fit(sizeof(struct eth_hdr) + sizeof(struct ip_hdr) +
+			     p->tot_len);
 	if (unlikely(!pkt))
 		return -ENOMEM;
 
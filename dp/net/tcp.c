@@ -900,6 +900,7 @@ pcb_remove_called_from_timer(struct eth_fg *cur_fg,struct tcp_pcb *pcb, int pcb_
       tcp_pcb_purge(pcb);
       /* Remove PCB from tcp_fg_lists.active_pcbs list. */
       hlist_del(&pcb->link);
+      cur_fg->tcp_active_pcbs--;
 
 
       if (pcb_reset) {
@@ -35,6 +35,8 @@
 #include <ix/kstats.h>
 #include <ix/cfg.h>
 #include <ix/config.h>
+#include <ix/hash.h>
+#include <ix/atomic.h>
 
 #include <lwip/tcp.h>
 
@@ -46,6 +48,10 @@ int ip_send_one(struct eth_fg *cur_fg, struct ip_addr *dst_addr, struct mbuf *pk
 /* FIXME: this should be probably per queue */
 static DEFINE_PERCPU(struct tcp_pcb_listen[CFG_MAX_PORTS], listen_ports);
 
+/* admission control, shared by all cores listening on a port */
+static atomic_t port_open[CFG_MAX_PORTS];
+static unsigned int port_limit[CFG_MAX_PORTS];
+
 static DEFINE_PERCPU(uint16_t, local_port);
 /* FIXME: this should be more adaptive to various configurations */
 #define PORTS_PER_CPU (65536 / 32)
@@ -70,7 +76,9 @@ struct tcpapi_pcb {
 	hid_t handle;
 	struct pbuf *recvd;
 	struct pbuf *recvd_tail;
+	size_t recvd_done; /* bytes of recvd already acknowledged */
 	int queue;
+	int port; /* the port index charged to its admission limit, or -1 */
 	bool accepted;
 };
 
@@ -81,6 +89,7 @@ static DEFINE_PERCPU(struct mempool, pcb_mempool __attribute__((aligned(64))));
 static DEFINE_PERCPU(struct mempool, id_mempool __attribute__((aligned(64))));
 
 static void remove_fdir_filter(struct ip_tuple *id);
+static void tcpapi_free(struct eth_fg *cur_fg, struct tcpapi_pcb *api);
 
 /**
  * handle_to_tcpapi - converts a handle to a PCB
@@ -185,18 +194,110 @@ long bsys_tcp_accept(hid_t handle, unsigned long cookie)
 	return RET_OK;
 }
 
+/**
+ * bsys_tcp_acceptv - accepts a batch of connection requests
+ * @ents: the handle and cookie pairs
+ * @nrents: the number of pairs
+ *
+ * Returns RET_OK, or the error of the last request that failed.
+ */
+long bsys_tcp_acceptv(struct accept_entry __user *ents, unsigned int nrents)
+{
+	unsigned int i;
+	long ret = RET_OK, err;
+
+	KSTATS_VECTOR(bsys_tcp_acceptv);
+
+	log_debug("tcpapi: bsys_tcp_acceptv() - ents %p, nrents %u\n",
+		  ents, nrents);
+
+	if (unlikely(!uaccess_okay(ents, nrents * sizeof(struct accept_entry))))
+		return -RET_FAULT;
+
+	for (i = 0; i < nrents; i++) {
+		hid_t handle = uaccess_peekq((uint64_t *) &ents[i].handle);
+		unsigned long cookie = uaccess_peekq(&ents[i].cookie);
+
+		if (unlikely(uaccess_check_fault()))
+			return -RET_FAULT;
+
+		err = bsys_tcp_accept(handle, cookie);
+		if (unlikely(err))
+			ret = err;
+	}
+
+	/* the return is not about any one of the flows */
+	percpu_get(syscall_cookie) = 0;
+	return ret;
+}
+
+static int port_to_idx(uint16_t port)
+{
+	int i;
+
+	if (CFG.num_ports == 0)
+		return port == DEFAULT_PORT ? 0 : -1;
+
+	for (i = 0; i < CFG.num_ports; i++) {
+		if (CFG.ports[i] == port)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * bsys_tcp_admit - sets the admission limit of a listening port
+ * @port: the port
+ * @limit: the maximum number of open connections, or zero for no limit
+ *
+ * Connections are only counted while a limit is set, so connections
+ * that were admitted without one do not count towards a later limit.
+ *
+ * Returns RET_OK, or -RET_INVAL if we are not listening on @port.
+ */
+long bsys_tcp_admit(uint16_t port, unsigned int limit)
+{
+	int idx = port_to_idx(port);
+
+	KSTATS_VECTOR(bsys_tcp_admit);
+
+	log_debug("tcpapi: bsys_tcp_admit() - port %u, limit %u\n",
+		  port, limit);
+
+	percpu_get(syscall_cookie) = 0;
+	if (idx < 0)
+		return -RET_INVAL;
+
+	port_limit[idx] = limit;
+	return RET_OK;
+}
+
 long bsys_tcp_reject(hid_t handle)
 {
 	/*
-	 * FIXME: LWIP's synchronous handling of accepts
-	 * makes supporting this call impossible.
+	 * LWIP's synchronous handling of accepts has already established
+	 * the connection, so the best we can do is to reset it. This also
+	 * gives back its admission slot.
 	 */
 
+	struct eth_fg *cur_fg;
+	struct tcpapi_pcb *api = handle_to_tcpapi(handle, &cur_fg);
+
 	KSTATS_VECTOR(bsys_tcp_reject);
 
-	log_err("tcpapi: bsys_tcp_reject() is not implemented\n");
+	log_debug("tcpapi: bsys_tcp_reject() - handle %lx\n", handle);
 
-	return -RET_NOTSUP;
+	if (unlikely(!api)) {
+		log_debug("tcpapi: invalid handle\n");
+		return -RET_BADH;
+	}
+
+	if (unlikely(api->accepted))
+		return -RET_INVAL;
+
+	tcpapi_free(cur_fg, api);
+	return RET_OK;
 }
 
 ssize_t bsys_tcp_send(hid_t handle, void *addr, size_t len)
@@ -278,6 +379,16 @@ ssize_t bsys_tcp_sendv(hid_t handle, struct sg_entry __user *ents,
 	return len_xmited;
 }
 
+/**
+ * bsys_tcp_recv_done - acknowledges received data
+ * @handle: the TCP flow handle
+ * @len: the number of bytes consumed
+ *
+ * @len may span any number of receive events (and scatter-gather entries
+ * of USYS_TCP_RECVV events) and may end partway through one.
+ *
+ * Returns RET_OK, or -RET_BADH if the handle is invalid.
+ */
 long bsys_tcp_recv_done(hid_t handle, size_t len)
 {
 	struct eth_fg *cur_fg;
@@ -298,35 +409,27 @@ long bsys_tcp_recv_done(hid_t handle, size_t len)
 
 	if (api->pcb)
 		tcp_recved(cur_fg, api->pcb, len);
+
+	len += api->recvd_done;
 	while (recvd) {
-		if (len < recvd->len)
+		if (len < recvd->tot_len)
 			break;
 
-		len -= recvd->len;
+		len -= recvd->tot_len;
 		next = recvd->tcp_api_next;
 		pbuf_free(recvd);
 		recvd = next;
 	}
 
 	api->recvd = recvd;
+	api->recvd_done = recvd ? len : 0;
 	return RET_OK;
 }
 
-long bsys_tcp_close(hid_t handle)
+static void tcpapi_free(struct eth_fg *cur_fg, struct tcpapi_pcb *api)
 {
-	struct eth_fg *cur_fg;
-	struct tcpapi_pcb *api = handle_to_tcpapi(handle, &cur_fg);
 	struct pbuf *recvd, *next;
 
-	KSTATS_VECTOR(bsys_tcp_close);
-
-	log_debug("tcpapi: bsys_tcp_close - handle %lx\n", handle);
-
-	if (unlikely(!api)) {
-		log_debug("tcpapi: invalid handle\n");
-		return -RET_BADH;
-	}
-
 	if (api->pcb) {
 		tcp_close_with_reset(cur_fg, api->pcb);
 	}
@@ -343,7 +446,27 @@ long bsys_tcp_close(hid_t handle)
 		mempool_free(&percpu_get(id_mempool), api->id);
 	}
 
+	if (api->port >= 0)
+		atomic_fetch_and_sub(&port_open[api->port], 1);
+
 	mempool_free(&percpu_get(pcb_mempool), api);
+}
+
+long bsys_tcp_close(hid_t handle)
+{
+	struct eth_fg *cur_fg;
+	struct tcpapi_pcb *api = handle_to_tcpapi(handle, &cur_fg);
+
+	KSTATS_VECTOR(bsys_tcp_close);
+
+	log_debug("tcpapi: bsys_tcp_close - handle %lx\n", handle);
+
+	if (unlikely(!api)) {
+		log_debug("tcpapi: invalid handle\n");
+		return -RET_BADH;
+	}
+
+	tcpapi_free(cur_fg, api);
 	return RET_OK;
 }
 
@@ -465,18 +588,28 @@ static err_t on_accept(struct eth_fg *cur_fg, void *arg, struct tcp_pcb *pcb, er
 	struct tcpapi_pcb *api;
 	struct ip_tuple *id;
 	hid_t handle;
-
+	int port = port_to_idx(pcb->local_port);
+	unsigned int limit = port >= 0 ? port_limit[port] : 0;
 
 	log_debug("tcpapi: on_accept - arg %p, pcb %p, err %d\n",
 		  arg, pcb, err);
 
+	/* the shared counter is only touched when the port has a limit */
+	if (limit) {
+		/* over the admission limit, LWIP resets the connection */
+		if (atomic_add_and_fetch(&port_open[port], 1) > limit)
+			goto fail_port;
+	} else {
+		port = -1;
+	}
+
 	api = mempool_alloc(&percpu_get(pcb_mempool));
 	if (unlikely(!api))
-		return ERR_MEM;
+		goto fail_port;
 	id = mempool_alloc(&percpu_get(id_mempool));
 	if (unlikely(!id)) {
 		mempool_free(&percpu_get(pcb_mempool), api);
-		return ERR_MEM;
+		goto fail_port;
 	}
 
 	api->pcb = pcb;
@@ -484,6 +617,8 @@ static err_t on_accept(struct eth_fg *cur_fg, void *arg, struct tcp_pcb *pcb, er
 	api->cookie = 0;
 	api->recvd = NULL;
 	api->recvd_tail = NULL;
+	api->recvd_done = 0;
+	api->port = port;
 	api->accepted = false;
 
 	tcp_nagle_disable(pcb);
@@ -511,6 +646,11 @@ static err_t on_accept(struct eth_fg *cur_fg, void *arg, struct tcp_pcb *pcb, er
 
 	usys_tcp_knock(handle, id);
 	return ERR_OK;
+
+fail_port:
+	if (port >= 0)
+		atomic_fetch_and_sub(&port_open[port], 1);
+	return ERR_MEM;
 }
 
 static err_t on_connected(void *arg, struct tcp_pcb *pcb, err_t err)
@@ -578,31 +718,6 @@ lwip_tcp_event(struct eth_fg *cur_fg, void *arg, struct tcp_pcb *pcb,
    -- short version: need to fix this by using flow director for all outbound connections.  (EdB 2014-11-17)
 */
 
-static uint32_t compute_toeplitz_hash(const uint8_t *key, uint32_t src_addr, uint32_t dst_addr, uint16_t src_port, uint16_t dst_port)
-{
-	int i, j;
-	uint8_t input[12];
-	uint32_t result = 0;
-	uint32_t key_part = htonl(((uint32_t *)key)[0]);
-
-	memcpy(&input[0], &src_addr, 4);
-	memcpy(&input[4], &dst_addr, 4);
-	memcpy(&input[8], &src_port, 2);
-	memcpy(&input[10], &dst_port, 2);
-
-	for (i = 0; i < 12; i++) {
-		for (j = 128; j; j >>= 1) {
-			if (input[i] & j)
-				result ^= key_part;
-			key_part <<= 1;
-			if (key[i + 4] & j)
-				key_part |= 1;
-		}
-	}
-
-	return result;
-}
-
 static void remove_fdir_filter(struct ip_tuple *id)
 {
 	struct rte_fdir_filter fdir_ftr;
@@ -673,7 +788,7 @@ struct eth_fg *get_local_port_and_set_queue(struct ip_tuple *id)
 	while (1) {
 		if (percpu_get(local_port) >= (percpu_get(cpu_id) + 1) * PORTS_PER_CPU)
 			percpu_get(local_port) = percpu_get(cpu_id) * PORTS_PER_CPU + 1;
-		hash = compute_toeplitz_hash(rss_conf.rss_key, htonl(id->dst_ip), htonl(id->src_ip), htons(id->dst_port), htons(id->src_port));
+		hash = hash_toeplitz(rss_conf.rss_key, htonl(id->dst_ip), htonl(id->src_ip), htons(id->dst_port), htons(id->src_port));
 		fg_idx = hash & (dev->data->nb_rx_fgs - 1);
 		if (percpu_get(eth_rxqs[0])->dev->data->rx_fgs[fg_idx].cur_cpu == percpu_get(cpu_id)) {
 			//set_current_queue(percpu_get(eth_rxqs)[0]);
@@ -732,6 +847,8 @@ long bsys_tcp_connect(struct ip_tuple __user *id, unsigned long cookie)
 	api->cookie = cookie;
 	api->recvd = NULL;
 	api->recvd_tail = NULL;
+	api->recvd_done = 0;
+	api->port = -1;
 	api->accepted = true;
 
 	tcp_arg(pcb, api);
@@ -780,7 +897,8 @@ int tcp_output_packet(struct eth_fg *cur_fg, struct tcp_pcb *pcb, struct pbuf *p
 	struct pbuf *curp;
 	struct ip_addr dst_addr;
 
-	pkt = mbuf_alloc_local();
+	pkt = mbuf_alloc_fit(sizeof(struct eth_hdr) + sizeof(struct ip_hdr) +
+			     p->tot_len);
 	if (unlikely(!pkt))
 		return -ENOMEM;
 
@@ -374,6 +374,7 @@ done_tcp_input:
            deallocate the PCB. */
         TCP_EVENT_ERR(pcb->errf, pcb->callback_arg, ERR_RST);
         tcp_pcb_remove(cur_fg,pcb);
+        cur_fg->tcp_active_pcbs--;
         memp_free(MEMP_TCP_PCB, pcb);
       } else if (lwip_context.recv_flags & TF_CLOSED) {
         /* The connection has been closed and we will deallocate the
@@ -385,6 +386,7 @@ done_tcp_input:
           TCP_EVENT_ERR(pcb->errf, pcb->callback_arg, ERR_CLSD);
         }
         tcp_pcb_remove(cur_fg,pcb);
+        cur_fg->tcp_active_pcbs--;
         memp_free(MEMP_TCP_PCB, pcb);
       } else {
         err = ERR_OK;
@@ -186,7 +186,8 @@ long bsys_udp_send(void __user *__restrict vaddr, size_t len,
 
 	addr = (void *)((uintptr_t) addr + PGOFF_2MB(vaddr));
 
-	pkt = mbuf_alloc_local();
+	pkt = mbuf_alloc_fit(align_up(UDP_PKT_SIZE, sizeof(uint64_t)) +
+			     2 * sizeof(struct mbuf_iov));
 	if (unlikely(!pkt))
 		return -RET_NOBUFS;
 
@@ -234,41 +235,24 @@ long bsys_udp_sendv(struct sg_entry __user *ents, unsigned int nrents,
 	return -RET_NOSYS;
 }
 
-#define MAX_MBUF_PAGE_OFF	(PGSIZE_2MB - (PGSIZE_2MB % MBUF_LEN))
-
 /**
  * bsys_udp_recv_done - inform the kernel done using a UDP packet buffer
  * @iomap: a pointer anywhere inside the mbuf
  */
 long bsys_udp_recv_done(void *iomap)
 {
-	struct mempool *pool = &percpu_get(mbuf_mempool);
 	struct mbuf *m;
-	void *addr = iomap_to_mbuf(pool, iomap);
-	size_t off = PGOFF_2MB(addr);
 
 	KSTATS_VECTOR(bsys_udp_recv_done);
 
-
-#if 0
-	// EdB: deprecated; rely on mempool sanity
-
-	/* validate the address */
-	if (unlikely((uintptr_t) addr < (uintptr_t) pool->buf ||
-		     (uintptr_t) addr >=
-		     (uintptr_t) pool->buf + pool->nr_pages * PGSIZE_2MB ||
-		     off >= MAX_MBUF_PAGE_OFF)) {
-		log_err("udp: user tried to free an invalid mbuf"
-			"at address %p\n", addr);
+	m = mbuf_from_iomap(iomap);
+	if (unlikely(!m)) {
+		log_err("udp: user tried to free an invalid mbuf "
+			"at address %p\n", iomap);
 		return -RET_FAULT;
 	}
-#endif
-	//FIXME: should support the conversion in mempool.h for nostraddle==1 pools
-
-	m = (struct mbuf *)(PGADDR_2MB(addr) + (off / MBUF_LEN) * MBUF_LEN);
-
-	MEMPOOL_SANITY_ACCESS(addr);
 
+	MEMPOOL_SANITY_ACCESS(m);
 
 	if (unlikely(m->done != (void *) 0xDEADBEEF)) {
 		log_err("udp: user tried to free an already free mbuf\n");
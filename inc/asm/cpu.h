@@ -71,6 +71,13 @@ static inline unsigned long rdtscp(unsigned int *aux)
 	return ((unsigned long) a) | (((unsigned long) d) << 32);
 }
 
+static inline unsigned long rdpmc(unsigned int counter)
+{
+	unsigned int a, d;
+	asm volatile("rdpmc" : "=a"(a), "=d"(d) : "c"(counter));
+	return ((unsigned long) a) | (((unsigned long) d) << 32);
+}
+
 static inline unsigned long rdmsr(unsigned int msr)
 {
 	unsigned low, high;
@@ -34,6 +34,7 @@
 #define CFG_MAX_PORTS    16
 #define CFG_MAX_CPU     128
 #define CFG_MAX_ETHDEV   16
+#define CFG_LOOPBACK_PREFIX "loopback:"
 
 
 struct cfg_ip_addr {
@@ -53,11 +54,19 @@ struct cfg_parameters {
 
 	int num_ethdev;
 	struct pci_addr ethdev[CFG_MAX_ETHDEV];
+	char ethdev_loopback[CFG_MAX_ETHDEV][32];	/* "NAME:SIDE", empty for PCI */
 
 	int num_ports;
 	uint16_t ports[CFG_MAX_PORTS];
 
+	int mtu;
+
+	uint32_t kstats_pmu;	/* bitmap of enum kstats_pmu_event */
+
 	char loader_path[256];
+
+	char pcap_replay[256];		/* pcap file to inject, empty for none */
+	double pcap_replay_speed;	/* replay speedup, 0: as fast as possible */
 };
 
 extern struct cfg_parameters CFG;
@@ -38,6 +38,7 @@
 #define prefetch() prefetch0()
 
 #define clz64(x) __builtin_clzll(x)
+#define ctz64(x) __builtin_ctzll(x)
 
 #define __packed __attribute__((packed))
 #define __notused __attribute__((unused))
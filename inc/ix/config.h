@@ -3,3 +3,7 @@
 #define CONFIG_PRINT_CONNECTION_COUNT 0
 
 #define CONFIG_STATS 0
+
+#define CONFIG_TRACE 1
+
+#define CONFIG_PCAP 1
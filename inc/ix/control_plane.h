@@ -27,6 +27,8 @@
 
 #include <ix/compiler.h>
 #include <ix/ethfg.h>
+#include <ix/latsketch.h>
+#include <ix/pcap.h>
 
 #define IDLE_FIFO_SIZE 256
 
@@ -36,10 +38,16 @@ struct cpu_metrics {
 	double queue_size[3];
 	long loop_duration;
 	double idle[3];
+	unsigned int rx_batch;	/* the current RX batch bound */
+	unsigned int rx_slo_miss; /* per mille of RX iterations over the SLO */
 } __aligned(64);
 
 struct flow_group_metrics {
 	int cpu;
+	int conns;		/* active TCP connections */
+	uint64_t pkts;		/* received packets */
+	uint64_t bytes;		/* received bytes */
+	uint64_t cycles;	/* cycles spent processing received packets */
 } __aligned(64);
 
 enum cpu_state {
@@ -102,6 +110,12 @@ extern volatile struct cp_shmem {
 		long ts_first_pkt_at_target;
 		long ts_last_pkt_at_target;
 	} scratchpad[1024];
+	uint32_t trace_mask;	/* flight recorder events to record */
+	struct cp_latency {
+		struct latsketch rx_delay;	/* ns from RX poll to processing */
+		struct latsketch app;		/* ns, reported by the application */
+	} latency[NCPU];
+	struct pcap_filter pcap;	/* sampled packet capture */
 } *cp_shmem;
 
 #define SCRATCHPAD (&cp_shmem->scratchpad[cp_shmem->scratchpad_idx])
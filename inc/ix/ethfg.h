@@ -82,6 +82,11 @@ struct eth_fg {
 	struct hlist_head     bound_pcbs;     // tcp_pcb
 	struct tcp_hash_entry active_tbl[TCP_ACTIVE_PCBS_MAX_BUCKETS];
 
+	// load accounting, only updated by the owning CPU
+	uint64_t              acc_pkts;
+	uint64_t              acc_bytes;
+	uint64_t              acc_cycles;
+	int                   tcp_active_pcbs;
 };
 
 struct eth_fg_listener {
@@ -127,6 +132,7 @@ extern void eth_fg_init(struct eth_fg *fg, unsigned int idx);
 extern int eth_fg_init_cpu(struct eth_fg *fg);
 extern void eth_fg_free(struct eth_fg *fg);
 extern void eth_fg_assign_to_cpu(bitmap_ptr fg_bitmap, int cpu);
+extern void eth_fg_publish_metrics(void);
 
 extern int nr_flow_groups;
 
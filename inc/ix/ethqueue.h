@@ -38,6 +38,9 @@
 #define ETH_RX_MAX_DEPTH	32768
 
 extern unsigned int eth_rx_max_batch;
+extern unsigned int eth_rx_batch_min;
+extern unsigned int eth_rx_batch_max;
+extern unsigned int eth_rx_batch_slo;
 
 
 /*
@@ -51,6 +54,7 @@ struct eth_rx_queue {
 	struct mbuf *tail; /* pointer to last recieved buffer */
 	int len;	   /* the total number of buffers */
 	int queue_idx;	   /* the queue index number */
+	int mbuf_class;	   /* the mbuf size class of receive buffers */
 
 	/* poll for new packets */
 	int (*poll)(struct eth_rx_queue *rx);
@@ -32,6 +32,9 @@
 
 #pragma once
 
+#include <string.h>
+#include <ix/byteorder.h>
+
 static inline uint64_t __mm_crc32_u64(uint64_t crc, uint64_t val)
 {
 	asm("crc32q %1, %0" : "+r"(crc) : "rm"(val));
@@ -155,3 +158,40 @@ static inline uint64_t hash_city_two(uint64_t val_a, uint64_t val_b)
 	return __hash_city_len16(c, d, mul);
 }
 
+
+/**
+ * hash_toeplitz - computes the RSS (Toeplitz) hash of an IPv4 4-tuple
+ * @key: the 40-byte RSS key
+ * @src_addr: the source address (network byte order)
+ * @dst_addr: the destination address (network byte order)
+ * @src_port: the source port (network byte order)
+ * @dst_port: the destination port (network byte order)
+ *
+ * Returns the same hash a NIC configured with @key computes for the flow.
+ */
+static inline uint32_t hash_toeplitz(const uint8_t *key, uint32_t src_addr,
+				     uint32_t dst_addr, uint16_t src_port,
+				     uint16_t dst_port)
+{
+	int i, j;
+	uint8_t input[12];
+	uint32_t result = 0;
+	uint32_t key_part = hton32(((uint32_t *)key)[0]);
+
+	memcpy(&input[0], &src_addr, 4);
+	memcpy(&input[4], &dst_addr, 4);
+	memcpy(&input[8], &src_port, 2);
+	memcpy(&input[10], &dst_port, 2);
+
+	for (i = 0; i < 12; i++) {
+		for (j = 128; j; j >>= 1) {
+			if (input[i] & j)
+				result ^= key_part;
+			key_part <<= 1;
+			if (key[i + 4] & j)
+				key_part |= 1;
+		}
+	}
+
+	return result;
+}
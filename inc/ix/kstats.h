@@ -30,41 +30,138 @@
 #include <ix/cpu.h>
 #include <ix/log.h>
 
+/*
+ * Latencies are kept in a log-linear histogram: each power of two is
+ * split into 2^KSTATS_HIST_SUB_BITS buckets, which bounds the relative
+ * error of a bucket to 12.5%. Values beyond 2^KSTATS_HIST_MAX_BITS
+ * cycles land in the last bucket.
+ */
+#define KSTATS_HIST_SUB_BITS	3
+#define KSTATS_HIST_MAX_BITS	36
+#define KSTATS_HIST_BUCKETS \
+	((KSTATS_HIST_MAX_BITS - KSTATS_HIST_SUB_BITS + 1) << KSTATS_HIST_SUB_BITS)
+
+/*
+ * Optionally, a group of PMU counters (selected with the "kstats_pmu"
+ * configuration option) is read with rdpmc on every push and pop and
+ * charged to the vector, excluding nested vectors like tot_occ. Each
+ * enabled counter adds one rdpmc (~25-40 cycles) to both the push and
+ * the pop; with no counters configured the cost is a single branch.
+ */
+enum kstats_pmu_event {
+	KSTATS_PMU_CYCLES = 0,
+	KSTATS_PMU_INSTRUCTIONS,
+	KSTATS_PMU_LLC_MISSES,
+	KSTATS_PMU_BRANCH_MISSES,
+	KSTATS_PMU_NR_EVENTS,
+};
+
+#define KSTATS_PMU_NAMES \
+	{ "cycles", "instructions", "llc_misses", "branch_misses" }
+
 typedef struct kstats_distr {
 	uint64_t count;
-	uint64_t min_occ;
-	uint64_t max_occ;
 	uint64_t tot_occ;
-	uint64_t min_lat;
-	uint64_t max_lat;
 	uint64_t tot_lat;
-
+	uint64_t pmu[KSTATS_PMU_NR_EVENTS];
+	uint32_t lat_hist[KSTATS_HIST_BUCKETS];
 } kstats_distr;
 
+/**
+ * kstats_hist_bucket - maps a value to its histogram bucket
+ * @val: the value (in cycles)
+ */
+static inline int kstats_hist_bucket(uint64_t val)
+{
+	int msb;
+
+	if (val < (1UL << KSTATS_HIST_SUB_BITS))
+		return val;
+
+	msb = 63 - __builtin_clzl(val);
+	if (msb >= KSTATS_HIST_MAX_BITS)
+		return KSTATS_HIST_BUCKETS - 1;
+
+	return ((msb - KSTATS_HIST_SUB_BITS + 1) << KSTATS_HIST_SUB_BITS) |
+	       ((val >> (msb - KSTATS_HIST_SUB_BITS)) &
+		((1 << KSTATS_HIST_SUB_BITS) - 1));
+}
+
+/**
+ * kstats_hist_value - the smallest value that maps to a bucket
+ * @bucket: the histogram bucket
+ */
+static inline uint64_t kstats_hist_value(int bucket)
+{
+	int shift;
+
+	if (bucket < (1 << KSTATS_HIST_SUB_BITS))
+		return bucket;
+
+	shift = (bucket >> KSTATS_HIST_SUB_BITS) - 1;
+	return (uint64_t) ((1 << KSTATS_HIST_SUB_BITS) |
+			   (bucket & ((1 << KSTATS_HIST_SUB_BITS) - 1))) << shift;
+}
+
 
 typedef struct kstats_accumulate {
 	kstats_distr *cur;
 	uint64_t start_lat;
 	uint64_t start_occ;
 	uint64_t accum_time;
+	uint64_t start_pmu[KSTATS_PMU_NR_EVENTS];
+	uint64_t accum_pmu[KSTATS_PMU_NR_EVENTS];
 } kstats_accumulate;
 
+struct kstats_pmu {
+	int nr;
+	int event[KSTATS_PMU_NR_EVENTS];
+	unsigned int counter[KSTATS_PMU_NR_EVENTS];	/* rdpmc index */
+	uint64_t width_mask[KSTATS_PMU_NR_EVENTS];
+};
+
 
 typedef struct kstats {
 #define DEF_KSTATS(_c) kstats_distr  _c
 #include "kstatvectors.h"
 } kstats;
 
+#define KSTATS_BATCH_HISTOGRAM_SIZE 512
+#define KSTATS_BACKLOG_HISTOGRAM_SIZE 512
+
+/*
+ * The dataplane publishes cumulative snapshots of its counters in the
+ * "/ix-kstats" shared memory; it never resets or formats them. Each cpu
+ * alternates between two buffers and bumps @gen once a buffer is
+ * complete, so readers copy snap[gen & 1] and retry if @gen moved.
+ */
+struct kstats_snapshot {
+	uint64_t tsc;
+	uint64_t packets;
+	uint64_t hw_instructions;
+	uint64_t llc_load_misses;
+	uint32_t batch_histogram[KSTATS_BATCH_HISTOGRAM_SIZE];
+	uint32_t backlog_histogram[KSTATS_BACKLOG_HISTOGRAM_SIZE];
+	kstats ks;
+};
+
+struct ix_kstats {
+	uint32_t cpus;
+	uint32_t cycles_per_us;
+	uint32_t pmu_mask;	/* bitmap of sampled enum kstats_pmu_event */
+	struct ix_kstats_percpu {
+		volatile uint64_t gen;
+		struct kstats_snapshot snap[2];
+	} __aligned(64) percpu[NCPU];
+};
+
 #ifdef ENABLE_KSTATS
 
 DECLARE_PERCPU(kstats, _kstats);
 DECLARE_PERCPU(kstats_accumulate, _kstats_accumulate);
-DECLARE_PERCPU(int, _kstats_packets);
-DECLARE_PERCPU(int, _kstats_batch_histogram[]);
-DECLARE_PERCPU(int, _kstats_backlog_histogram[]);
-
-#define KSTATS_BATCH_HISTOGRAM_SIZE 512
-#define KSTATS_BACKLOG_HISTOGRAM_SIZE 512
+DECLARE_PERCPU(uint64_t, _kstats_packets);
+DECLARE_PERCPU(uint32_t, _kstats_batch_histogram[]);
+DECLARE_PERCPU(uint32_t, _kstats_backlog_histogram[]);
 
 extern void kstats_enter(kstats_distr *n, kstats_accumulate *saved_accu);
 extern void kstats_leave(kstats_accumulate *saved_accu);
@@ -109,7 +206,9 @@ static inline void kstats_backlog_inc(int count)
 #define KSTATS_BACKLOG_INC(_count) \
 	kstats_backlog_inc(_count)
 
+extern int kstats_init(void);
 extern int kstats_init_cpu(void);
+extern int kstats_init_pmu(void);
 
 #else /* ENABLE_KSTATS */
 
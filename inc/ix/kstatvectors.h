@@ -32,7 +32,7 @@ DEF_KSTATS(idle);
 DEF_KSTATS(user);
 DEF_KSTATS(timer);
 DEF_KSTATS(timer_collapse);
-DEF_KSTATS(print_kstats);
+DEF_KSTATS(publish_kstats);
 DEF_KSTATS(percpu_bookkeeping);
 DEF_KSTATS(tx_reclaim);
 DEF_KSTATS(tx_send);
@@ -52,6 +52,8 @@ DEF_KSTATS(timer_tcp_retransmit);
 DEF_KSTATS(timer_tcp_persist);
 DEF_KSTATS(bsys_dispatch_one);
 DEF_KSTATS(bsys_tcp_accept);
+DEF_KSTATS(bsys_tcp_acceptv);
+DEF_KSTATS(bsys_tcp_admit);
 DEF_KSTATS(bsys_tcp_close);
 DEF_KSTATS(bsys_tcp_connect);
 DEF_KSTATS(bsys_tcp_recv_done);
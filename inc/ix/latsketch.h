@@ -0,0 +1,153 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * latsketch.h - mergeable relative-error latency sketch
+ *
+ * Values are counted in a log-linear histogram: each power of two is
+ * split into 2^LATSKETCH_SUB_BITS buckets, so a quantile is off by at
+ * most 1/2^LATSKETCH_SUB_BITS of its value. Insertion is O(1) and a
+ * sketch has a single writer; readers merge sketches by adding buckets,
+ * without locks. All counters only grow, so the sketch of an interval
+ * is the difference of two snapshots (modulo 2^32 per bucket).
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define LATSKETCH_SUB_BITS	4
+#define LATSKETCH_MAX_BITS	36
+#define LATSKETCH_BUCKETS \
+	((LATSKETCH_MAX_BITS - LATSKETCH_SUB_BITS + 1) << LATSKETCH_SUB_BITS)
+
+struct latsketch {
+	uint64_t count;
+	uint64_t sum;
+	uint32_t bucket[LATSKETCH_BUCKETS];
+} __attribute__((aligned(64)));
+
+/**
+ * latsketch_bucket - maps a value to its bucket
+ * @val: the value
+ */
+static inline int latsketch_bucket(uint64_t val)
+{
+	int msb;
+
+	if (val < (1UL << LATSKETCH_SUB_BITS))
+		return val;
+
+	msb = 63 - __builtin_clzl(val);
+	if (msb >= LATSKETCH_MAX_BITS)
+		return LATSKETCH_BUCKETS - 1;
+
+	return ((msb - LATSKETCH_SUB_BITS + 1) << LATSKETCH_SUB_BITS) |
+	       ((val >> (msb - LATSKETCH_SUB_BITS)) &
+		((1 << LATSKETCH_SUB_BITS) - 1));
+}
+
+/**
+ * latsketch_value - the smallest value that maps to a bucket
+ * @bucket: the bucket
+ */
+static inline uint64_t latsketch_value(int bucket)
+{
+	int shift;
+
+	if (bucket < (1 << LATSKETCH_SUB_BITS))
+		return bucket;
+
+	shift = (bucket >> LATSKETCH_SUB_BITS) - 1;
+	return (uint64_t) ((1 << LATSKETCH_SUB_BITS) |
+			   (bucket & ((1 << LATSKETCH_SUB_BITS) - 1))) << shift;
+}
+
+/**
+ * latsketch_add - records a value
+ * @s: the sketch, owned by the caller's core
+ * @val: the value
+ */
+static inline void latsketch_add(volatile struct latsketch *s, uint64_t val)
+{
+	s->bucket[latsketch_bucket(val)]++;
+	s->sum += val;
+	s->count++;
+}
+
+/**
+ * latsketch_merge - adds (or subtracts) a sketch into another
+ * @dst: the destination sketch, private to the caller
+ * @src: the source sketch, possibly being updated concurrently
+ * @sign: 1 to merge, -1 to take the difference to an older snapshot
+ *
+ * A concurrent writer can only make @src newer, never inconsistent:
+ * each bucket is read once and counts values that were recorded.
+ */
+static inline void latsketch_merge(struct latsketch *dst,
+				   const volatile struct latsketch *src,
+				   int sign)
+{
+	int i;
+
+	dst->count += sign * src->count;
+	dst->sum += sign * src->sum;
+	for (i = 0; i < LATSKETCH_BUCKETS; i++)
+		dst->bucket[i] += sign * src->bucket[i];
+}
+
+/**
+ * latsketch_quantile - estimates a quantile
+ * @s: the sketch
+ * @q: the quantile, between 0 and 1
+ *
+ * Returns the midpoint of the bucket holding the quantile, or 0 if the
+ * sketch is empty. Values beyond 2^LATSKETCH_MAX_BITS are reported as
+ * 2^LATSKETCH_MAX_BITS.
+ */
+static inline uint64_t latsketch_quantile(const struct latsketch *s, double q)
+{
+	uint64_t total = 0, target, sum = 0;
+	int i;
+
+	/* the buckets, not count, are authoritative for a merged sketch */
+	for (i = 0; i < LATSKETCH_BUCKETS; i++)
+		total += s->bucket[i];
+	if (!total)
+		return 0;
+
+	target = q * total;
+	if (target >= total)
+		target = total - 1;
+
+	for (i = 0; i < LATSKETCH_BUCKETS - 1; i++) {
+		sum += s->bucket[i];
+		if (sum > target)
+			break;
+	}
+
+	if (i == LATSKETCH_BUCKETS - 1)
+		return latsketch_value(i);
+
+	return (latsketch_value(i) + latsketch_value(i + 1)) / 2;
+}
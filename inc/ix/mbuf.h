@@ -83,12 +83,31 @@ struct mbuf {
 	void (*done)(struct mbuf *m);  /* called on free */
 	unsigned long done_data; /* extra data to pass to done() */
 	unsigned long timestamp; /* receive timestamp (in CPU clock ticks) */
+	struct mempool *pool;	/* the memory pool that owns the mbuf */
 };
 
 #define MBUF_HEADER_LEN		64	/* one cache line */
+#define MBUF_SMALL_DATA_LEN	256	/* 256 B */
 #define MBUF_DATA_LEN		2048	/* 2 KB */
+#define MBUF_JUMBO_DATA_LEN	9216	/* 9 KB */
 #define MBUF_LEN		(MBUF_HEADER_LEN + MBUF_DATA_LEN)
 
+/*
+ * mbuf size classes, ordered by increasing data length. Each class is
+ * backed by its own datastore. The jumbo class only exists if the
+ * configured MTU requires it.
+ */
+enum {
+	MBUF_CLASS_SMALL = 0,	/* headers, ACKs and small RPCs */
+	MBUF_CLASS_DEFAULT,	/* standard ethernet frames */
+	MBUF_CLASS_JUMBO,	/* jumbo frames */
+	MBUF_NR_CLASSES,
+};
+
+extern const size_t mbuf_class_data_len[MBUF_NR_CLASSES];
+extern int mbuf_nr_classes;
+extern int mbuf_rx_class;
+
 /* Offload flag bits */
 #define PKT_TX_IP_CKSUM      0x1000 /**< IP cksum of TX pkt. computed by NIC. */
 #define PKT_TX_TCP_CKSUM     0x2000 /**< TCP cksum of TX pkt. computed by NIC. */
@@ -149,7 +168,7 @@ struct mbuf {
  *
  * Returns an address.
  */
-#define mbuf_to_iomap(mbuf, pos) mempool_pagemem_to_iomap(&percpu_get(mbuf_mempool), pos)
+#define mbuf_to_iomap(mbuf, pos) mempool_pagemem_to_iomap((mbuf)->pool, pos)
 
 /**
  * iomap_to_mbuf - determines the mbuf pointer based on the IOMAP address
@@ -160,9 +179,29 @@ struct mbuf {
  */
 #define iomap_to_mbuf(pool, pos) mempool_iomap_to_ptr(pool, pos)
 
+extern struct mbuf *mbuf_from_iomap(void *iomap);
+
 extern void mbuf_default_done(struct mbuf *m);
 
-DECLARE_PERCPU(struct mempool, mbuf_mempool);
+DECLARE_PERCPU(struct mempool, mbuf_mempool[MBUF_NR_CLASSES]);
+
+/**
+ * mbuf_class_fit - finds the smallest size class that can hold some data
+ * @len: the number of data bytes
+ *
+ * Returns a size class, or -1 if no class is large enough.
+ */
+static inline int mbuf_class_fit(size_t len)
+{
+	int cls;
+
+	for (cls = 0; cls < mbuf_nr_classes; cls++) {
+		if (len <= mbuf_class_data_len[cls])
+			return cls;
+	}
+
+	return -1;
+}
 
 /**
  * mbuf_alloc - allocate an mbuf from a memory pool
@@ -178,17 +217,30 @@ static inline struct mbuf *mbuf_alloc(struct mempool *pool)
 
 	m->next = NULL;
 	m->done = &mbuf_default_done;
+	m->pool = pool;
 
 	return m;
 }
 
+extern void mbuf_free_remote(struct mbuf *m);
+
 /**
  * mbuf_free - frees an mbuf
  * @m: the mbuf
+ *
+ * The mbuf is returned to the memory pool it was allocated from. If that
+ * pool belongs to another core, the mbuf is queued on a return path that
+ * the owning core drains during its bookkeeping.
  */
 static inline void mbuf_free(struct mbuf *m)
 {
-	mempool_free(&percpu_get(mbuf_mempool), m);
+	uintptr_t off = (uintptr_t) m->pool -
+			(uintptr_t) percpu_get_addr(mbuf_mempool);
+
+	if (likely(off < sizeof(struct mempool) * MBUF_NR_CLASSES))
+		mempool_free(m->pool, m);
+	else
+		mbuf_free_remote(m);
 }
 
 /**
@@ -212,18 +264,47 @@ static inline void mbuf_xmit_done(struct mbuf *m)
 }
 
 /**
- * mbuf_alloc_local - allocate an mbuf from the core-local mempool
+ * mbuf_alloc_local_class - allocate an mbuf of a size class from the
+ * core-local mempool
+ * @cls: the size class
+ *
+ * Returns an mbuf, or NULL if out of memory.
+ */
+static inline struct mbuf *mbuf_alloc_local_class(int cls)
+{
+	return mbuf_alloc(&percpu_get(mbuf_mempool[cls]));
+}
+
+/**
+ * mbuf_alloc_local - allocate a default-sized mbuf from the core-local mempool
  *
  * Returns an mbuf, or NULL if out of memory.
  */
 static inline struct mbuf *mbuf_alloc_local(void)
 {
-	return mbuf_alloc(&percpu_get(mbuf_mempool));
+	return mbuf_alloc_local_class(MBUF_CLASS_DEFAULT);
+}
+
+/**
+ * mbuf_alloc_fit - allocate the smallest core-local mbuf that fits
+ * @len: the number of data bytes needed
+ *
+ * Returns an mbuf, or NULL if out of memory or @len is too large.
+ */
+static inline struct mbuf *mbuf_alloc_fit(size_t len)
+{
+	int cls = mbuf_class_fit(len);
+
+	if (unlikely(cls < 0))
+		return NULL;
+
+	return mbuf_alloc_local_class(cls);
 }
 
 extern int mbuf_init(void);
 extern int mbuf_init_cpu(void);
 extern void mbuf_exit_cpu(void);
+extern void mbuf_do_bookkeeping(void);
 
 /*
  * direct dispatches into network stack
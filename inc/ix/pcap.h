@@ -0,0 +1,145 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * pcap.h - sampled packet capture and pcap file replay
+ *
+ * Capture: each core copies the first PCAP_SNAPLEN bytes of selected RX
+ * and TX frames into its own ring in the "/ix-pcap" shared memory, where
+ * ix-pcap drains them into a pcap file. The filter (1-in-N sampling,
+ * IP address, L4 port, direction) lives in cp_shmem->pcap and is sampled
+ * once per bpoll, so a disabled capture costs a single test of a per-cpu
+ * word per packet.
+ *
+ * Replay: a pcap file named in the configuration is injected into the
+ * local RX queues at its recorded timing (optionally accelerated). Each
+ * core only injects the frames whose flow group it owns.
+ */
+
+#pragma once
+
+#include <ix/config.h>
+#include <ix/stddef.h>
+#include <ix/cpu.h>
+
+#define PCAP_RING_SIZE		4096	/* records per core, power of two */
+#define PCAP_SNAPLEN		256	/* bytes kept of each frame */
+
+#define PCAP_DIR_RX		0x1
+#define PCAP_DIR_TX		0x2
+
+/* the control plane's capture settings, in cp_shmem */
+struct pcap_filter {
+	uint32_t sample;	/* capture 1 in @sample frames, 0 disables */
+	uint32_t dirs;		/* PCAP_DIR_* */
+	uint32_t ip;		/* source or destination, host order, 0: any */
+	uint16_t port;		/* source or destination, host order, 0: any */
+};
+
+struct pcap_rec {
+	uint64_t tsc;
+	uint32_t len;		/* original length of the frame */
+	uint16_t caplen;	/* bytes stored in @data */
+	uint16_t dir;		/* PCAP_DIR_* */
+	uint8_t data[PCAP_SNAPLEN];
+};
+
+struct ix_pcap_ring {
+	volatile uint64_t head;	/* total records ever written */
+	struct pcap_rec rec[PCAP_RING_SIZE];
+} __aligned(64);
+
+struct ix_pcap {
+	uint32_t cpus;
+	uint32_t cycles_per_us;
+	uint32_t ring_size;
+	uint32_t snaplen;
+	uint64_t base_tsc;	/* rdtsc() at ... */
+	uint64_t base_ns;	/* ... this CLOCK_REALTIME, for timestamps */
+	struct ix_pcap_ring ring[];
+} __aligned(64);
+
+/* pcap file format */
+#define PCAP_MAGIC_US		0xa1b2c3d4
+#define PCAP_MAGIC_NS		0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET	1
+
+struct pcap_file_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_pkt_hdr {
+	uint32_t ts_sec;
+	uint32_t ts_frac;	/* microseconds or nanoseconds, see magic */
+	uint32_t caplen;
+	uint32_t len;
+};
+
+#if CONFIG_PCAP
+
+struct mbuf;
+
+DECLARE_PERCPU(uint32_t, pcap_sample);
+
+extern int pcap_init(void);
+extern void pcap_refresh(void);
+extern void __pcap_capture(int dir, struct mbuf *pkt);
+extern int pcap_replay_poll(void);
+
+/**
+ * pcap_active - determines whether the local core is sampling frames
+ */
+static inline bool pcap_active(void)
+{
+	return percpu_get(pcap_sample) != 0;
+}
+
+/**
+ * pcap_capture - offers a frame to the packet capture
+ * @dir: PCAP_DIR_RX or PCAP_DIR_TX
+ * @pkt: the frame
+ */
+static inline void pcap_capture(int dir, struct mbuf *pkt)
+{
+	if (likely(!percpu_get(pcap_sample)))
+		return;
+
+	__pcap_capture(dir, pkt);
+}
+
+#else /* CONFIG_PCAP */
+
+struct mbuf;
+
+static inline void pcap_refresh(void) { }
+static inline bool pcap_active(void) { return false; }
+static inline void pcap_capture(int dir, struct mbuf *pkt) { }
+static inline int pcap_replay_poll(void) { return 0; }
+
+#endif /* CONFIG_PCAP */
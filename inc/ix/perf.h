@@ -1,5 +1,10 @@
 #pragma once
 
+#include <stdint.h>
+
 long read_perf_event(int fd);
 
 int init_perf_event(struct perf_event_attr *attr);
+
+int init_perf_event_rdpmc(struct perf_event_attr *attr, unsigned int *counter,
+			  uint64_t *width_mask);
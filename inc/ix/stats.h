@@ -4,7 +4,9 @@
 #include <ix/cpu.h>
 
 #define STATS \
-	COUNTER(llc_load_misses)
+	COUNTER(llc_load_misses) \
+	COUNTER(mbuf_remote_free) \
+	COUNTER(mbuf_remote_return)
 
 #if CONFIG_STATS
 
@@ -54,6 +54,11 @@ struct sg_entry {
 
 typedef long hid_t;
 
+struct accept_entry {
+	hid_t handle;
+	unsigned long cookie;
+};
+
 enum {
 	RET_OK		= 0, /* Successful                 */
 	RET_NOMEM	= 1, /* Out of memory              */
@@ -82,6 +87,7 @@ enum {
 	SYS_NRCPUS,
 	SYS_TIMER_INIT,
 	SYS_TIMER_CTL,
+	SYS_BRING,
 	SYS_NR,
 };
 
@@ -131,6 +137,20 @@ struct bsys_arr {
 	struct bsys_desc descs[];
 };
 
+/*
+ * The submission ring is a per-cpu area shared between the application
+ * and the kernel. The application appends descriptors to @sq, and each
+ * SYS_BPOLL or SYS_BCALL executes those between @head and @sq.len before
+ * advancing @head to match. Return values are written in place (see
+ * struct bsys_ret). The application resets both indices to zero once it
+ * has handled the returns.
+ */
+struct bsys_ring {
+	unsigned long head;
+	unsigned long pad[7];
+	struct bsys_arr sq;
+};
+
 /**
  * __bsys_arr_next - get the next free descriptor
  * @a: the syscall array
@@ -172,6 +192,9 @@ enum {
 	KSYS_TCP_SENDV,
 	KSYS_TCP_RECV_DONE,
 	KSYS_TCP_CLOSE,
+	KSYS_LAT_RECORD,
+	KSYS_TCP_ACCEPTV,
+	KSYS_TCP_ADMIT,
 	KSYS_NR,
 };
 
@@ -310,6 +333,47 @@ ksys_tcp_close(struct bsys_desc *d, hid_t handle)
 	BSYS_DESC_1ARG(d, KSYS_TCP_CLOSE, handle);
 }
 
+/**
+ * ksys_lat_record - reports the latency of an application request
+ * @d: the syscall descriptor to program
+ * @ns: the latency in nanoseconds
+ *
+ * The sample is added to the per-core sketch read by the control plane.
+ */
+static inline void
+ksys_lat_record(struct bsys_desc *d, uint64_t ns)
+{
+	BSYS_DESC_1ARG(d, KSYS_LAT_RECORD, ns);
+}
+
+/**
+ * ksys_tcp_acceptv - accept a batch of TCP connection requests
+ * @d: the syscall descriptor to program
+ * @ents: an array of handle and cookie pairs
+ * @nrents: the number of pairs
+ */
+static inline void
+ksys_tcp_acceptv(struct bsys_desc *d, struct accept_entry *ents,
+		 unsigned int nrents)
+{
+	BSYS_DESC_2ARG(d, KSYS_TCP_ACCEPTV, ents, nrents);
+}
+
+/**
+ * ksys_tcp_admit - limit the connections held open on a listening port
+ * @d: the syscall descriptor to program
+ * @port: the listening port
+ * @limit: the maximum number of connections, or zero for no limit
+ *
+ * NOTE: Connections beyond the limit are reset by the kernel without a
+ * knock event. Connections count against the limit until they are closed.
+ */
+static inline void
+ksys_tcp_admit(struct bsys_desc *d, uint16_t port, unsigned int limit)
+{
+	BSYS_DESC_2ARG(d, KSYS_TCP_ADMIT, port, limit);
+}
+
 
 /*
  * Commands that can be sent from the kernel to the user-level application.
@@ -324,12 +388,15 @@ enum {
 	USYS_TCP_SENT,
 	USYS_TCP_DEAD,
 	USYS_TIMER,
+	USYS_TCP_RECVV,
 	USYS_NR,
 };
 
 #ifdef __KERNEL__
 
 DECLARE_PERCPU(struct bsys_arr *, usys_arr);
+DECLARE_PERCPU(unsigned long, usys_sg_len);
+DECLARE_PERCPU(unsigned long, usys_sealed);
 DECLARE_PERCPU(unsigned long, syscall_cookie);
 
 /**
@@ -340,6 +407,18 @@ DECLARE_PERCPU(unsigned long, syscall_cookie);
 static inline void usys_reset(void)
 {
 	percpu_get(usys_arr)->len = 0;
+	percpu_get(usys_sg_len) = 0;
+	percpu_get(usys_sealed) = 0;
+}
+
+/**
+ * usys_seal - prevents changes to the events already in the array
+ *
+ * Call this when the application may have started handling the events.
+ */
+static inline void usys_seal(void)
+{
+	percpu_get(usys_sealed) = percpu_get(usys_arr)->len;
 }
 
 /**
@@ -405,17 +484,33 @@ usys_tcp_knock(hid_t handle, struct ip_tuple *id)
 	BSYS_DESC_2ARG(d, USYS_TCP_KNOCK, handle, id);
 }
 
+extern bool usys_tcp_recv_merge(struct bsys_desc *d, void *addr, size_t len);
+
 /**
  * usys_tcp_recv - receive TCP data
  * @handle: the TCP flow handle
  * @cookie: a user-level tag for the flow
  * @addr: the address of the received data
  * @len: the length of the received data
+ *
+ * Data that directly follows a receive event for the same flow is merged
+ * into that event, which becomes a USYS_TCP_RECVV scatter-gather list.
  */
 static inline void
 usys_tcp_recv(hid_t handle, unsigned long cookie, void *addr, size_t len)
 {
-	struct bsys_desc *d = usys_next();
+	struct bsys_arr *a = percpu_get(usys_arr);
+	struct bsys_desc *d;
+
+	if (a->len > percpu_get(usys_sealed)) {
+		d = &a->descs[a->len - 1];
+		if ((d->sysnr == USYS_TCP_RECV || d->sysnr == USYS_TCP_RECVV) &&
+		    d->arga == (uint64_t) handle && d->argb == cookie &&
+		    usys_tcp_recv_merge(d, addr, len))
+			return;
+	}
+
+	d = usys_next();
 	BSYS_DESC_4ARG(d, USYS_TCP_RECV, handle, cookie, addr, len);
 }
 
@@ -479,12 +574,16 @@ extern long bsys_udp_recv_done(void *iomap);
 extern long bsys_tcp_connect(struct ip_tuple __user *id,
 			     unsigned long cookie);
 extern long bsys_tcp_accept(hid_t handle, unsigned long cookie);
+extern long bsys_tcp_acceptv(struct accept_entry __user *ents,
+			     unsigned int nrents);
+extern long bsys_tcp_admit(uint16_t port, unsigned int limit);
 extern long bsys_tcp_reject(hid_t handle);
 extern ssize_t bsys_tcp_send(hid_t handle, void *addr, size_t len);
 extern ssize_t bsys_tcp_sendv(hid_t handle, struct sg_entry __user *ents,
 			      unsigned int nrents);
 extern long bsys_tcp_recv_done(hid_t handle, size_t len);
 extern long bsys_tcp_close(hid_t handle);
+extern long bsys_lat_record(uint64_t ns);
 
 struct dune_tf;
 extern void do_syscall(struct dune_tf *tf, uint64_t sysnr);
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * trace.h - per-core binary flight recorder
+ *
+ * Each core appends fixed-size records to its own ring in the
+ * "/ix-trace" shared memory. Recording is off until the control plane
+ * sets bits in cp_shmem->trace_mask; the mask is sampled once per
+ * bpoll, so a disabled event costs a single test of a per-cpu word.
+ */
+
+#pragma once
+
+#include <ix/config.h>
+#include <ix/stddef.h>
+#include <ix/cpu.h>
+#include <asm/cpu.h>
+
+#define TRACE_RING_SIZE		16384	/* records per core, power of two */
+
+enum trace_type {
+	TRACE_BPOLL_ENTER = 0,	/* arg: number of batched system calls */
+	TRACE_BPOLL_EXIT,	/* arg: number of events returned */
+	TRACE_RX_BATCH,		/* arg: packets processed */
+	TRACE_TIMER,		/* arg: flow group of the timer */
+	TRACE_MIGRATE_START,	/* arg: target cpu */
+	TRACE_MIGRATE_END,	/* arg: packets replayed at the target */
+	TRACE_IDLE_ENTER,
+	TRACE_IDLE_EXIT,
+	TRACE_DROP,		/* arg: enum trace_drop_reason */
+	TRACE_NR_TYPES,
+};
+
+enum trace_drop_reason {
+	TRACE_DROP_FG_TRANSITION = 0,
+	TRACE_DROP_NOBUFS,
+};
+
+struct trace_rec {
+	uint64_t tsc;
+	uint32_t type;
+	uint32_t arg;
+};
+
+struct ix_trace_ring {
+	volatile uint64_t head;	/* total records ever written */
+	struct trace_rec rec[TRACE_RING_SIZE];
+} __aligned(64);
+
+struct ix_trace {
+	uint32_t cpus;
+	uint32_t cycles_per_us;
+	uint32_t ring_size;
+	struct ix_trace_ring ring[];
+} __aligned(64);
+
+#if CONFIG_TRACE
+
+DECLARE_PERCPU(uint32_t, trace_mask);
+DECLARE_PERCPU(struct ix_trace_ring *, trace_ring);
+
+extern int trace_init(void);
+extern void trace_refresh(void);
+
+/**
+ * trace_event - records an event in the local flight recorder
+ * @type: the event type
+ * @arg: an event specific argument
+ */
+static inline void trace_event(enum trace_type type, uint32_t arg)
+{
+	struct ix_trace_ring *ring;
+	struct trace_rec *rec;
+
+	if (likely(!(percpu_get(trace_mask) & (1 << type))))
+		return;
+
+	ring = percpu_get(trace_ring);
+	rec = &ring->rec[ring->head & (TRACE_RING_SIZE - 1)];
+	rec->tsc = rdtsc();
+	rec->type = type;
+	rec->arg = arg;
+	asm volatile("" ::: "memory");
+	ring->head++;
+}
+
+#else /* CONFIG_TRACE */
+
+static inline void trace_refresh(void) { }
+static inline void trace_event(enum trace_type type, uint32_t arg) { }
+
+#endif /* CONFIG_TRACE */
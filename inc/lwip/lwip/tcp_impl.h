@@ -523,6 +523,7 @@ static inline void TCP_REG_ACTIVE(struct tcp_pcb *npcb, int idx, struct eth_fg *
 	
 	TCP_REG(&he->pcbs, npcb,cur_fg);
 	cur_fg->tcp_active_pcb_changed = 1;					
+	cur_fg->tcp_active_pcbs++;
 }
 
 
@@ -530,12 +531,14 @@ static inline void TCP_REG_ACTIVE(struct tcp_pcb *npcb, int idx, struct eth_fg *
   do {                                             \
     TCP_RMV(&perfg_get(tcp_active_pcbs), npcb);               \
     cur_fg->tcp_active_pcb_changed = 1;                   \
+    cur_fg->tcp_active_pcbs--;                            \
   } while (0)
 
 #define TCP_PCB_REMOVE_ACTIVE(pcb)                 \
   do {                                             \
 	  tcp_pcb_remove(cur_fg,pcb);			  \
     cur_fg->tcp_active_pcb_changed = 1;                   \
+    cur_fg->tcp_active_pcbs--;                            \
   } while (0)
 
 
@@ -40,6 +40,7 @@
 #define ETH_MAX_LEN		1518
 #define	ETH_MAX_LEN_JUMBO	9018	/* max jumbo frame len, including CRC */
 #define ETH_MTU			1500
+#define ETH_MIN_MTU		576	/* minimum IPv4 datagram size (RFC 791) */
 
 struct eth_addr {
 	uint8_t addr[ETH_ADDR_LEN];
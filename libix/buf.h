@@ -30,47 +30,124 @@
 #include <ix/stddef.h>
 #include <mempool.h>
 
+#include <emmintrin.h>
 #include <pthread.h>
 #include <string.h>
 
+/* the defaults of struct ixev_conf */
+#define IXEV_BUF_SIZE		(1460 * 4)
+#define IXEV_NR_BUFS		131072
+#define IXEV_EXTENT_SIZE	65536
+#define IXEV_NR_EXTENTS		2048
+#define IXEV_NT_THRESHOLD	16384
 
-#define BUF_SIZE	1460 * 4
-
+extern uint32_t ixev_buf_size;
+extern uint32_t ixev_extent_size;
+extern size_t ixev_nt_threshold;
 extern __thread struct mempool ixev_buf_pool;
+extern __thread struct mempool ixev_extent_pool;
 
+/*
+ * A send buffer comes either from the pool of small buffers or, for
+ * large sends, from the pool of extents. The buffers filled by one send
+ * are chained through @prev and released together by the @ref of the
+ * last one.
+ */
 struct ixev_buf {
 	uint32_t len;
-	uint32_t pad;
+	uint32_t size;			/* the payload capacity */
+	struct ixev_buf *prev;		/* the previous buffer of the send */
 	struct ixev_ref ref;
-	char payload[BUF_SIZE];
+	char payload[];
 };
 
+static inline void ixev_buf_free(struct ixev_buf *buf)
+{
+	if (buf->size == ixev_extent_size)
+		mempool_free(&ixev_extent_pool, buf);
+	else
+		mempool_free(&ixev_buf_pool, buf);
+}
+
 static inline void ixev_buf_release(struct ixev_ref *ref)
 {
 	struct ixev_buf *buf = container_of(ref, struct ixev_buf, ref);
-	mempool_free(&ixev_buf_pool, buf);
+	struct ixev_buf *prev;
+
+	for (; buf; buf = prev) {
+		prev = buf->prev;
+		ixev_buf_free(buf);
+	}
 }
 
 /**
  * ixev_buf_alloc - allocates a buffer
+ * @want: the number of bytes the caller has left to store
  *
- * The initial refcount is set to one.
+ * An extent is used if @want does not fit in a small buffer, as long as
+ * there are extents left.
  *
  * Returns a buffer, or NULL if out of memory.
  */
-static inline struct ixev_buf *ixev_buf_alloc(void)
+static inline struct ixev_buf *ixev_buf_alloc(size_t want)
 {
-	struct ixev_buf *buf = mempool_alloc(&ixev_buf_pool);
+	struct ixev_buf *buf = NULL;
 
-	if (unlikely(!buf))
-		return NULL;
+	if (want > ixev_buf_size) {
+		buf = mempool_alloc(&ixev_extent_pool);
+		if (buf)
+			buf->size = ixev_extent_size;
+	}
+
+	if (!buf) {
+		buf = mempool_alloc(&ixev_buf_pool);
+		if (unlikely(!buf))
+			return NULL;
+		buf->size = ixev_buf_size;
+	}
 
 	buf->len = 0;
+	buf->prev = NULL;
 	buf->ref.cb = &ixev_buf_release;
 
 	return buf;
 }
 
+/**
+ * ixev_copy_nt - copies data with non-temporal stores
+ * @dst: the destination
+ * @src: the source
+ * @len: the length of the data
+ *
+ * Payload is only read again by the NIC, so large copies bypass the
+ * cache instead of evicting the application's working set. The stores
+ * are fenced before returning.
+ */
+static inline void ixev_copy_nt(char *dst, const char *src, size_t len)
+{
+	size_t head = min(-(uintptr_t) dst & 15, len);
+	__m128i a, b, c, d;
+
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	len -= head;
+
+	for (; len >= 64; len -= 64, dst += 64, src += 64) {
+		a = _mm_loadu_si128((const __m128i *) src);
+		b = _mm_loadu_si128((const __m128i *) (src + 16));
+		c = _mm_loadu_si128((const __m128i *) (src + 32));
+		d = _mm_loadu_si128((const __m128i *) (src + 48));
+		_mm_stream_si128((__m128i *) dst, a);
+		_mm_stream_si128((__m128i *) (dst + 16), b);
+		_mm_stream_si128((__m128i *) (dst + 32), c);
+		_mm_stream_si128((__m128i *) (dst + 48), d);
+	}
+
+	memcpy(dst, src, len);
+	_mm_sfence();
+}
+
 /**
  * ixev_buf_store - store data inside a buffer
  * @buf: the buffer
@@ -82,12 +159,15 @@ static inline struct ixev_buf *ixev_buf_alloc(void)
  */
 static inline size_t ixev_buf_store(struct ixev_buf *buf, void *addr, size_t len)
 {
-	size_t avail = min(len, BUF_SIZE - buf->len);
+	size_t avail = min(len, buf->size - buf->len);
 
 	if (!avail)
 		return 0;
 
-	memcpy(&buf->payload[buf->len], addr, avail);
+	if (avail >= ixev_nt_threshold)
+		ixev_copy_nt(&buf->payload[buf->len], addr, avail);
+	else
+		memcpy(&buf->payload[buf->len], addr, avail);
 	buf->len += avail;
 
 	return avail;
@@ -101,7 +181,5 @@ static inline size_t ixev_buf_store(struct ixev_buf *buf, void *addr, size_t len
  */
 static inline bool ixev_is_buf_full(struct ixev_buf *buf)
 {
-	return buf->len == BUF_SIZE;
+	return buf->len == buf->size;
 }
-
-
@@ -37,13 +37,18 @@ struct ix_ops {
 	void (*tcp_knock)(hid_t handle, struct ip_tuple *id);
 	void (*tcp_recv)(hid_t handle, unsigned long cookie,
 			 void *addr, size_t len);
+	/* optional, tcp_recv is called per entry otherwise */
+	void (*tcp_recvv)(hid_t handle, unsigned long cookie,
+			  struct sg_entry *ents, unsigned int nrents);
 	void (*tcp_sent)(hid_t handle, unsigned long cookie,
 			 size_t win_size);
 	void (*tcp_dead)(hid_t handle, unsigned long cookie);
 	void (*timer_event)(unsigned long cookie);
+	void (*flushed)(struct bsys_desc *descs, unsigned int nr);
 };
 
 extern void ix_flush(void);
+extern __thread struct bsys_ring *kring;
 extern __thread struct bsys_arr *karr;
 
 static inline int ix_bsys_idx(void)
@@ -51,6 +56,17 @@ static inline int ix_bsys_idx(void)
 	return karr->len;
 }
 
+/**
+ * ix_bsys_reset - recycles the command batch
+ *
+ * Must be called once the return values of the batch have been handled.
+ */
+static inline void ix_bsys_reset(void)
+{
+	karr->len = 0;
+	kring->head = 0;
+}
+
 static inline void ix_udp_send(void *addr, size_t len, struct ip_tuple *id,
 			       unsigned long cookie)
 {
@@ -134,6 +150,31 @@ static inline void ix_tcp_close(hid_t handle)
 	ksys_tcp_close(__bsys_arr_next(karr), handle);
 }
 
+static inline void ix_tcp_acceptv(struct accept_entry *ents,
+				  unsigned int nrents)
+{
+	if (karr->len >= karr->max_len)
+		ix_flush();
+
+	ksys_tcp_acceptv(__bsys_arr_next(karr), ents, nrents);
+}
+
+static inline void ix_tcp_admit(uint16_t port, unsigned int limit)
+{
+	if (karr->len >= karr->max_len)
+		ix_flush();
+
+	ksys_tcp_admit(__bsys_arr_next(karr), port, limit);
+}
+
+static inline void ix_lat_record(uint64_t ns)
+{
+	if (karr->len >= karr->max_len)
+		ix_flush();
+
+	ksys_lat_record(__bsys_arr_next(karr), ns);
+}
+
 extern void *ix_alloc_pages(int nrpages);
 extern void ix_free_pages(void *addr, int nrpages);
 
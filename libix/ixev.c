@@ -28,6 +28,7 @@
 #include <ix/stddef.h>
 #include <mempool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 
 #include "ixev.h"
@@ -35,15 +36,47 @@
 #include "ixev_timer.h"
 
 #define CMD_BATCH_SIZE	4096
+#define IXEV_EXTENT_CHUNK	8
 
-/* FIXME: implement automatic TCP Buffer Tuning, Jeffrey Semke et. al. */
-#define IXEV_SEND_WIN_SIZE	65536
+/*
+ * Send windows are tuned per connection, along the lines of "Automatic
+ * TCP Buffer Tuning", Jeffrey Semke et. al.: once a window's worth of
+ * data has been acknowledged, or everything sent so far, a connection
+ * that was held back by its window (and not by the kernel) doubles it,
+ * and one that used less than half of it shrinks to twice what it did
+ * use. Growth beyond IXEV_SEND_WIN_MIN is charged to a per-thread
+ * budget, which bounds the ixev_buf memory the connections of a thread
+ * can hold.
+ */
+#define IXEV_SEND_WIN_MIN	16384
+#define IXEV_SEND_WIN_INIT	65536
+#define IXEV_SEND_WIN_MAX	(4 * 1024 * 1024)
+#define IXEV_SEND_BUDGET	(64 * 1024 * 1024)
 
 static __thread uint64_t ixev_generation;
+
+#define IXEV_ACCEPT_BATCH	256
+
+static __thread struct accept_entry ixev_accepts[IXEV_ACCEPT_BATCH];
+static __thread struct bsys_desc *ixev_accept_desc;
+static __thread uint64_t ixev_accept_generation;
+static __thread struct ixev_ctx *ixev_ready;
+static __thread struct ixev_ctx *ixev_closed;
+static __thread size_t ixev_send_budget = IXEV_SEND_BUDGET;
+static __thread long ixev_send_budget_left = IXEV_SEND_BUDGET;
 static struct ixev_conn_ops ixev_global_ops;
 
 static struct mempool_datastore ixev_buf_datastore;
 __thread struct mempool ixev_buf_pool;
+uint32_t ixev_buf_size;
+
+static struct mempool_datastore ixev_extent_datastore;
+__thread struct mempool ixev_extent_pool;
+uint32_t ixev_extent_size;
+size_t ixev_nt_threshold;
+
+static struct mempool_datastore ixev_recv_datastore;
+static __thread struct mempool ixev_recv_pool;
 
 static inline void __ixev_check_generation(struct ixev_ctx *ctx)
 {
@@ -60,9 +93,12 @@ __ixev_recv_done(struct ixev_ctx *ctx, size_t len)
 	__ixev_check_generation(ctx);
 
 	if (!ctx->recv_done_desc) {
-		ctx->recv_done_desc = __bsys_arr_next(karr);
-		ixev_check_hacks(ctx);
-		ksys_tcp_recv_done(ctx->recv_done_desc, ctx->handle, len);
+		struct bsys_desc *d = __ixev_next_desc();
+
+		/* reserving may have flushed the batch: revalidate */
+		__ixev_check_generation(ctx);
+		ctx->recv_done_desc = d;
+		ksys_tcp_recv_done(d, ctx->handle, len);
 	} else {
 		ctx->recv_done_desc->argb += (uint64_t) len;
 	}
@@ -74,9 +110,12 @@ __ixev_sendv(struct ixev_ctx *ctx, struct sg_entry *ents, unsigned int nrents)
 	__ixev_check_generation(ctx);
 
 	if (!ctx->sendv_desc) {
-		ctx->sendv_desc = __bsys_arr_next(karr);
-		ixev_check_hacks(ctx);
-		ksys_tcp_sendv(ctx->sendv_desc, ctx->handle, ents, nrents);
+		struct bsys_desc *d = __ixev_next_desc();
+
+		/* reserving may have flushed the batch: revalidate */
+		__ixev_check_generation(ctx);
+		ctx->sendv_desc = d;
+		ksys_tcp_sendv(d, ctx->handle, ents, nrents);
 	} else {
 		ctx->sendv_desc->argb = (uint64_t) ents;
 		ctx->sendv_desc->argc = (uint64_t) nrents;
@@ -86,9 +125,7 @@ __ixev_sendv(struct ixev_ctx *ctx, struct sg_entry *ents, unsigned int nrents)
 static inline void
 __ixev_close(struct ixev_ctx *ctx)
 {
-	struct bsys_desc *d = __bsys_arr_next(karr);
-	ixev_check_hacks(ctx);
-	ksys_tcp_close(d, ctx->handle);
+	ksys_tcp_close(__ixev_next_desc(), ctx->handle);
 }
 
 static void ixev_tcp_connected(hid_t handle, unsigned long cookie, long ret)
@@ -98,6 +135,36 @@ static void ixev_tcp_connected(hid_t handle, unsigned long cookie, long ret)
 	ixev_global_ops.dialed(ctx, ret);
 }
 
+/*
+ * The accepts of a generation share one KSYS_TCP_ACCEPTV descriptor,
+ * whose entries stay valid until its return has been handled.
+ */
+static inline void __ixev_accept(struct ixev_ctx *ctx)
+{
+	struct accept_entry *ent;
+
+	if (ixev_accept_generation != ixev_generation) {
+		ixev_accept_generation = ixev_generation;
+		ixev_accept_desc = NULL;
+	}
+
+	if (!ixev_accept_desc) {
+		struct bsys_desc *d = __ixev_next_desc();
+
+		/* reserving may have flushed the batch: revalidate */
+		ixev_accept_generation = ixev_generation;
+		ixev_accept_desc = d;
+		ksys_tcp_acceptv(d, ixev_accepts, 0);
+	} else if (unlikely(ixev_accept_desc->argb == IXEV_ACCEPT_BATCH)) {
+		ix_tcp_accept(ctx->handle, (unsigned long) ctx);
+		return;
+	}
+
+	ent = &ixev_accepts[ixev_accept_desc->argb++];
+	ent->handle = ctx->handle;
+	ent->cookie = (unsigned long) ctx;
+}
+
 static void ixev_tcp_knock(hid_t handle, struct ip_tuple *id)
 {
 	struct ixev_ctx *ctx = ixev_global_ops.accept(id);
@@ -108,7 +175,81 @@ static void ixev_tcp_knock(hid_t handle, struct ip_tuple *id)
 	}
 
 	ctx->handle = handle;
-	ix_tcp_accept(handle, (unsigned long) ctx);
+	__ixev_accept(ctx);
+}
+
+static void ixev_ready_link(struct ixev_ctx **head, struct ixev_ctx *ctx)
+{
+	ctx->ready_next = *head;
+	if (ctx->ready_next)
+		ctx->ready_next->ready_pprev = &ctx->ready_next;
+	ctx->ready_pprev = head;
+	*head = ctx;
+}
+
+static void ixev_ready_unlink(struct ixev_ctx *ctx)
+{
+	if (!ctx->ready_pprev)
+		return;
+
+	*ctx->ready_pprev = ctx->ready_next;
+	if (ctx->ready_next)
+		ctx->ready_next->ready_pprev = ctx->ready_pprev;
+	ctx->ready_pprev = NULL;
+}
+
+static inline void ixev_ready_add(struct ixev_ctx *ctx)
+{
+	if (!ctx->ready_pprev)
+		ixev_ready_link(&ixev_ready, ctx);
+}
+
+/**
+ * ixev_deliver - reports events to the handler of a context
+ * @ctx: the context
+ * @events: the events that occurred
+ *
+ * Level-triggered contexts are only queued here; ixev_run_ready()
+ * reports them once all events of the iteration are in.
+ */
+static void ixev_deliver(struct ixev_ctx *ctx, unsigned int events)
+{
+	unsigned int mask = ctx->en_mask;
+
+	ctx->last_active = ixev_wheel_now;
+
+	if (mask & IXEVLEVEL) {
+		ixev_ready_add(ctx);
+		return;
+	}
+
+	if (!(mask & events)) {
+		ctx->trig_mask |= events;
+		return;
+	}
+
+	if (mask & IXEVONESHOT)
+		ctx->en_mask = 0;
+	ctx->handler(ctx, mask & events);
+}
+
+/**
+ * ixev_deliver_dead - reports that a connection is gone
+ * @ctx: the context
+ *
+ * This is the last event of a context, so all events are disabled.
+ */
+static void ixev_deliver_dead(struct ixev_ctx *ctx)
+{
+	unsigned int mask = ctx->en_mask;
+
+	ctx->en_mask = 0;
+	if (mask & IXEVHUP)
+		ctx->handler(ctx, IXEVHUP);
+	else if (mask & IXEVIN)
+		ctx->handler(ctx, IXEVIN | IXEVHUP);
+	else
+		ctx->trig_mask |= IXEVHUP;
 }
 
 static void ixev_tcp_dead(hid_t handle, unsigned long cookie)
@@ -119,50 +260,165 @@ static void ixev_tcp_dead(hid_t handle, unsigned long cookie)
 		return;
 
 	ctx->is_dead = true;
-	if (ctx->en_mask & IXEVHUP)
-		ctx->handler(ctx, IXEVHUP);
-	else if (ctx->en_mask & IXEVIN)
-		ctx->handler(ctx, IXEVIN | IXEVHUP);
+	ixev_wheel_del(&ctx->timeout_ent);
+
+	if (ctx->en_mask & IXEVLEVEL)
+		ixev_ready_add(ctx);
 	else
-		ctx->trig_mask |= IXEVHUP;
+		ixev_deliver_dead(ctx);
+}
 
-	ctx->en_mask = 0;
+static void ixev_recv_ring_free(struct ixev_ctx *ctx)
+{
+	if (ctx->recv == ctx->recv_inline)
+		return;
+
+	if (ctx->recv_mask + 1 == IXEV_RECV_DEPTH)
+		mempool_free(&ixev_recv_pool, ctx->recv);
+	else
+		free(ctx->recv);
+}
+
+/**
+ * ixev_recv_grow - moves the received data to a ring twice the size
+ * @ctx: the context
+ *
+ * The first overflow ring comes from a per-thread pool; rings beyond
+ * IXEV_RECV_DEPTH entries (or any ring once the pool is empty) are
+ * malloc'd.
+ *
+ * Returns 0 if successful, otherwise -ENOMEM.
+ */
+static int ixev_recv_grow(struct ixev_ctx *ctx)
+{
+	uint32_t i, size = ctx->recv_mask + 1;
+	uint32_t new_size = max(size * 2, (uint32_t) IXEV_RECV_DEPTH);
+	struct sg_entry *ring = NULL;
+
+	if (new_size == IXEV_RECV_DEPTH)
+		ring = mempool_alloc(&ixev_recv_pool);
+	if (!ring) {
+		/* ixev_recv_ring_free() tells pooled rings apart by size */
+		if (new_size == IXEV_RECV_DEPTH)
+			new_size *= 2;
+		ring = malloc(sizeof(struct sg_entry) * new_size);
+		if (!ring)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < size; i++)
+		ring[i] = ctx->recv[(ctx->recv_head + i) & ctx->recv_mask];
+
+	ixev_recv_ring_free(ctx);
+	ctx->recv = ring;
+	ctx->recv_head = 0;
+	ctx->recv_tail = size;
+	ctx->recv_mask = new_size - 1;
+
+	return 0;
+}
+
+/**
+ * ixev_recv_shrink - returns to the inline ring once all data is consumed
+ * @ctx: the context
+ */
+static inline void ixev_recv_shrink(struct ixev_ctx *ctx)
+{
+	if (likely(ctx->recv == ctx->recv_inline) ||
+	    ctx->recv_head != ctx->recv_tail)
+		return;
+
+	ixev_recv_ring_free(ctx);
+	ctx->recv = ctx->recv_inline;
+	ctx->recv_head = 0;
+	ctx->recv_tail = 0;
+	ctx->recv_mask = IXEV_RECV_INLINE - 1;
 }
 
 static void ixev_tcp_recv(hid_t handle, unsigned long cookie,
 			  void *addr, size_t len)
 {
 	struct ixev_ctx *ctx = (struct ixev_ctx *) cookie;
-	uint16_t pos = ((ctx->recv_tail) & (IXEV_RECV_DEPTH - 1));
 	struct sg_entry *ent;
 
-	if (unlikely(ctx->recv_tail - ctx->recv_head + 1 >= IXEV_RECV_DEPTH)) {
-		/*
-		 * FIXME: We've run out of space for received packets. This
-		 * will probably not happen unless the application is
-		 * misbehaving and does not accept new packets for long
-		 * periods of time or if a remote host sends a lot of too
-		 * small packets.
-		 *
-		 * Possible solutions:
-		 * 1.) Start copying into a buffer and accept up to the kernel
-		 * receive window size in data.
-		 * 2.) Allocate more descriptors and leave memory in mbufs, but
-		 * this could waste memory.
-		 */
+	if (unlikely(ctx->recv_tail - ctx->recv_head > ctx->recv_mask) &&
+	    ixev_recv_grow(ctx)) {
 		printf("ixev: ran out of receive memory\n");
 		exit(-1);
 	}
 
-	ent = &ctx->recv[pos];
+	ent = &ctx->recv[ctx->recv_tail & ctx->recv_mask];
 	ent->base = addr;
 	ent->len = len;
 	ctx->recv_tail++;
 
-	if (ctx->en_mask & IXEVIN)
-		ctx->handler(ctx, IXEVIN);
-	else
-		ctx->trig_mask |= IXEVIN;
+	ixev_deliver(ctx, IXEVIN);
+}
+
+static void ixev_tcp_recvv(hid_t handle, unsigned long cookie,
+			   struct sg_entry *ents, unsigned int nrents)
+{
+	struct ixev_ctx *ctx = (struct ixev_ctx *) cookie;
+	unsigned int i;
+
+	while (unlikely(ctx->recv_tail - ctx->recv_head + nrents >
+			ctx->recv_mask + 1)) {
+		if (ixev_recv_grow(ctx)) {
+			printf("ixev: ran out of receive memory\n");
+			exit(-1);
+		}
+	}
+
+	for (i = 0; i < nrents; i++)
+		ctx->recv[ctx->recv_tail++ & ctx->recv_mask] = ents[i];
+
+	/* the whole list is reported as a single event */
+	ixev_deliver(ctx, IXEVIN);
+}
+
+static uint32_t ixev_win_charge(uint32_t want)
+{
+	uint32_t got = min((long) want, max(ixev_send_budget_left, 0L));
+
+	ixev_send_budget_left -= got;
+	return got;
+}
+
+static void ixev_win_reset(struct ixev_ctx *ctx)
+{
+	ixev_send_budget_left += ctx->send_win - IXEV_SEND_WIN_MIN;
+	ctx->send_win = IXEV_SEND_WIN_MIN;
+}
+
+/**
+ * ixev_win_tune - adjusts the send window after an acknowledgment
+ * @ctx: the context
+ * @len: the number of bytes acknowledged
+ */
+static void ixev_win_tune(struct ixev_ctx *ctx, size_t len)
+{
+	uint32_t delta;
+
+	/* a round ends after a window's worth of data or when idle */
+	ctx->win_acked += len;
+	if (ctx->win_acked < ctx->send_win &&
+	    ctx->sent_total != ctx->send_total)
+		return;
+
+	if (ctx->win_limited && !ctx->kernel_limited) {
+		delta = min(ctx->send_win, IXEV_SEND_WIN_MAX - ctx->send_win);
+		ctx->send_win += ixev_win_charge(delta);
+	} else if (ctx->win_peak < ctx->send_win / 2) {
+		delta = ctx->send_win -
+			max(ctx->win_peak * 2, (uint32_t) IXEV_SEND_WIN_MIN);
+		ctx->send_win -= delta;
+		ixev_send_budget_left += delta;
+	}
+
+	ctx->win_acked = 0;
+	ctx->win_peak = 0;
+	ctx->win_limited = false;
+	ctx->kernel_limited = false;
 }
 
 static void ixev_tcp_sent(hid_t handle, unsigned long cookie, size_t len)
@@ -171,6 +427,7 @@ static void ixev_tcp_sent(hid_t handle, unsigned long cookie, size_t len)
 	struct ixev_ref *ref = ctx->ref_head;
 
 	ctx->sent_total += len;
+	ixev_win_tune(ctx, len);
 
 	while (ref && ref->send_pos <= ctx->sent_total) {
 		ref->cb(ref);
@@ -185,26 +442,20 @@ static void ixev_tcp_sent(hid_t handle, unsigned long cookie, size_t len)
 	if (ctx->send_count)
 		__ixev_sendv(ctx, ctx->send, ctx->send_count);
 
-	if (ctx->en_mask & IXEVOUT)
-		ctx->handler(ctx, IXEVOUT);
-	else
-		ctx->trig_mask |= IXEVOUT;
+	ixev_deliver(ctx, IXEVOUT);
 }
 
-static void ixev_timer_event(unsigned long cookie)
-{
-	struct ixev_timer *t = (struct ixev_timer *) cookie;
-
-	t->handler(t->arg);
-}
+static void ixev_handle_rets(struct bsys_desc *descs, unsigned int nr);
 
 static struct ix_ops ixev_ops = {
 	.tcp_connected	= ixev_tcp_connected,
 	.tcp_knock	= ixev_tcp_knock,
 	.tcp_dead	= ixev_tcp_dead,
 	.tcp_recv	= ixev_tcp_recv,
+	.tcp_recvv	= ixev_tcp_recvv,
 	.tcp_sent	= ixev_tcp_sent,
-	.timer_event	= ixev_timer_event,
+	.timer_event	= ixev_wheel_event,
+	.flushed	= ixev_handle_rets,
 };
 
 /**
@@ -225,7 +476,7 @@ ssize_t ixev_recv(struct ixev_ctx *ctx, void *buf, size_t len)
 
 	while (ctx->recv_head != ctx->recv_tail) {
 		struct sg_entry *ent =
-			&ctx->recv[ctx->recv_head & (IXEV_RECV_DEPTH - 1)];
+			&ctx->recv[ctx->recv_head & ctx->recv_mask];
 		size_t left = len - pos;
 
 		if (!left)
@@ -247,6 +498,7 @@ ssize_t ixev_recv(struct ixev_ctx *ctx, void *buf, size_t len)
 	if (!pos)
 		return -EAGAIN;
 
+	ixev_recv_shrink(ctx);
 	__ixev_recv_done(ctx, pos);
 	return pos;
 }
@@ -272,18 +524,20 @@ void *ixev_recv_zc(struct ixev_ctx *ctx, size_t len)
 	struct sg_entry *ent;
 	void *buf;
 
-	if (ctx->is_dead)
+	if (ctx->is_dead || ctx->recv_head == ctx->recv_tail)
 		return NULL;
 
-	ent = &ctx->recv[ctx->recv_head & (IXEV_RECV_DEPTH - 1)];
+	ent = &ctx->recv[ctx->recv_head & ctx->recv_mask];
 	if (len > ent->len)
 		return NULL;
 
 	buf = ent->base;
 	ent->base = (char *) ent->base + len;
 	ent->len -= len;
-	if (!ent->len)
+	if (!ent->len) {
 		ctx->recv_head++;
+		ixev_recv_shrink(ctx);
+	}
 
 	__ixev_recv_done(ctx, len);
 	return buf;
@@ -301,7 +555,14 @@ static struct sg_entry *ixev_next_entry(struct ixev_ctx *ctx)
 
 static void ixev_update_send_stats(struct ixev_ctx *ctx, size_t len)
 {
+	uint32_t in_flight;
+
 	ctx->send_total += len;
+	in_flight = ctx->send_total - ctx->sent_total;
+	if (in_flight > ctx->win_peak)
+		ctx->win_peak = in_flight;
+	if (in_flight >= ctx->send_win)
+		ctx->win_limited = true;
 }
 
 static void __ixev_add_sent_cb(struct ixev_ctx *ctx, struct ixev_ref *ref)
@@ -319,72 +580,119 @@ static void __ixev_add_sent_cb(struct ixev_ctx *ctx, struct ixev_ref *ref)
 
 static size_t ixev_window_len(struct ixev_ctx *ctx, size_t len)
 {
-	size_t win_left = IXEV_SEND_WIN_SIZE -
-			  ctx->send_total + ctx->sent_total;
+	size_t in_flight = ctx->send_total - ctx->sent_total;
+	size_t win_left = 0;
+
+	/* the window may have shrunk below what is already in flight */
+	if (ctx->send_win > in_flight)
+		win_left = ctx->send_win - in_flight;
 
 	return min(win_left, len);
 }
 
 /*
- * ixev_send - send data using copying
+ * ixev_buf_fill - copies data from an iovec into a buffer
+ * @buf: the buffer
+ * @ent: the send entry that covers the end of the buffer
+ * @iov: the current iovec, advanced past the data copied
+ * @off: the offset in the current iovec, advanced as well
+ * @len: the number of bytes left to copy
+ *
+ * Returns the number of bytes copied.
+ */
+static size_t ixev_buf_fill(struct ixev_buf *buf, struct sg_entry *ent,
+			    const struct iovec **iov, size_t *off, size_t len)
+{
+	size_t ret, total = 0;
+
+	while (len && !ixev_is_buf_full(buf)) {
+		if (*off == (*iov)->iov_len) {
+			(*iov)++;
+			*off = 0;
+			continue;
+		}
+
+		ret = ixev_buf_store(buf, (char *) (*iov)->iov_base + *off,
+				     min(len, (*iov)->iov_len - *off));
+		*off += ret;
+		len -= ret;
+		total += ret;
+	}
+
+	ent->len += total;
+	return total;
+}
+
+/*
+ * ixev_sendv - send data from several buffers using copying
  * @ctx: the context
- * @addr: the address of the data
- * @len: the length of the data
+ * @iov: the buffers
+ * @iovcnt: the number of buffers
  *
- * This variant is easier to use but is slower because it must first
- * copy the data to a buffer.
+ * The data is appended to the current send buffer, then copied into
+ * new buffers, preferably extents if it is large. The new buffers of
+ * one call share a single completion reference.
  *
  * Returns the number of bytes sent, or <0 if there was an error.
  */
-ssize_t ixev_send(struct ixev_ctx *ctx, void *addr, size_t len)
+ssize_t ixev_sendv(struct ixev_ctx *ctx, const struct iovec *iov, int iovcnt)
 {
-	size_t actual_len = ixev_window_len(ctx, len);
+	struct ixev_buf *buf = ctx->cur_buf, *chain = NULL;
 	struct sg_entry *ent;
-	char *caddr = (char *) addr;
-	ssize_t ret, so_far = 0;
+	size_t left = 0, off = 0, ret;
+	ssize_t so_far = 0;
+	int i;
 
 	if (ctx->is_dead)
 		return -EIO;
 
-	if (!actual_len)
+	for (i = 0; i < iovcnt; i++)
+		left += iov[i].iov_len;
+
+	left = ixev_window_len(ctx, left);
+	if (!left)
 		return -EAGAIN;
 
-	/* hot path: is there already a buffer? */
-	if (ctx->send_count && ctx->cur_buf) {
-		ret = ixev_buf_store(ctx->cur_buf, caddr, actual_len);
+	/*
+	 * hot path: is there room in the current buffer? Its data must
+	 * still be queued and its ref must be last, or a later ref could
+	 * complete (and free the buffer) before the appended data is sent.
+	 */
+	if (ctx->send_count && buf && ctx->ref_tail == &buf->ref &&
+	    !ixev_is_buf_full(buf)) {
 		ent = &ctx->send[ctx->send_count - 1];
-		ent->len += ret;
-
-		actual_len -= ret;
-		caddr += ret;
-		so_far += ret;
-
-		ctx->cur_buf->ref.send_pos = ctx->send_total + so_far;
+		so_far = ixev_buf_fill(buf, ent, &iov, &off, left);
+		left -= so_far;
+		buf->ref.send_pos = ctx->send_total + so_far;
 	}
 
 	/* cold path: allocate and fill new buffers */
-	while (actual_len) {
+	while (left) {
 		if (ctx->send_count >= IXEV_SEND_DEPTH)
-			goto out;
+			break;
 
-		ctx->cur_buf = ixev_buf_alloc();
-		if (unlikely(!ctx->cur_buf))
-			goto out;
+		buf = ixev_buf_alloc(left);
+		if (unlikely(!buf))
+			break;
+
+		buf->prev = chain;
+		chain = buf;
 
-		ret = ixev_buf_store(ctx->cur_buf, caddr, actual_len);
 		ent = ixev_next_entry(ctx);
-		ent->base = ctx->cur_buf->payload;
-		ent->len = ret;
+		ent->base = buf->payload;
+		ent->len = 0;
 
-		actual_len -= ret;
-		caddr += ret;
+		ret = ixev_buf_fill(buf, ent, &iov, &off, left);
+		left -= ret;
 		so_far += ret;
+	}
 
-		__ixev_add_sent_cb(ctx, &ctx->cur_buf->ref);
-		ctx->cur_buf->ref.send_pos = ctx->send_total + so_far;
+	if (chain) {
+		ctx->cur_buf = chain;
+		chain->ref.send_pos = ctx->send_total + so_far;
+		__ixev_add_sent_cb(ctx, &chain->ref);
 	}
 
-out:
 	if (!so_far)
 		return -EAGAIN;
 
@@ -392,6 +700,27 @@ out:
 	return so_far;
 }
 
+/*
+ * ixev_send - send data using copying
+ * @ctx: the context
+ * @addr: the address of the data
+ * @len: the length of the data
+ *
+ * This variant is easier to use but is slower because it must first
+ * copy the data to a buffer.
+ *
+ * Returns the number of bytes sent, or <0 if there was an error.
+ */
+ssize_t ixev_send(struct ixev_ctx *ctx, void *addr, size_t len)
+{
+	struct iovec iov = {
+		.iov_base	= addr,
+		.iov_len	= len,
+	};
+
+	return ixev_sendv(ctx, &iov, 1);
+}
+
 /*
  * ixev_send_zc - send data using zero-copy
  * @ctx: the context
@@ -442,13 +771,68 @@ void ixev_add_sent_cb(struct ixev_ctx *ctx, struct ixev_ref *ref)
 /**
  * ixev_close - closes a context
  * @ctx: the context
+ *
+ * The context may be released by any later call that flushes a full
+ * command batch, so it must not be used after this call.
  */
 void ixev_close(struct ixev_ctx *ctx)
 {
 	ctx->en_mask = 0;
+	ixev_ready_unlink(ctx);
+	ixev_wheel_del(&ctx->timeout_ent);
 	__ixev_close(ctx);
 }
 
+/**
+ * ixev_set_send_budget - sets the send window budget of the calling thread
+ * @bytes: how far, in total, the send windows of the thread's
+ *	   connections may grow beyond their minimum
+ *
+ * The default is IXEV_SEND_BUDGET.
+ */
+void ixev_set_send_budget(size_t bytes)
+{
+	ixev_send_budget_left += (long) bytes - (long) ixev_send_budget;
+	ixev_send_budget = bytes;
+}
+
+static void ixev_timeout_fire(struct ixev_wheel_ent *ent)
+{
+	struct ixev_ctx *ctx = container_of(ent, struct ixev_ctx, timeout_ent);
+	uint64_t deadline = ctx->last_active + ctx->timeout;
+
+	/* there was activity since the timer was armed: push it back */
+	if (deadline > ixev_wheel_now) {
+		ixev_wheel_add(ent, deadline);
+		return;
+	}
+
+	ctx->last_active = ixev_wheel_now;
+	ixev_wheel_add(ent, ixev_wheel_now + ctx->timeout);
+	ctx->handler(ctx, IXEVTIMEOUT);
+}
+
+/**
+ * ixev_set_timeout - sets the inactivity timeout of a context
+ * @ctx: the context
+ * @usecs: the timeout in microseconds, or 0 to disable it
+ *
+ * The handler is called with IXEVTIMEOUT each time no data was received
+ * or acknowledged for @usecs, whatever events are enabled, so it must be
+ * set first.
+ */
+void ixev_set_timeout(struct ixev_ctx *ctx, uint64_t usecs)
+{
+	ctx->timeout = ixev_wheel_ticks(usecs);
+	if (!ctx->timeout || ctx->is_dead) {
+		ixev_wheel_del(&ctx->timeout_ent);
+		return;
+	}
+
+	ctx->last_active = ixev_wheel_now;
+	ixev_wheel_add(&ctx->timeout_ent, ixev_wheel_now + ctx->timeout);
+}
+
 /**
  * ixev_ctx_init - prepares a context for use
  * @ctx: the context
@@ -460,6 +844,8 @@ void ixev_ctx_init(struct ixev_ctx *ctx)
 	ctx->trig_mask = 0;
 	ctx->recv_head = 0;
 	ctx->recv_tail = 0;
+	ctx->recv_mask = IXEV_RECV_INLINE - 1;
+	ctx->recv = ctx->recv_inline;
 	ctx->send_count = 0;
 	ctx->recv_done_desc = NULL;
 	ctx->sendv_desc = NULL;
@@ -468,8 +854,19 @@ void ixev_ctx_init(struct ixev_ctx *ctx)
 
 	ctx->send_total = 0;
 	ctx->sent_total = 0;
+	ctx->send_win = IXEV_SEND_WIN_MIN +
+			ixev_win_charge(IXEV_SEND_WIN_INIT - IXEV_SEND_WIN_MIN);
+	ctx->win_acked = 0;
+	ctx->win_peak = 0;
+	ctx->win_limited = false;
+	ctx->kernel_limited = false;
 	ctx->ref_head = NULL;
 	ctx->cur_buf = NULL;
+
+	ctx->ready_pprev = NULL;
+	ctx->last_active = ixev_wheel_now;
+	ctx->timeout = 0;
+	ixev_wheel_ent_init(&ctx->timeout_ent, ixev_timeout_fire);
 }
 
 static void ixev_bad_ret(struct ixev_ctx *ctx, uint64_t sysnr, long ret)
@@ -512,26 +909,59 @@ static void ixev_handle_sendv_ret(struct ixev_ctx *ctx, long ret)
 	}
 
 	ixev_shift_sends(ctx, i);
+	if (ctx->send_count)
+		ctx->kernel_limited = true;
 }
 
-static void ixev_handle_close_ret(struct ixev_ctx *ctx, long ret)
+static void ixev_release(struct ixev_ctx *ctx)
 {
 	struct ixev_ref *ref = ctx->ref_head;
 
+	while (ref) {
+		ref->cb(ref);
+		ref = ref->next;
+	}
+
+	ixev_ready_unlink(ctx);
+	ixev_recv_ring_free(ctx);
+	ctx->recv = ctx->recv_inline;
+	ixev_win_reset(ctx);
+	ixev_global_ops.release(ctx);
+}
+
+/*
+ * A batch flushed in the middle of an iteration may be followed by more
+ * events for the same context, and ixev code that triggered the flush
+ * may still hold it, so its release waits until ixev_wait() is done
+ * dispatching.
+ */
+static void ixev_handle_close_ret(struct ixev_ctx *ctx, long ret, bool defer)
+{
 	if (unlikely(ret < 0)) {
 		printf("ixev: failed to close handle, ret = %ld\n", ret);
 		return;
 	}
 
-	while (ref) {
-		ref->cb(ref);
-		ref = ref->next;
+	if (defer) {
+		ctx->closed_next = ixev_closed;
+		ixev_closed = ctx;
+		return;
 	}
 
-	ixev_global_ops.release(ctx);
+	ixev_release(ctx);
+}
+
+static void ixev_release_closed(void)
+{
+	struct ixev_ctx *ctx;
+
+	while ((ctx = ixev_closed)) {
+		ixev_closed = ctx->closed_next;
+		ixev_release(ctx);
+	}
 }
 
-static void ixev_handle_one_ret(struct bsys_ret *r)
+static void ixev_handle_one_ret(struct bsys_ret *r, bool defer)
 {
 	struct ixev_ctx *ctx = (struct ixev_ctx *) r->cookie;
 	uint64_t sysnr = r->sysnr;
@@ -549,6 +979,7 @@ static void ixev_handle_one_ret(struct bsys_ret *r)
 		 */
 		if (unlikely(ret < 0)) {
 			printf("ixev: connect failed with %ld\n", ret);
+			ixev_win_reset(ctx);
 		}
 		break;
 
@@ -557,7 +988,12 @@ static void ixev_handle_one_ret(struct bsys_ret *r)
 		break;
 
 	case KSYS_TCP_CLOSE:
-		ixev_handle_close_ret(ctx, ret);
+		ixev_handle_close_ret(ctx, ret, defer);
+		break;
+
+	case KSYS_TCP_ADMIT:
+		if (unlikely(ret))
+			printf("ixev: admission limit not set, ret %ld\n", ret);
 		break;
 
 	default:
@@ -566,41 +1002,129 @@ static void ixev_handle_one_ret(struct bsys_ret *r)
 	}
 }
 
+/**
+ * __ixev_handle_rets - processes the return values of a command batch
+ * @descs: the descriptors, overwritten with struct bsys_ret by the kernel
+ * @nr: the number of descriptors
+ * @defer: if true, closed contexts are released by ixev_wait() later
+ */
+static void __ixev_handle_rets(struct bsys_desc *descs, unsigned int nr,
+			       bool defer)
+{
+	unsigned int i;
+
+	/* coalesced recv_done and sendv descriptors now hold return values */
+	ixev_generation++;
+
+	/* WARNING: return handlers should not enqueue new comamnds */
+	for (i = 0; i < nr; i++)
+		ixev_handle_one_ret((struct bsys_ret *) &descs[i], defer);
+}
+
+/*
+ * Called by ix_flush() when a full batch is flushed in the middle of an
+ * iteration.
+ */
+static void ixev_handle_rets(struct bsys_desc *descs, unsigned int nr)
+{
+	__ixev_handle_rets(descs, nr, true);
+}
+
+/**
+ * ixev_run_ready - reports events to level-triggered contexts
+ *
+ * Each context whose events still hold is reported once and stays on
+ * the list for the next iteration.
+ */
+static void ixev_run_ready(void)
+{
+	struct ixev_ctx *pending = ixev_ready, *ctx;
+	unsigned int mask, events;
+
+	if (!pending)
+		return;
+
+	/*
+	 * Handlers may close (and so release) any context, so the list is
+	 * moved aside and taken off its head one at a time.
+	 */
+	pending->ready_pprev = &pending;
+	ixev_ready = NULL;
+
+	while ((ctx = pending)) {
+		ixev_ready_unlink(ctx);
+
+		mask = ctx->en_mask;
+		if (!(mask & IXEVLEVEL))
+			continue;
+
+		if (ctx->is_dead) {
+			ixev_deliver_dead(ctx);
+			continue;
+		}
+
+		events = 0;
+		if (ctx->recv_head != ctx->recv_tail)
+			events |= IXEVIN;
+		if (ctx->send_count < IXEV_SEND_DEPTH &&
+		    ixev_window_len(ctx, 1))
+			events |= IXEVOUT;
+
+		events &= mask;
+		if (!events)
+			continue;
+
+		if (mask & IXEVONESHOT)
+			ctx->en_mask = 0;
+		else
+			ixev_ready_link(&ixev_ready, ctx);
+		ctx->handler(ctx, events);
+	}
+}
+
 /**
  * ixev_wait - wait for new events
  */
 void ixev_wait(void)
 {
-	int i;
-
 	/*
 	 * FIXME: don't use the low-level library,
 	 * just make system calls directly.
 	 */
 
 	ix_poll();
-	ixev_generation++;
+	ixev_wheel_sync();
 
-	/* WARNING: return handlers should not enqueue new comamnds */
-	for (i = 0; i < karr->len; i++)
-		ixev_handle_one_ret((struct bsys_ret *) &karr->descs[i]);
-	karr->len = 0;
+	__ixev_handle_rets(karr->descs, karr->len, false);
+	ix_bsys_reset();
 
 	ix_handle_events();
+	ixev_release_closed();
+	ixev_wheel_run();
+	ixev_run_ready();
+	ixev_release_closed();
+	ixev_wheel_arm();
 }
 
 
 /**
  * ixev_set_handler - sets the event handler and which events trigger it
  * @ctx: the context
- * @mask: the event types that trigger
+ * @mask: the event types that trigger, and optionally IXEVLEVEL and/or
+ *	  IXEVONESHOT
  * @handler: the handler
+ *
+ * Events that are already pending are reported to level-triggered
+ * handlers on the next call to ixev_wait().
  */
 void ixev_set_handler(struct ixev_ctx *ctx, unsigned int mask,
 		      ixev_handler_t handler)
 {
 	ctx->en_mask = mask;
 	ctx->handler = handler;
+
+	if (mask & IXEVLEVEL)
+		ixev_ready_add(ctx);
 }
 
 /**
@@ -618,33 +1142,99 @@ int ixev_init_thread(void)
 	if (ret)
 		return ret;
 
+	ret = mempool_create(&ixev_extent_pool, &ixev_extent_datastore);
+	if (ret)
+		goto fail_extent;
+
+	ret = mempool_create(&ixev_recv_pool, &ixev_recv_datastore);
+	if (ret)
+		goto fail_recv;
+
 	ret = ix_init(&ixev_ops, CMD_BATCH_SIZE);
-	if (ret) {
-		mempool_destroy(&ixev_buf_pool);
-		return ret;
-	}
+	if (ret)
+		goto fail_init;
 
+	ixev_wheel_init_thread();
 	return 0;
+
+fail_init:
+	mempool_destroy(&ixev_recv_pool);
+fail_recv:
+	mempool_destroy(&ixev_extent_pool);
+fail_extent:
+	mempool_destroy(&ixev_buf_pool);
+	return ret;
 }
 
 /**
- * ixev_init - global initializer
+ * ixev_init_conf - global initializer with custom send buffers
  * @conn_ops: operations for establishing new connections
+ * @conf: the send buffer settings, or NULL for the defaults
  *
- * Call once.
+ * Call once, instead of ixev_init().
  *
  * Returns zero if successful, otherwise fail.
  */
-int ixev_init(struct ixev_conn_ops *ops)
+int ixev_init_conf(struct ixev_conn_ops *ops, const struct ixev_conf *conf)
 {
 	/* FIXME: check if running inside IX */
+	struct ixev_conf c = {
+		.buf_size	= IXEV_BUF_SIZE,
+		.nr_bufs	= IXEV_NR_BUFS,
+		.extent_size	= IXEV_EXTENT_SIZE,
+		.nr_extents	= IXEV_NR_EXTENTS,
+		.nt_threshold	= IXEV_NT_THRESHOLD,
+	};
 	int ret;
 
-	ret = mempool_create_datastore(&ixev_buf_datastore, 131072, sizeof(struct ixev_buf), 0, MEMPOOL_DEFAULT_CHUNKSIZE, "ixev_buf");
+	if (conf) {
+		if (conf->buf_size)
+			c.buf_size = conf->buf_size;
+		if (conf->nr_bufs)
+			c.nr_bufs = conf->nr_bufs;
+		if (conf->extent_size)
+			c.extent_size = conf->extent_size;
+		if (conf->nr_extents)
+			c.nr_extents = conf->nr_extents;
+		if (conf->nt_threshold)
+			c.nt_threshold = conf->nt_threshold;
+	}
+
+	/* ixev_buf_free() tells extents apart by size */
+	if (c.extent_size <= c.buf_size)
+		return -EINVAL;
+
+	ixev_buf_size = c.buf_size;
+	ixev_extent_size = c.extent_size;
+	ixev_nt_threshold = c.nt_threshold;
+
+	ret = mempool_create_datastore(&ixev_buf_datastore, align_up(c.nr_bufs, MEMPOOL_DEFAULT_CHUNKSIZE), sizeof(struct ixev_buf) + c.buf_size, 0, MEMPOOL_DEFAULT_CHUNKSIZE, "ixev_buf");
 	if (ret)
 		return ret;
 
+	/* extents are large, so threads take them a few at a time */
+	ret = mempool_create_datastore(&ixev_extent_datastore, align_up(c.nr_extents, IXEV_EXTENT_CHUNK), sizeof(struct ixev_buf) + c.extent_size, 0, IXEV_EXTENT_CHUNK, "ixev_extent");
+	if (ret)
+		return ret;
+
+	ret = mempool_create_datastore(&ixev_recv_datastore, 16384, sizeof(struct sg_entry) * IXEV_RECV_DEPTH, 0, MEMPOOL_DEFAULT_CHUNKSIZE, "ixev_recv");
+	if (ret)
+		return ret;
+
+	ixev_wheel_init();
 	ixev_global_ops = *ops;
 	return 0;
 }
 
+/**
+ * ixev_init - global initializer
+ * @conn_ops: operations for establishing new connections
+ *
+ * Call once.
+ *
+ * Returns zero if successful, otherwise fail.
+ */
+int ixev_init(struct ixev_conn_ops *ops)
+{
+	return ixev_init_conf(ops, NULL);
+}
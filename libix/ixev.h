@@ -28,27 +28,49 @@
 #pragma once
 
 #include "ix.h"
+#include "ixev_timer.h"
 #include <stdio.h>
+#include <sys/uio.h>
 
-/* FIXME: we won't need recv depth when i get a chance to fix the kernel */
-#define IXEV_RECV_DEPTH	128
-#define IXEV_SEND_DEPTH	16
+/*
+ * Received data starts out in a small ring inside the context and moves
+ * to a pooled ring of IXEV_RECV_DEPTH entries (then to larger, malloc'd
+ * rings) only while the application falls behind.
+ */
+#define IXEV_RECV_INLINE	4
+#define IXEV_RECV_DEPTH		128
+#define IXEV_SEND_DEPTH		16
 
 struct ixev_ctx;
 struct ixev_ref;
 struct ixev_buf;
 
-/*
- * FIXME: right now we only support some libevent features
- * - add level triggered support (now only edge triggered)
- * - add one fire events (now only persistent)
- * - add timeout support for events
- */
-
 /* IX event types */
 #define IXEVHUP		0x1 /* the connection was closed (or failed) */
 #define IXEVIN		0x2 /* new data is available for reading */
 #define IXEVOUT		0x4 /* more space is available for writing */
+#define IXEVTIMEOUT	0x8 /* the connection was idle for too long */
+
+/*
+ * IX event modes, or'ed into the ixev_set_handler() mask. By default,
+ * events are edge triggered and persistent.
+ */
+#define IXEVLEVEL	0x100 /* report events once per ixev_wait() while
+				 their condition holds */
+#define IXEVONESHOT	0x200 /* disable all events after the first report */
+
+/*
+ * Send buffer settings for ixev_init_conf(); fields left at zero keep
+ * their defaults (see buf.h). Sends that do not fit in a buffer are
+ * copied into extents, which must be larger.
+ */
+struct ixev_conf {
+	uint32_t	buf_size;	/* the payload size of a send buffer */
+	unsigned int	nr_bufs;	/* the number of send buffers */
+	uint32_t	extent_size;	/* the payload size of a send extent */
+	unsigned int	nr_extents;	/* the number of send extents */
+	size_t		nt_threshold;	/* copies this large bypass the cache */
+};
 
 struct ixev_conn_ops {
 	struct ixev_ctx *(*accept)(struct ip_tuple *id);
@@ -79,13 +101,19 @@ struct ixev_ctx {
 	ixev_handler_t	handler;		/* the event handler */
 	unsigned int	en_mask;		/* a mask of enabled events */
 	unsigned int	trig_mask;		/* a mask of triggered events */
-	uint16_t	recv_head;		/* received data SG head */
-	uint16_t	recv_tail;		/* received data SG tail */
+	uint32_t	recv_head;		/* received data SG head */
+	uint32_t	recv_tail;		/* received data SG tail */
+	uint32_t	recv_mask;		/* the receive ring size - 1 */
 	uint16_t	send_count;		/* the current send SG count */
 	uint16_t	is_dead: 1;		/* is the connection dead? */
+	uint16_t	win_limited: 1;		/* did the send window cap a send? */
+	uint16_t	kernel_limited: 1;	/* did the kernel take only part of a sendv? */
 
 	size_t		send_total;		/* the total requested bytes */
 	size_t		sent_total;		/* the total completed bytes */
+	uint32_t	send_win;		/* the current send window */
+	uint32_t	win_acked;		/* bytes acked in this tuning round */
+	uint32_t	win_peak;		/* peak bytes in flight in this round */
 	struct ixev_ref	*ref_head;		/* list head of references */
 	struct ixev_ref *ref_tail;		/* list tail of references */
 	struct ixev_buf *cur_buf;		/* current buffer */
@@ -93,31 +121,43 @@ struct ixev_ctx {
 	struct bsys_desc *recv_done_desc;	/* the current recv_done bsys descriptor */
 	struct bsys_desc *sendv_desc;		/* the current sendv bsys descriptor */
 
-	struct sg_entry	recv[IXEV_RECV_DEPTH];	/* receieve SG array */
+	struct ixev_ctx	*ready_next;		/* next level-triggered context */
+	struct ixev_ctx	**ready_pprev;		/* level-triggered list link */
+	struct ixev_ctx	*closed_next;		/* next context awaiting release */
+	uint64_t	last_active;		/* the wheel tick of the last event */
+	uint64_t	timeout;		/* the inactivity timeout in ticks */
+	struct ixev_wheel_ent timeout_ent;	/* the inactivity timer */
+
+	struct sg_entry	*recv;			/* receive SG ring */
+	struct sg_entry recv_inline[IXEV_RECV_INLINE]; /* the initial ring */
 	struct sg_entry send[IXEV_SEND_DEPTH];	/* send SG array */
 };
 
-static inline void ixev_check_hacks(struct ixev_ctx *ctx)
+/**
+ * __ixev_next_desc - reserves the next command descriptor
+ *
+ * If the command batch is full, it is flushed to the kernel first and
+ * the return values are processed right away. This starts a new
+ * generation, so descriptors cached for coalescing are not reused.
+ */
+static inline struct bsys_desc *__ixev_next_desc(void)
 {
-	/*
-	 * Temporary hack:
-	 *
-	 * FIXME: we need to flush commands in batches to limit our
-	 * command buffer size. Then this restriction can be lifted.
-	 */
-	if (unlikely(karr->len >= karr->max_len)) {
-		printf("ixev: ran out of command space\n");
-		exit(-1);
-	}
+	if (unlikely(karr->len >= karr->max_len))
+		ix_flush();
+
+	return __bsys_arr_next(karr);
 }
 
 extern ssize_t ixev_recv(struct ixev_ctx *ctx, void *addr, size_t len);
 extern void *ixev_recv_zc(struct ixev_ctx *ctx, size_t len);
 extern ssize_t ixev_send(struct ixev_ctx *ctx, void *addr, size_t len);
+extern ssize_t ixev_sendv(struct ixev_ctx *ctx, const struct iovec *iov,
+			  int iovcnt);
 extern ssize_t ixev_send_zc(struct ixev_ctx *ctx, void *addr, size_t len);
 extern void ixev_add_sent_cb(struct ixev_ctx *ctx, struct ixev_ref *ref);
 
 extern void ixev_close(struct ixev_ctx *ctx);
+extern void ixev_set_send_budget(size_t bytes);
 
 /**
  * ixev_dial - open a connection
@@ -131,10 +171,20 @@ extern void ixev_close(struct ixev_ctx *ctx);
 static inline void
 ixev_dial(struct ixev_ctx *ctx, struct ip_tuple *id)
 {
-	struct bsys_desc *d = __bsys_arr_next(karr);
-	ixev_check_hacks(ctx);
+	ksys_tcp_connect(__ixev_next_desc(), id, (unsigned long) ctx);
+}
 
-	ksys_tcp_connect(d, id, (unsigned long) ctx);
+/**
+ * ixev_admit - limits the connections held open on a listening port
+ * @port: the listening port
+ * @limit: the maximum number of connections, or zero for no limit
+ *
+ * The limit is enforced by the kernel for all threads: connections beyond
+ * it are reset without reaching the accept op.
+ */
+static inline void ixev_admit(uint16_t port, unsigned int limit)
+{
+	ksys_tcp_admit(__ixev_next_desc(), port, limit);
 }
 
 extern void ixev_ctx_init(struct ixev_ctx *ctx);
@@ -142,7 +192,10 @@ extern void ixev_wait(void);
 
 extern void ixev_set_handler(struct ixev_ctx *ctx, unsigned int mask,
 			     ixev_handler_t handler);
+extern void ixev_set_timeout(struct ixev_ctx *ctx, uint64_t usecs);
 
 extern int ixev_init_thread(void);
 extern int ixev_init(struct ixev_conn_ops *ops);
+extern int ixev_init_conf(struct ixev_conn_ops *ops,
+			  const struct ixev_conf *conf);
 
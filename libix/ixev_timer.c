@@ -1,20 +1,435 @@
+/*
+ * ixev_timer.c - user-level timers
+ *
+ * Timers live on a per-thread hierarchical timer wheel, Scheme 7 of
+ * "Hashed and Hierarchical Timing Wheels" by Varghese and Lauck, like
+ * the dataplane timers: four levels of 256 slots with microsecond ticks,
+ * so timers up to about 71 minutes away are placed directly and later
+ * ones are parked on the last level until they come within range. Each
+ * level has an occupancy bitmap, so empty slots are skipped without
+ * being touched.
+ *
+ * However many timers are pending, a thread holds a single kernel timer
+ * armed for the earliest of them, and the timers that expired by the
+ * time it fires are all run from the one USYS_TIMER event.
+ */
+
+#include <stdio.h>
+
+#include <ix/bitmap.h>
+
 #include "ixev_timer.h"
 #include "syscall.h"
 
+#define IXEV_WHEEL_SHIFT	8
+#define IXEV_WHEEL_SIZE		(1 << IXEV_WHEEL_SHIFT)
+#define IXEV_WHEEL_MASK		(IXEV_WHEEL_SIZE - 1)
+#define IXEV_WHEEL_LEVELS	4
+#define IXEV_WHEEL_RANGE \
+	((1ull << (IXEV_WHEEL_LEVELS * IXEV_WHEEL_SHIFT)) - 1)
+
+/* the kernel timer is re-armed at least this often */
+#define IXEV_WHEEL_MAX_ARM_US	1000000
+
+#define IXEV_CALIBRATE_US	10000
+
+struct ixev_wheel {
+	uint64_t		pos;	/* the next tick to process */
+	uint64_t		armed;	/* the tick the kernel timer is set for */
+	unsigned long		count;	/* the number of pending entries */
+	int			timer_id; /* the kernel timer, or -1 */
+	DEFINE_BITMAP(occupied[IXEV_WHEEL_LEVELS], IXEV_WHEEL_SIZE);
+	struct ixev_wheel_ent	*slots[IXEV_WHEEL_LEVELS][IXEV_WHEEL_SIZE];
+};
+
+static uint64_t ixev_cycles_per_tick;
+static __thread struct ixev_wheel ixev_wheel;
+
+/* the current tick, as of the last ixev_wheel_sync() or ixev_wheel_run() */
+__thread uint64_t ixev_wheel_now;
+
+static inline uint64_t ixev_wheel_clock(void)
+{
+	return rdtsc() / ixev_cycles_per_tick;
+}
+
+static void ixev_wheel_link(struct ixev_wheel_ent **head,
+			    struct ixev_wheel_ent *ent)
+{
+	ent->next = *head;
+	if (ent->next)
+		ent->next->pprev = &ent->next;
+	ent->pprev = head;
+	*head = ent;
+}
+
+static void ixev_wheel_unlink(struct ixev_wheel_ent *ent)
+{
+	*ent->pprev = ent->next;
+	if (ent->next)
+		ent->next->pprev = ent->pprev;
+	ent->pprev = NULL;
+}
+
+static void ixev_wheel_insert(struct ixev_wheel *w, struct ixev_wheel_ent *ent)
+{
+	uint64_t delta = ent->expires - w->pos;
+	uint64_t when = ent->expires;
+	int level, off;
+
+	/* too far out: park it on the last level and place it again later */
+	if (delta > IXEV_WHEEL_RANGE) {
+		delta = IXEV_WHEEL_RANGE;
+		when = w->pos + delta;
+	}
+
+	level = delta ? (63 - clz64(delta)) / IXEV_WHEEL_SHIFT : 0;
+	off = (when >> (level * IXEV_WHEEL_SHIFT)) & IXEV_WHEEL_MASK;
+
+	ixev_wheel_link(&w->slots[level][off], ent);
+	bitmap_set(w->occupied[level], off);
+}
+
+/**
+ * ixev_wheel_next_slot - finds the next non-empty slot of a level
+ * @w: the wheel
+ * @level: the level
+ * @off: the offset of the first slot to look at
+ *
+ * Stale occupancy bits found on the way are cleared.
+ *
+ * Returns the distance from @off to the first non-empty slot, wrapping
+ * around, or IXEV_WHEEL_SIZE if there is none.
+ */
+static int ixev_wheel_next_slot(struct ixev_wheel *w, int level, int off)
+{
+	unsigned long *bits = w->occupied[level];
+	int d = 0, pos, next;
+
+	while (d < IXEV_WHEEL_SIZE) {
+		pos = (off + d) & IXEV_WHEEL_MASK;
+		next = bitmap_next_set(bits, IXEV_WHEEL_SIZE, pos);
+		d += next - pos;
+		if (next == IXEV_WHEEL_SIZE || d >= IXEV_WHEEL_SIZE)
+			continue;
+		if (w->slots[level][next])
+			return d;
+		bitmap_clear(bits, next);
+		d++;
+	}
+
+	return IXEV_WHEEL_SIZE;
+}
+
+/**
+ * ixev_wheel_add - arms (or re-arms) a wheel entry
+ * @ent: the entry
+ * @expires: the tick at which to fire
+ *
+ * Ticks that have already been processed are rounded up to the next
+ * one, so the entry fires on the next call to ixev_wheel_run().
+ */
+void ixev_wheel_add(struct ixev_wheel_ent *ent, uint64_t expires)
+{
+	struct ixev_wheel *w = &ixev_wheel;
+
+	if (ixev_wheel_pending(ent))
+		ixev_wheel_del(ent);
+
+	ent->expires = max(expires, w->pos);
+	ixev_wheel_insert(w, ent);
+	w->count++;
+}
+
+/**
+ * ixev_wheel_del - disarms a wheel entry
+ * @ent: the entry
+ *
+ * It is safe to call this on an entry that is not armed. The occupancy
+ * bit of the slot is left for the next scan to clear.
+ */
+void ixev_wheel_del(struct ixev_wheel_ent *ent)
+{
+	if (!ixev_wheel_pending(ent))
+		return;
+
+	ixev_wheel_unlink(ent);
+	ixev_wheel.count--;
+}
+
+/*
+ * Called at the start of every block of 256 ticks: moves the slot of the
+ * next level that covers the block down, and so on up while the block
+ * also starts a block of that level.
+ */
+static void ixev_wheel_cascade(struct ixev_wheel *w)
+{
+	struct ixev_wheel_ent *ent, *next;
+	int level, off;
+
+	for (level = 1; level < IXEV_WHEEL_LEVELS; level++) {
+		off = (w->pos >> (level * IXEV_WHEEL_SHIFT)) & IXEV_WHEEL_MASK;
+
+		if (bitmap_test(w->occupied[level], off)) {
+			ent = w->slots[level][off];
+			w->slots[level][off] = NULL;
+			bitmap_clear(w->occupied[level], off);
+
+			for (; ent; ent = next) {
+				next = ent->next;
+				ixev_wheel_insert(w, ent);
+			}
+		}
+
+		if (off)
+			break;
+	}
+}
+
+/**
+ * ixev_wheel_next_expiry - determines when the wheel needs to run next
+ * @w: the wheel
+ *
+ * Entries on the upper levels count for the tick at which they move
+ * down a level, which is never later than their expiry.
+ *
+ * Returns the tick, or UINT64_MAX if the wheel is empty.
+ */
+static uint64_t ixev_wheel_next_expiry(struct ixev_wheel *w)
+{
+	uint64_t next = UINT64_MAX, base, tick;
+	int level, shift, d;
+
+	for (level = 0; level < IXEV_WHEEL_LEVELS; level++) {
+		shift = level * IXEV_WHEEL_SHIFT;
+
+		/*
+		 * The current slot of an upper level was already cascaded,
+		 * unless the wheel stopped right at the start of its block.
+		 */
+		base = w->pos >> shift;
+		if (w->pos & ((1ull << shift) - 1))
+			base++;
+		d = ixev_wheel_next_slot(w, level, base & IXEV_WHEEL_MASK);
+		if (d == IXEV_WHEEL_SIZE)
+			continue;
+
+		tick = (base + d) << shift;
+		if (tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+static void ixev_wheel_run_slot(struct ixev_wheel *w, int off)
+{
+	struct ixev_wheel_ent *pending = w->slots[0][off], *ent;
+
+	w->slots[0][off] = NULL;
+	bitmap_clear(w->occupied[0], off);
+
+	/* entries added by the handlers below must not land on this tick */
+	w->pos++;
+	if (!pending)
+		return;
+
+	/*
+	 * Handlers may add or remove any entry, including the ones still
+	 * waiting in this slot, so they are moved to a private list and
+	 * taken off its head one at a time.
+	 */
+	pending->pprev = &pending;
+	while ((ent = pending)) {
+		ixev_wheel_unlink(ent);
+		w->count--;
+		ent->fire(ent);
+	}
+}
+
+/**
+ * ixev_wheel_sync - brings ixev_wheel_now up to date without running
+ * the wheel
+ */
+void ixev_wheel_sync(void)
+{
+	ixev_wheel_now = ixev_wheel_clock();
+}
+
+/**
+ * ixev_wheel_run - fires the wheel entries that have expired
+ *
+ * All entries of a level 0 slot expire on the same tick, so only the
+ * slots that are occupied and due are visited, and the wheel skips
+ * ahead to the next expiry or cascade in between.
+ */
+void ixev_wheel_run(void)
+{
+	struct ixev_wheel *w = &ixev_wheel;
+	uint64_t now = ixev_wheel_clock();
+	int off, next;
+
+	ixev_wheel_now = now;
+
+	while (w->count && w->pos <= now) {
+		if (!(w->pos & IXEV_WHEEL_MASK))
+			ixev_wheel_cascade(w);
+
+		off = w->pos & IXEV_WHEEL_MASK;
+		next = bitmap_next_set(w->occupied[0], IXEV_WHEEL_SIZE, off);
+		if (next < IXEV_WHEEL_SIZE && w->pos + next - off <= now) {
+			w->pos += next - off;
+			ixev_wheel_run_slot(w, next);
+			continue;
+		}
+
+		/* nothing is due in this block: skip the blocks that are idle */
+		w->pos = min(now + 1, ixev_wheel_next_expiry(w));
+	}
+
+	if (w->pos <= now)
+		w->pos = now + 1;
+}
+
+/**
+ * ixev_wheel_event - handles the expiry of the thread's kernel timer
+ * @cookie: unused
+ *
+ * ixev_wait() runs the wheel after every batch of events, so this only
+ * notes that the kernel timer needs to be armed again.
+ */
+void ixev_wheel_event(unsigned long cookie)
+{
+	ixev_wheel.armed = UINT64_MAX;
+}
+
+/**
+ * ixev_wheel_arm - makes sure the thread wakes up for the next expiry
+ *
+ * Called by ixev_wait() before it goes back to the kernel. The kernel
+ * timer is only touched if the earliest pending entry moved ahead of
+ * the tick it is set for, and is allocated on first use.
+ */
+void ixev_wheel_arm(void)
+{
+	struct ixev_wheel *w = &ixev_wheel;
+	uint64_t next, now, delay;
+
+	if (!w->count)
+		return;
+
+	next = ixev_wheel_next_expiry(w);
+	if (next >= w->armed)
+		return;
+
+	if (w->timer_id < 0) {
+		w->timer_id = sys_timer_init(w);
+		if (w->timer_id < 0) {
+			printf("ixev: no kernel timer left, "
+			       "timers will fire late\n");
+			w->armed = 0;
+			return;
+		}
+	}
+
+	now = ixev_wheel_clock();
+	delay = next > now ? (next - now) * IXEV_WHEEL_TICK_US : 1;
+	if (delay > IXEV_WHEEL_MAX_ARM_US) {
+		delay = IXEV_WHEEL_MAX_ARM_US;
+		next = now + ixev_wheel_ticks(delay);
+	}
+
+	if (!sys_timer_ctl(w->timer_id, delay))
+		w->armed = next;
+}
+
+static void ixev_timer_fire(struct ixev_wheel_ent *ent)
+{
+	struct ixev_timer *t = container_of(ent, struct ixev_timer, ent);
+
+	t->handler(t->arg);
+}
+
+/**
+ * ixev_timer_init - prepares a timer for use
+ * @t: the timer
+ * @h: the function to call when the timer fires
+ * @arg: the argument passed to @h
+ *
+ * Timers do not hold kernel resources, so this cannot fail.
+ *
+ * Returns non-zero.
+ */
 int ixev_timer_init(struct ixev_timer *t, ixev_timer_handler_t h, void *arg)
 {
 	t->handler = h;
 	t->arg = arg;
-	t->timer_id = sys_timer_init(t);
+	ixev_wheel_ent_init(&t->ent, ixev_timer_fire);
 
-	return t->timer_id != -1;
+	return 1;
 }
 
+/**
+ * ixev_timer_add - arms (or re-arms) a timer
+ * @t: the timer
+ * @tv: the time from now at which to fire
+ *
+ * The handler runs from ixev_wait() on the calling thread.
+ *
+ * Returns 0.
+ */
 int ixev_timer_add(struct ixev_timer *t, struct timeval tv)
 {
 	uint64_t delay;
 
 	delay = tv.tv_sec * 1000000 + tv.tv_usec;
+	ixev_wheel_add(&t->ent, ixev_wheel_clock() + ixev_wheel_ticks(delay));
+
+	return 0;
+}
+
+/**
+ * ixev_timer_del - disarms a timer
+ * @t: the timer
+ *
+ * It is safe to call this on a timer that is not armed.
+ */
+void ixev_timer_del(struct ixev_timer *t)
+{
+	ixev_wheel_del(&t->ent);
+}
+
+/**
+ * ixev_wheel_init_thread - thread-local initializer for the wheel
+ */
+void ixev_wheel_init_thread(void)
+{
+	struct ixev_wheel *w = &ixev_wheel;
+
+	ixev_wheel_now = ixev_wheel_clock();
+	w->pos = ixev_wheel_now + 1;
+	w->armed = UINT64_MAX;
+	w->timer_id = -1;
+}
+
+/**
+ * ixev_wheel_init - global initializer for the wheel
+ *
+ * Measures the TSC frequency against gettimeofday().
+ */
+void ixev_wheel_init(void)
+{
+	struct timeval start, now;
+	uint64_t tsc;
+	long us;
+
+	gettimeofday(&start, NULL);
+	tsc = rdtsc();
+	do {
+		gettimeofday(&now, NULL);
+		us = (now.tv_sec - start.tv_sec) * 1000000 +
+		     now.tv_usec - start.tv_usec;
+	} while (us < IXEV_CALIBRATE_US);
 
-	return sys_timer_ctl(t->timer_id, delay);
+	ixev_cycles_per_tick = (rdtsc() - tsc) * IXEV_WHEEL_TICK_US / us;
 }
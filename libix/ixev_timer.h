@@ -1,15 +1,85 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/time.h>
 
+/*
+ * The wheel is a per-thread hierarchical timer wheel with microsecond
+ * ticks, advanced by ixev_wait(). All of its entries share a single
+ * kernel timer per thread, armed for the earliest deadline only.
+ */
+#define IXEV_WHEEL_TICK_US	1
+
+struct ixev_wheel_ent;
+typedef void (*ixev_wheel_fn_t)(struct ixev_wheel_ent *ent);
+
+struct ixev_wheel_ent {
+	struct ixev_wheel_ent	*next;
+	struct ixev_wheel_ent	**pprev;
+	uint64_t		expires;	/* the expiry tick */
+	ixev_wheel_fn_t		fire;		/* the expiry handler */
+};
+
+extern __thread uint64_t ixev_wheel_now;
+
+/**
+ * ixev_wheel_ent_init - prepares a wheel entry for use
+ * @ent: the entry
+ * @fire: the function to call when the entry expires
+ */
+static inline void
+ixev_wheel_ent_init(struct ixev_wheel_ent *ent, ixev_wheel_fn_t fire)
+{
+	ent->pprev = NULL;
+	ent->fire = fire;
+}
+
+/**
+ * ixev_wheel_pending - determines if a wheel entry is armed
+ * @ent: the entry
+ */
+static inline bool ixev_wheel_pending(struct ixev_wheel_ent *ent)
+{
+	return ent->pprev != NULL;
+}
+
+/**
+ * ixev_wheel_ticks - converts microseconds to wheel ticks, rounding up
+ * @usecs: the time in microseconds
+ */
+static inline uint64_t ixev_wheel_ticks(uint64_t usecs)
+{
+	return (usecs + IXEV_WHEEL_TICK_US - 1) / IXEV_WHEEL_TICK_US;
+}
+
+extern void ixev_wheel_add(struct ixev_wheel_ent *ent, uint64_t expires);
+extern void ixev_wheel_del(struct ixev_wheel_ent *ent);
+extern void ixev_wheel_sync(void);
+extern void ixev_wheel_run(void);
+extern void ixev_wheel_arm(void);
+extern void ixev_wheel_event(unsigned long cookie);
+extern void ixev_wheel_init_thread(void);
+extern void ixev_wheel_init(void);
+
 typedef void (*ixev_timer_handler_t)(void *arg);
 
 struct ixev_timer {
 	ixev_timer_handler_t handler;
 	void *arg;
-	int timer_id;
+	struct ixev_wheel_ent ent;
 };
 
+/**
+ * ixev_timer_pending - determines if a timer is armed
+ * @t: the timer
+ */
+static inline bool ixev_timer_pending(struct ixev_timer *t)
+{
+	return ixev_wheel_pending(&t->ent);
+}
+
 int ixev_timer_init(struct ixev_timer *t, ixev_timer_handler_t h, void *arg);
 
 int ixev_timer_add(struct ixev_timer *t, struct timeval tv);
+void ixev_timer_del(struct ixev_timer *t);
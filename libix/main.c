@@ -32,19 +32,24 @@
 
 static __thread bsysfn_t usys_tbl[USYS_NR];
 static __thread struct bsys_arr *uarr;
+static __thread void (*flushed_fn)(struct bsys_desc *descs, unsigned int nr);
 
+__thread struct bsys_ring *kring;
 __thread struct bsys_arr *karr;
 
 /**
  * ix_poll - flush pending commands and check for new commands
  *
+ * Pending commands sit on the shared submission ring, so the kernel picks
+ * them up without being handed the batch.
+ *
  * Returns the number of new commands received.
  */
 int ix_poll(void)
 {
 	int ret;
 
-	ret = sys_bpoll(karr->descs, karr->len);
+	ret = sys_bpoll(NULL, 0);
 	if (ret) {
 		printf("libix: encountered a fatal memory fault\n");
 		exit(-1);
@@ -65,18 +70,23 @@ void ix_handle_events(void)
 
 /**
  * ix_flush - send pending commands
+ *
+ * The return values are handed to the flushed() op, if there is one,
+ * before the command array is reused.
  */
 void ix_flush(void)
 {
 	int ret;
 
-	ret = sys_bcall(karr->descs, karr->len);
+	ret = sys_bcall(NULL, 0);
 	if (ret) {
 		printf("libix: encountered a fatal memory fault\n");
 		exit(-1);
 	}
 
-	karr->len = 0;
+	if (flushed_fn)
+		flushed_fn(karr->descs, karr->len);
+	ix_bsys_reset();
 }
 
 static void
@@ -91,6 +101,17 @@ ix_default_tcp_knock(int handle, struct ip_tuple *id)
 	ix_tcp_reject(handle);
 }
 
+static void
+ix_default_tcp_recvv(hid_t handle, unsigned long cookie,
+		     struct sg_entry *ents, unsigned int nrents)
+{
+	unsigned int i;
+
+	for (i = 0; i < nrents; i++)
+		usys_tbl[USYS_TCP_RECV](handle, cookie,
+					(uint64_t) ents[i].base, ents[i].len);
+}
+
 /**
  * ix_init - initializes libIX
  * @ops: user-provided event handlers
@@ -112,24 +133,30 @@ int ix_init(struct ix_ops *ops, int batch_depth)
 	usys_tbl[USYS_TCP_SENT]		= (bsysfn_t) ops->tcp_sent;
 	usys_tbl[USYS_TCP_DEAD]		= (bsysfn_t) ops->tcp_dead;
 	usys_tbl[USYS_TIMER]		= (bsysfn_t) ops->timer_event;
+	usys_tbl[USYS_TCP_RECVV]	= (bsysfn_t) ops->tcp_recvv;
+	flushed_fn			= ops->flushed;
 
 	/* provide sane defaults so we don't leak memory */
 	if (!ops->udp_recv)
 		usys_tbl[USYS_UDP_RECV] = (bsysfn_t) ix_default_udp_recv;
 	if (!ops->tcp_knock)
 		usys_tbl[USYS_TCP_KNOCK] = (bsysfn_t) ix_default_tcp_knock;
+	if (!ops->tcp_recvv)
+		usys_tbl[USYS_TCP_RECVV] = (bsysfn_t) ix_default_tcp_recvv;
 
 	uarr = sys_baddr();
 	if (!uarr)
 		return -EFAULT;
 
-	karr = malloc(sizeof(struct bsys_arr) +
-		      sizeof(struct bsys_desc) * batch_depth);
-	if (!karr)
-		return -ENOMEM;
+	kring = sys_bring();
+	if (!kring)
+		return -EFAULT;
+	if (batch_depth <= 0 || batch_depth > kring->sq.max_len)
+		return -EINVAL;
 
-	karr->len = 0;
+	karr = &kring->sq;
 	karr->max_len = batch_depth;
+	ix_bsys_reset();
 
 	return 0;
 }
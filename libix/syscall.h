@@ -47,6 +47,11 @@ static inline void *sys_baddr(void)
 	return (struct bsys_arr *) SYSCALL(SYS_BADDR);
 }
 
+static inline struct bsys_ring *sys_bring(void)
+{
+	return (struct bsys_ring *) SYSCALL(SYS_BRING);
+}
+
 static inline int sys_mmap(void *addr, int nr, int size, int perm)
 {
 	return (int) SYSCALL(SYS_MMAP, addr, nr, size, perm);
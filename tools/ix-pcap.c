@@ -0,0 +1,312 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ix-pcap.c - controls the sampled packet capture and writes it to a file
+ *
+ * The data plane copies the selected frames into per-core rings in the
+ * "/ix-pcap" shared memory; this tool drains them, merges the cores in
+ * timestamp order per drain round and writes a nanosecond pcap file.
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <ix/control_plane.h>
+#include <ix/pcap.h>
+
+volatile struct cp_shmem *cp_shmem;
+
+static volatile int stop;
+
+static void handle_sigint(int sig)
+{
+	stop = 1;
+}
+
+static int pcap_map_cp(void)
+{
+	int fd;
+
+	fd = shm_open("/ix", O_RDWR, 0);
+	if (fd == -1) {
+		perror("shm_open");
+		return 1;
+	}
+
+	cp_shmem = mmap(NULL, sizeof(struct cp_shmem), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if (cp_shmem == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int pcap_set_filter(struct pcap_filter *f)
+{
+	if (pcap_map_cp())
+		return 1;
+
+	/* disable first so that cores never see a half-written filter */
+	cp_shmem->pcap.sample = 0;
+	__sync_synchronize();
+	cp_shmem->pcap.dirs = f->dirs;
+	cp_shmem->pcap.ip = f->ip;
+	cp_shmem->pcap.port = f->port;
+	__sync_synchronize();
+	cp_shmem->pcap.sample = f->sample;
+	return 0;
+}
+
+static void pcap_write_rec(FILE *out, struct ix_pcap *pcap,
+			   struct pcap_rec *rec)
+{
+	struct pcap_pkt_hdr ph;
+	uint64_t ns;
+
+	ns = pcap->base_ns +
+	     (rec->tsc - pcap->base_tsc) * 1000 / pcap->cycles_per_us;
+	ph.ts_sec = ns / 1000000000;
+	ph.ts_frac = ns % 1000000000;
+	ph.caplen = rec->caplen;
+	ph.len = rec->len;
+	fwrite(&ph, sizeof(ph), 1, out);
+	fwrite(rec->data, rec->caplen, 1, out);
+}
+
+/*
+ * Copies the records between *tail and the current head of a ring. The
+ * data plane keeps writing while we copy, so each record is validated
+ * against head afterwards; records that were (or may have been)
+ * overwritten are counted as lost.
+ */
+static unsigned int pcap_drain_ring(volatile struct ix_pcap_ring *ring,
+				    uint64_t *tail, struct pcap_rec *out,
+				    uint64_t *lost)
+{
+	uint64_t head1, head2, i, bad;
+	unsigned int nr = 0;
+
+	head1 = ring->head;
+	__sync_synchronize();
+
+	if (head1 - *tail > PCAP_RING_SIZE) {
+		*lost += head1 - *tail - PCAP_RING_SIZE;
+		*tail = head1 - PCAP_RING_SIZE;
+	}
+
+	for (i = *tail; i < head1; i++)
+		memcpy(&out[nr++], (void *) &ring->rec[i & (PCAP_RING_SIZE - 1)],
+		       sizeof(*out));
+
+	/* the writer may be overwriting record head2 - PCAP_RING_SIZE now */
+	__sync_synchronize();
+	head2 = ring->head;
+	if (head2 + 1 > *tail + PCAP_RING_SIZE) {
+		bad = head2 + 1 - PCAP_RING_SIZE - *tail;
+		if (bad > nr)
+			bad = nr;
+		memmove(out, out + bad, (nr - bad) * sizeof(*out));
+		nr -= bad;
+		*lost += bad;
+	}
+
+	*tail = head1;
+	return nr;
+}
+
+static int pcap_cmp_tsc(const void *a, const void *b)
+{
+	const struct pcap_rec *ra = a, *rb = b;
+
+	return ra->tsc < rb->tsc ? -1 : ra->tsc > rb->tsc;
+}
+
+static int pcap_write(const char *path)
+{
+	struct pcap_file_hdr fh;
+	struct ix_pcap *pcap;
+	struct pcap_rec *recs;
+	uint64_t *tails, lost = 0, written = 0;
+	unsigned int i, nr;
+	struct stat st;
+	FILE *out;
+	int fd;
+
+	fd = shm_open("/ix-pcap", O_RDONLY, 0);
+	if (fd == -1) {
+		perror("shm_open");
+		return 1;
+	}
+
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		return 1;
+	}
+
+	pcap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (pcap == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	if (pcap->ring_size != PCAP_RING_SIZE || pcap->snaplen != PCAP_SNAPLEN) {
+		fprintf(stderr, "ix-pcap: ring layout mismatch\n");
+		return 1;
+	}
+
+	out = strcmp(path, "-") ? fopen(path, "w") : stdout;
+	if (!out) {
+		perror("fopen");
+		return 1;
+	}
+
+	recs = malloc(pcap->cpus * PCAP_RING_SIZE * sizeof(*recs));
+	tails = calloc(pcap->cpus, sizeof(*tails));
+	if (!recs || !tails) {
+		perror("malloc");
+		return 1;
+	}
+
+	/* only frames captured from now on */
+	for (i = 0; i < pcap->cpus; i++)
+		tails[i] = pcap->ring[i].head;
+
+	fh.magic = PCAP_MAGIC_NS;
+	fh.version_major = 2;
+	fh.version_minor = 4;
+	fh.thiszone = 0;
+	fh.sigfigs = 0;
+	fh.snaplen = PCAP_SNAPLEN;
+	fh.linktype = PCAP_LINKTYPE_ETHERNET;
+	fwrite(&fh, sizeof(fh), 1, out);
+
+	signal(SIGINT, handle_sigint);
+	signal(SIGTERM, handle_sigint);
+
+	while (!stop) {
+		nr = 0;
+		for (i = 0; i < pcap->cpus; i++)
+			nr += pcap_drain_ring(&pcap->ring[i], &tails[i],
+					      recs + nr, &lost);
+
+		qsort(recs, nr, sizeof(*recs), pcap_cmp_tsc);
+		for (i = 0; i < nr; i++)
+			pcap_write_rec(out, pcap, &recs[i]);
+		written += nr;
+
+		if (!nr) {
+			fflush(out);
+			usleep(1000);
+		}
+	}
+
+	fclose(out);
+	fprintf(stderr, "ix-pcap: %lu frames written, %lu lost\n",
+		(unsigned long) written, (unsigned long) lost);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s -e N [-i IP] [-p PORT] [-R | -T] | -d | -w FILE\n", prog);
+	fprintf(stderr, "  -e N       capture 1 in N frames\n");
+	fprintf(stderr, "  -i IP      only frames from or to IP\n");
+	fprintf(stderr, "  -p PORT    only frames from or to PORT\n");
+	fprintf(stderr, "  -R, -T     only received (-R) or transmitted (-T) frames\n");
+	fprintf(stderr, "  -d         stop capturing\n");
+	fprintf(stderr, "  -w FILE    write captured frames to FILE ('-' for stdout) until interrupted\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct pcap_filter f = {
+		.dirs = PCAP_DIR_RX | PCAP_DIR_TX,
+	};
+	struct in_addr addr;
+	const char *path = NULL;
+	int opt, set = 0;
+
+	while ((opt = getopt(argc, argv, "e:i:p:RTdw:")) != -1) {
+		switch (opt) {
+		case 'e':
+			f.sample = strtoul(optarg, NULL, 0);
+			if (!f.sample) {
+				usage(argv[0]);
+				return 1;
+			}
+			set = 1;
+			break;
+		case 'i':
+			if (!inet_aton(optarg, &addr)) {
+				usage(argv[0]);
+				return 1;
+			}
+			f.ip = ntohl(addr.s_addr);
+			break;
+		case 'p':
+			f.port = strtoul(optarg, NULL, 0);
+			break;
+		case 'R':
+			f.dirs = PCAP_DIR_RX;
+			break;
+		case 'T':
+			f.dirs = PCAP_DIR_TX;
+			break;
+		case 'd':
+			f.sample = 0;
+			set = 1;
+			break;
+		case 'w':
+			path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((!set && !path) || optind != argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (set && pcap_set_filter(&f))
+		return 1;
+
+	if (path)
+		return pcap_write(path);
+
+	return 0;
+}
@@ -12,6 +12,7 @@
 #include <string.h>
 
 #include <ix/config.h>
+#include <ix/kstats.h>
 #include <ix/stats.h>
 
 // static void show_stat(const char *name, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
@@ -27,18 +28,10 @@
 	// puts("");
 // }
 
-#if !CONFIG_STATS
-
-int main(int argc, char **argv)
-{
-	fprintf(stderr, "%s: Error: CONFIG_STATS was disabled during compilation.\n", argv[0]);
-	return 1;
-}
-
-#else
-
 #define cpu_relax() asm volatile("pause")
 
+#if CONFIG_STATS
+
 static void __attribute__((unused)) show_histogram(const char *name, int min, int max, int buckets, long sum, unsigned int *bucket_arr)
 {
 	int i, from, to;
@@ -103,7 +96,7 @@ STATS
 #undef HISTOGRAM
 }
 
-int main(int argc, char **argv)
+static int stats_main(int argc, char **argv)
 {
 	int fd, i;
 	int reset = 0;
@@ -143,3 +136,297 @@ int main(int argc, char **argv)
 }
 
 #endif /* CONFIG_STATS */
+
+#define KSTATS_NR_VECTORS (sizeof(kstats) / sizeof(kstats_distr))
+
+static const char *kstats_names[KSTATS_NR_VECTORS];
+
+static void kstats_init_names(void)
+{
+	int n = 0;
+
+#undef DEF_KSTATS
+#define DEF_KSTATS(_c) kstats_names[n++] = #_c
+#include <ix/kstatvectors.h>
+#undef DEF_KSTATS
+}
+
+static void kstats_read(struct ix_kstats *shm, int cpu, struct kstats_snapshot *out)
+{
+	struct ix_kstats_percpu *pc = &shm->percpu[cpu];
+	uint64_t gen;
+
+	do {
+		gen = pc->gen;
+		asm volatile("" ::: "memory");
+		memcpy(out, &pc->snap[gen & 1], sizeof(*out));
+		asm volatile("" ::: "memory");
+	} while (gen != pc->gen);
+}
+
+/*
+ * kstats_accumulate_snapshot - acc += sign * snap
+ */
+static void kstats_accumulate_snapshot(struct kstats_snapshot *acc,
+				       const struct kstats_snapshot *snap,
+				       int sign)
+{
+	kstats_distr *a = (kstats_distr *) &acc->ks;
+	const kstats_distr *d = (const kstats_distr *) &snap->ks;
+	int i, j;
+
+	acc->tsc += sign * snap->tsc;
+	acc->packets += sign * snap->packets;
+	acc->hw_instructions += sign * snap->hw_instructions;
+	acc->llc_load_misses += sign * snap->llc_load_misses;
+	for (i = 0; i < KSTATS_BATCH_HISTOGRAM_SIZE; i++)
+		acc->batch_histogram[i] += sign * snap->batch_histogram[i];
+	for (i = 0; i < KSTATS_BACKLOG_HISTOGRAM_SIZE; i++)
+		acc->backlog_histogram[i] += sign * snap->backlog_histogram[i];
+
+	for (i = 0; i < KSTATS_NR_VECTORS; i++) {
+		a[i].count += sign * d[i].count;
+		a[i].tot_occ += sign * d[i].tot_occ;
+		a[i].tot_lat += sign * d[i].tot_lat;
+		for (j = 0; j < KSTATS_PMU_NR_EVENTS; j++)
+			a[i].pmu[j] += sign * d[i].pmu[j];
+		for (j = 0; j < KSTATS_HIST_BUCKETS; j++)
+			a[i].lat_hist[j] += sign * d[i].lat_hist[j];
+	}
+}
+
+static double kstats_percentile(const kstats_distr *d, double q, double cycles_per_us)
+{
+	uint64_t total = 0, target, sum = 0;
+	int i;
+
+	for (i = 0; i < KSTATS_HIST_BUCKETS; i++)
+		total += d->lat_hist[i];
+	if (!total)
+		return 0;
+
+	/* q = 1 is the last sample, not one past it */
+	target = q * total;
+	if (target >= total)
+		target = total - 1;
+
+	for (i = 0; i < KSTATS_HIST_BUCKETS - 1; i++) {
+		sum += d->lat_hist[i];
+		if (sum > target)
+			return kstats_hist_value(i + 1) / cycles_per_us;
+	}
+
+	return kstats_hist_value(KSTATS_HIST_BUCKETS - 1) / cycles_per_us;
+}
+
+/*
+ * kstats_selftest - checks kstats_percentile() on known histograms
+ *
+ * Returns 0 if all checks pass, otherwise 1.
+ */
+static int kstats_selftest(void)
+{
+	static kstats_distr d;
+	static const double qs[] = {0.5, 0.99, 0.999, 1};
+	uint64_t val = 2400;
+	double want, got;
+	int i, ret = 0;
+
+	/* with one value, every percentile is the bucket holding it */
+	d.count = 10;
+	d.lat_hist[kstats_hist_bucket(val)] = 10;
+	want = kstats_hist_value(kstats_hist_bucket(val) + 1);
+	for (i = 0; i < ARRAY_SIZE(qs); i++) {
+		got = kstats_percentile(&d, qs[i], 1);
+		if (got != want) {
+			fprintf(stderr, "kstats: p%g of 10 x %lu cycles is %.0f, "
+				"expected %.0f\n", qs[i] * 100, val, got, want);
+			ret = 1;
+		}
+	}
+
+	/* the maximum follows the largest sample */
+	d.count = 11;
+	d.lat_hist[kstats_hist_bucket(val * 4)] = 1;
+	want = kstats_hist_value(kstats_hist_bucket(val * 4) + 1);
+	got = kstats_percentile(&d, 1, 1);
+	if (got != want) {
+		fprintf(stderr, "kstats: max is %.0f, expected %.0f\n", got, want);
+		ret = 1;
+	}
+
+	if (kstats_percentile(&(kstats_distr) {0}, 1, 1) != 0) {
+		fprintf(stderr, "kstats: max of an empty histogram isn't 0\n");
+		ret = 1;
+	}
+
+	if (!ret)
+		printf("kstats: self-test passed\n");
+	return ret;
+}
+
+static double histogram_avg(const uint32_t *histogram, int size)
+{
+	uint64_t sum = 0, count = 0;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		sum += (uint64_t) histogram[i] * i;
+		count += histogram[i];
+	}
+
+	return count ? (double) sum / count : 0;
+}
+
+static void kstats_show_pmu(const struct kstats_snapshot *acc, uint32_t pmu_mask)
+{
+	static const char *pmu_names[] = KSTATS_PMU_NAMES;
+	const kstats_distr *d = (const kstats_distr *) &acc->ks;
+	int i, j;
+
+	printf("\n%-30s", "vector (per call)");
+	for (j = 0; j < KSTATS_PMU_NR_EVENTS; j++)
+		if (pmu_mask & (1 << j))
+			printf(" %13s", pmu_names[j]);
+	if ((pmu_mask & (1 << KSTATS_PMU_CYCLES)) &&
+	    (pmu_mask & (1 << KSTATS_PMU_INSTRUCTIONS)))
+		printf(" %6s", "IPC");
+	puts("");
+
+	for (i = 0; i < KSTATS_NR_VECTORS; i++) {
+		if (!d[i].count)
+			continue;
+		printf("%-30s", kstats_names[i]);
+		for (j = 0; j < KSTATS_PMU_NR_EVENTS; j++)
+			if (pmu_mask & (1 << j))
+				printf(" %13.1f", (double) d[i].pmu[j] / d[i].count);
+		if ((pmu_mask & (1 << KSTATS_PMU_CYCLES)) &&
+		    (pmu_mask & (1 << KSTATS_PMU_INSTRUCTIONS)))
+			printf(" %6.2f", d[i].pmu[KSTATS_PMU_CYCLES] ?
+			       (double) d[i].pmu[KSTATS_PMU_INSTRUCTIONS] /
+			       d[i].pmu[KSTATS_PMU_CYCLES] : 0);
+		puts("");
+	}
+}
+
+static void kstats_show(const struct kstats_snapshot *acc, double cycles_per_us)
+{
+	const kstats_distr *d = (const kstats_distr *) &acc->ks;
+	double span = acc->tsc;
+	int i;
+
+	if (span)
+		printf("kstats: %.1f%% idle, %.1f%% user, %lu pkts (%.0f/s), "
+		       "avg batch %.1f, avg backlog %.1f, HW instructions %lu, "
+		       "LLC load misses %lu\n",
+		       100 * acc->ks.idle.tot_lat / span,
+		       100 * acc->ks.user.tot_lat / span,
+		       acc->packets, acc->packets / (span / cycles_per_us / 1000000),
+		       histogram_avg(acc->batch_histogram, KSTATS_BATCH_HISTOGRAM_SIZE),
+		       histogram_avg(acc->backlog_histogram, KSTATS_BACKLOG_HISTOGRAM_SIZE),
+		       acc->hw_instructions, acc->llc_load_misses);
+
+	printf("%-30s %10s %6s %9s %9s %9s %9s %9s (us)\n", "vector", "count",
+	       "occ", "avg", "p50", "p99", "p99.9", "max");
+	for (i = 0; i < KSTATS_NR_VECTORS; i++) {
+		if (!d[i].count)
+			continue;
+		printf("%-30s %10lu %5.1f%% %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+		       kstats_names[i], d[i].count,
+		       span ? 100 * d[i].tot_occ / span : 0,
+		       d[i].tot_lat / cycles_per_us / d[i].count,
+		       kstats_percentile(&d[i], 0.5, cycles_per_us),
+		       kstats_percentile(&d[i], 0.99, cycles_per_us),
+		       kstats_percentile(&d[i], 0.999, cycles_per_us),
+		       kstats_percentile(&d[i], 1, cycles_per_us));
+	}
+}
+
+static void kstats_usage(void)
+{
+	fprintf(stderr, "Usage: ix-stats-show --kstats [-i SECONDS] [-c CPU]\n"
+		"  -i SECONDS  show the difference over an interval (default 1), 0 shows totals\n"
+		"  -c CPU      only show the given cpu instead of merging all of them\n");
+}
+
+static int kstats_main(int argc, char **argv)
+{
+	static struct kstats_snapshot acc, snap;
+	struct ix_kstats *shm;
+	int fd, c, i, cpu = -1;
+	unsigned int interval = 1;
+
+	while ((c = getopt(argc, argv, "i:c:h")) != -1) {
+		switch (c) {
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		default:
+			kstats_usage();
+			return 1;
+		}
+	}
+
+	fd = shm_open("/ix-kstats", O_RDONLY, 0);
+	if (fd == -1) {
+		perror("shm_open");
+		return 1;
+	}
+
+	shm = mmap(NULL, sizeof(struct ix_kstats), PROT_READ, MAP_SHARED, fd, 0);
+	if (shm == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	if (cpu >= (int) shm->cpus) {
+		fprintf(stderr, "ix-stats-show: invalid cpu %d\n", cpu);
+		return 1;
+	}
+
+	kstats_init_names();
+
+	if (interval) {
+		for (i = 0; i < shm->cpus; i++) {
+			if (cpu != -1 && i != cpu)
+				continue;
+			kstats_read(shm, i, &snap);
+			kstats_accumulate_snapshot(&acc, &snap, -1);
+		}
+		sleep(interval);
+	}
+
+	for (i = 0; i < shm->cpus; i++) {
+		if (cpu != -1 && i != cpu)
+			continue;
+		kstats_read(shm, i, &snap);
+		kstats_accumulate_snapshot(&acc, &snap, 1);
+	}
+
+	/* without a baseline the tsc values do not form a span */
+	if (!interval)
+		acc.tsc = 0;
+
+	kstats_show(&acc, shm->cycles_per_us);
+	if (shm->pmu_mask)
+		kstats_show_pmu(&acc, shm->pmu_mask);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "--kstats"))
+		return kstats_main(argc - 1, argv + 1);
+	if (argc > 1 && !strcmp(argv[1], "--kstats-selftest"))
+		return kstats_selftest();
+
+#if CONFIG_STATS
+	return stats_main(argc, argv);
+#else
+	fprintf(stderr, "%s: Error: CONFIG_STATS was disabled during compilation.\n", argv[0]);
+	return 1;
+#endif
+}
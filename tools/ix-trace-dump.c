@@ -0,0 +1,251 @@
+/*
+ * Copyright 2013-16 Board of Trustees of Stanford University
+ * Copyright 2013-16 Ecole Polytechnique Federale Lausanne (EPFL)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ix-trace-dump.c - dumps the per-core flight recorder as a Chrome trace
+ *
+ * The output can be loaded in chrome://tracing or Perfetto. Each core is
+ * shown as a thread; bpoll iterations and idle periods are slices, RX
+ * batch sizes a counter, and the remaining events instants.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <ix/control_plane.h>
+#include <ix/trace.h>
+
+volatile struct cp_shmem *cp_shmem;
+
+static const char *trace_names[] = {
+	[TRACE_BPOLL_ENTER]	= "bpoll",
+	[TRACE_BPOLL_EXIT]	= "bpoll",
+	[TRACE_RX_BATCH]	= "rx_batch",
+	[TRACE_TIMER]		= "timer",
+	[TRACE_MIGRATE_START]	= "migrate_start",
+	[TRACE_MIGRATE_END]	= "migrate_end",
+	[TRACE_IDLE_ENTER]	= "idle",
+	[TRACE_IDLE_EXIT]	= "idle",
+	[TRACE_DROP]		= "drop",
+};
+
+static const char *drop_reasons[] = {
+	[TRACE_DROP_FG_TRANSITION]	= "fg_transition",
+	[TRACE_DROP_NOBUFS]		= "nobufs",
+};
+
+struct trace_copy {
+	uint64_t nr;
+	struct trace_rec rec[TRACE_RING_SIZE];
+};
+
+/*
+ * The data plane keeps writing while we copy, so the copy is bracketed by
+ * two reads of head. Anything the writer may have reached in the meantime,
+ * including the slot it is writing right now, is discarded.
+ */
+static void trace_copy_ring(volatile struct ix_trace_ring *ring,
+			    struct trace_copy *copy)
+{
+	static struct trace_rec raw[TRACE_RING_SIZE];
+	uint64_t head1, head2, first, i;
+
+	head1 = ring->head;
+	__sync_synchronize();
+	memcpy(raw, (void *) ring->rec, sizeof(raw));
+	__sync_synchronize();
+	head2 = ring->head;
+
+	first = head2 >= TRACE_RING_SIZE ? head2 - TRACE_RING_SIZE + 1 : 0;
+	if (head1 >= TRACE_RING_SIZE && first < head1 - TRACE_RING_SIZE)
+		first = head1 - TRACE_RING_SIZE;
+	if (first > head1)
+		first = head1;
+
+	copy->nr = 0;
+	for (i = first; i < head1; i++)
+		copy->rec[copy->nr++] = raw[i & (TRACE_RING_SIZE - 1)];
+}
+
+static void trace_print(struct trace_copy *copies, unsigned int cpus,
+			unsigned int cycles_per_us)
+{
+	uint64_t min_tsc = UINT64_MAX;
+	struct trace_rec *rec;
+	unsigned int cpu;
+	uint64_t i;
+	double ts;
+	int first = 1;
+
+	for (cpu = 0; cpu < cpus; cpu++)
+		if (copies[cpu].nr && copies[cpu].rec[0].tsc < min_tsc)
+			min_tsc = copies[cpu].rec[0].tsc;
+
+	printf("{\"traceEvents\":[\n");
+	for (cpu = 0; cpu < cpus; cpu++) {
+		for (i = 0; i < copies[cpu].nr; i++) {
+			rec = &copies[cpu].rec[i];
+			if (rec->type >= TRACE_NR_TYPES)
+				continue;
+
+			ts = (double) (rec->tsc - min_tsc) / cycles_per_us;
+			printf("%s{\"name\":\"%s\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,",
+			       first ? "" : ",\n", trace_names[rec->type], cpu, ts);
+			first = 0;
+
+			switch (rec->type) {
+			case TRACE_BPOLL_ENTER:
+				printf("\"ph\":\"B\",\"args\":{\"nr\":%u}}", rec->arg);
+				break;
+			case TRACE_BPOLL_EXIT:
+				printf("\"ph\":\"E\",\"args\":{\"events\":%u}}", rec->arg);
+				break;
+			case TRACE_IDLE_ENTER:
+				printf("\"ph\":\"B\"}");
+				break;
+			case TRACE_IDLE_EXIT:
+				printf("\"ph\":\"E\"}");
+				break;
+			case TRACE_RX_BATCH:
+				printf("\"ph\":\"C\",\"args\":{\"pkts\":%u}}", rec->arg);
+				break;
+			case TRACE_TIMER:
+				printf("\"ph\":\"i\",\"s\":\"t\",\"args\":{\"fg\":%d}}", (int) rec->arg);
+				break;
+			case TRACE_MIGRATE_START:
+				printf("\"ph\":\"i\",\"s\":\"t\",\"args\":{\"target\":%u}}", rec->arg);
+				break;
+			case TRACE_MIGRATE_END:
+				printf("\"ph\":\"i\",\"s\":\"t\",\"args\":{\"backlog\":%u}}", rec->arg);
+				break;
+			case TRACE_DROP:
+				printf("\"ph\":\"i\",\"s\":\"t\",\"args\":{\"reason\":\"%s\"}}",
+				       rec->arg < sizeof(drop_reasons) / sizeof(drop_reasons[0]) ?
+				       drop_reasons[rec->arg] : "unknown");
+				break;
+			}
+		}
+	}
+	printf("\n]}\n");
+}
+
+static int trace_set_mask(uint32_t mask)
+{
+	int fd;
+
+	fd = shm_open("/ix", O_RDWR, 0);
+	if (fd == -1) {
+		perror("shm_open");
+		return 1;
+	}
+
+	cp_shmem = mmap(NULL, sizeof(struct cp_shmem), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if (cp_shmem == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	cp_shmem->trace_mask = mask;
+	return 0;
+}
+
+static int trace_dump(void)
+{
+	struct ix_trace *trace;
+	struct trace_copy *copies;
+	struct stat st;
+	unsigned int i;
+	int fd;
+
+	fd = shm_open("/ix-trace", O_RDONLY, 0);
+	if (fd == -1) {
+		perror("shm_open");
+		return 1;
+	}
+
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		return 1;
+	}
+
+	trace = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (trace == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	if (trace->ring_size != TRACE_RING_SIZE) {
+		fprintf(stderr, "ix-trace-dump: ring size mismatch (%u != %u)\n",
+			trace->ring_size, TRACE_RING_SIZE);
+		return 1;
+	}
+
+	copies = malloc(trace->cpus * sizeof(*copies));
+	if (!copies) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (i = 0; i < trace->cpus; i++)
+		trace_copy_ring(&trace->ring[i], &copies[i]);
+
+	trace_print(copies, trace->cpus, trace->cycles_per_us);
+	free(copies);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-e [MASK] | -d]\n", prog);
+	fprintf(stderr, "  (no option)  write the recorded events as Chrome trace JSON to stdout\n");
+	fprintf(stderr, "  -e [MASK]    start recording the events in MASK (default: all)\n");
+	fprintf(stderr, "  -d           stop recording\n");
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t mask;
+
+	if (argc == 1)
+		return trace_dump();
+
+	if (!strcmp(argv[1], "-e") && argc <= 3) {
+		mask = argc == 3 ? strtoul(argv[2], NULL, 0) :
+				   (1 << TRACE_NR_TYPES) - 1;
+		return trace_set_mask(mask);
+	}
+
+	if (!strcmp(argv[1], "-d") && argc == 2)
+		return trace_set_mask(0);
+
+	usage(argv[0]);
+	return 1;
+}